@@ -0,0 +1,205 @@
+// acpi.c
+
+#include "acpi.h"
+#include "klib.h"
+
+// External functions from kernel
+extern void print(const char* str);
+extern void print_dec(unsigned int n);
+
+// Root System Description Pointer
+struct rsdp {
+    char signature[8];          // "RSD PTR "
+    unsigned char checksum;
+    char oem_id[6];
+    unsigned char revision;
+    unsigned int rsdt_address;
+} __attribute__((packed));
+
+// Header shared by all system description tables
+struct sdt_header {
+    char signature[4];
+    unsigned int length;
+    unsigned char revision;
+    unsigned char checksum;
+    char oem_id[6];
+    char oem_table_id[8];
+    unsigned int oem_revision;
+    unsigned int creator_id;
+    unsigned int creator_revision;
+} __attribute__((packed));
+
+// MADT: header, local APIC address, flags, then variable-length entries
+struct madt {
+    struct sdt_header header;
+    unsigned int lapic_address;
+    unsigned int flags;
+} __attribute__((packed));
+
+struct madt_entry {
+    unsigned char type;
+    unsigned char length;
+} __attribute__((packed));
+
+#define MADT_PCAT_COMPAT    0x1
+
+#define MADT_LAPIC          0
+#define MADT_IOAPIC         1
+#define MADT_OVERRIDE       2
+#define MADT_LAPIC_ENABLED  0x1
+
+struct madt_lapic {
+    struct madt_entry entry;
+    unsigned char acpi_id;
+    unsigned char apic_id;
+    unsigned int flags;
+} __attribute__((packed));
+
+struct madt_ioapic {
+    struct madt_entry entry;
+    unsigned char ioapic_id;
+    unsigned char reserved;
+    unsigned int address;
+    unsigned int gsi_base;
+} __attribute__((packed));
+
+// An ISA IRQ wired to a different global interrupt, or with
+// non-default polarity or trigger mode
+struct madt_override {
+    struct madt_entry entry;
+    unsigned char bus;
+    unsigned char source;
+    unsigned int gsi;
+    unsigned short flags;
+} __attribute__((packed));
+
+// Where the BIOS may put the RSDP
+#define EBDA_SEGMENT_PTR    0x40E
+#define BIOS_ROM_START      0xE0000
+#define BIOS_ROM_END        0x100000
+
+static struct madt_info madt_info;
+static int madt_found = 0;
+
+// Bytes of a valid table sum to zero
+static int checksum_ok(const void* table, unsigned int length) {
+    const unsigned char* bytes = (const unsigned char*)table;
+    unsigned char sum = 0;
+    for (unsigned int i = 0; i < length; i++) {
+        sum += bytes[i];
+    }
+    return sum == 0;
+}
+
+// Scan a range on 16-byte boundaries for the RSDP
+static struct rsdp* rsdp_scan(unsigned int start, unsigned int end) {
+    for (unsigned int addr = start; addr + sizeof(struct rsdp) <= end; addr += 16) {
+        struct rsdp* rsdp = (struct rsdp*)addr;
+        if (memcmp(rsdp->signature, "RSD PTR ", 8) == 0 &&
+            checksum_ok(rsdp, sizeof(struct rsdp))) {
+            return rsdp;
+        }
+    }
+    return 0;
+}
+
+static struct rsdp* rsdp_find() {
+    // First KB of the Extended BIOS Data Area, then the BIOS ROM
+    unsigned int ebda = *(volatile unsigned short*)EBDA_SEGMENT_PTR << 4;
+    struct rsdp* rsdp = 0;
+    if (ebda) {
+        rsdp = rsdp_scan(ebda, ebda + 1024);
+    }
+    if (!rsdp) {
+        rsdp = rsdp_scan(BIOS_ROM_START, BIOS_ROM_END);
+    }
+    return rsdp;
+}
+
+static void madt_parse(struct madt* madt) {
+    madt_info.lapic_address = madt->lapic_address;
+    madt_info.cpu_count = 0;
+    madt_info.pcat_compat = madt->flags & MADT_PCAT_COMPAT;
+    madt_info.ioapic_address = 0;
+    
+    // ISA IRQs are identity mapped, edge triggered, active high unless
+    // an override says otherwise
+    for (int i = 0; i < ISA_IRQS; i++) {
+        madt_info.isa_gsi[i] = i;
+        madt_info.isa_flags[i] = 0;
+    }
+    
+    unsigned int pos = (unsigned int)madt + sizeof(struct madt);
+    unsigned int end = (unsigned int)madt + madt->header.length;
+    while (pos + sizeof(struct madt_entry) <= end) {
+        struct madt_entry* entry = (struct madt_entry*)pos;
+        if (entry->length < sizeof(struct madt_entry)) {
+            break;  // Corrupt table
+        }
+        
+        if (entry->type == MADT_LAPIC) {
+            struct madt_lapic* cpu = (struct madt_lapic*)entry;
+            if ((cpu->flags & MADT_LAPIC_ENABLED) && madt_info.cpu_count < MAX_CPUS) {
+                madt_info.apic_ids[madt_info.cpu_count++] = cpu->apic_id;
+            }
+        } else if (entry->type == MADT_IOAPIC) {
+            // Only the first IOAPIC is used; PCs route ISA IRQs through it
+            struct madt_ioapic* ioapic = (struct madt_ioapic*)entry;
+            if (!madt_info.ioapic_address) {
+                madt_info.ioapic_address = ioapic->address;
+                madt_info.ioapic_gsi_base = ioapic->gsi_base;
+            }
+        } else if (entry->type == MADT_OVERRIDE) {
+            struct madt_override* override = (struct madt_override*)entry;
+            if (override->bus == 0 && override->source < ISA_IRQS) {
+                madt_info.isa_gsi[override->source] = override->gsi;
+                madt_info.isa_flags[override->source] = override->flags;
+            }
+        }
+        pos += entry->length;
+    }
+}
+
+// Find the MADT through the RSDP and RSDT. Runs before paging is on,
+// since the tables may sit above the kernel identity map.
+// Returns 0 if the MADT was found.
+int acpi_init() {
+    struct rsdp* rsdp = rsdp_find();
+    if (!rsdp) {
+        print("ACPI: no RSDP\n");
+        return -1;
+    }
+    
+    struct sdt_header* rsdt = (struct sdt_header*)rsdp->rsdt_address;
+    if (memcmp(rsdt->signature, "RSDT", 4) != 0 || !checksum_ok(rsdt, rsdt->length)) {
+        print("ACPI: bad RSDT\n");
+        return -1;
+    }
+    
+    unsigned int* tables = (unsigned int*)((unsigned int)rsdt + sizeof(struct sdt_header));
+    unsigned int count = (rsdt->length - sizeof(struct sdt_header)) / 4;
+    for (unsigned int i = 0; i < count; i++) {
+        struct sdt_header* table = (struct sdt_header*)tables[i];
+        if (memcmp(table->signature, "APIC", 4) == 0 && checksum_ok(table, table->length)) {
+            madt_parse((struct madt*)table);
+            madt_found = 1;
+            
+            print("ACPI: ");
+            print_dec(madt_info.cpu_count);
+            print(" CPUs in MADT");
+            if (madt_info.ioapic_address) {
+                print(", IOAPIC present");
+            }
+            print("\n");
+            return 0;
+        }
+    }
+    
+    print("ACPI: no MADT\n");
+    return -1;
+}
+
+// Parsed MADT, or 0 if there is none
+const struct madt_info* acpi_madt() {
+    return madt_found ? &madt_info : 0;
+}
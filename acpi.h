@@ -0,0 +1,33 @@
+// acpi.h
+
+#ifndef ACPI_H
+#define ACPI_H
+
+#include "smp.h"
+
+// Legacy ISA interrupt lines
+#define ISA_IRQS 16
+
+// MPS INTI flags of an interrupt source override
+#define MPS_POLARITY_MASK   0x3
+#define MPS_POLARITY_LOW    0x3
+#define MPS_TRIGGER_MASK    0xC
+#define MPS_TRIGGER_LEVEL   0xC
+
+// What the kernel needs from the MADT (ACPI "APIC" table)
+struct madt_info {
+    unsigned int lapic_address;             // Physical address of the local APICs
+    unsigned int cpu_count;                 // Enabled processors found
+    unsigned char apic_ids[MAX_CPUS];       // Their local APIC IDs
+    int pcat_compat;                        // 8259 PICs are present too
+    unsigned int ioapic_address;            // First IOAPIC, 0 if none
+    unsigned int ioapic_gsi_base;           // First global interrupt it handles
+    unsigned int isa_gsi[ISA_IRQS];         // Global interrupt of each ISA IRQ
+    unsigned short isa_flags[ISA_IRQS];     // MPS INTI flags of each ISA IRQ
+};
+
+// Functions
+int acpi_init();
+const struct madt_info* acpi_madt();
+
+#endif
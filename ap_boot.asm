@@ -0,0 +1,80 @@
+; ap_boot.asm
+; Real mode entry point of the application processors. smp_init() copies
+; everything between ap_trampoline_start and ap_trampoline_end to
+; AP_TRAMPOLINE and fills in the parameter block before each startup IPI.
+
+[BITS 16]
+
+AP_TRAMPOLINE equ 0x7000
+
+; Address of a trampoline label once copied
+%define TRAMP(label) (AP_TRAMPOLINE + (label) - ap_trampoline_start)
+
+section .text
+
+global ap_trampoline_start
+global ap_trampoline_end
+global ap_boot_params
+
+ap_trampoline_start:
+    cli
+    cld
+    xor ax, ax
+    mov ds, ax
+    
+    ; Flat segments, then protected mode
+    lgdt [TRAMP(ap_gdt_descriptor)]
+    mov eax, cr0
+    or eax, 1
+    mov cr0, eax
+    jmp dword 0x08:TRAMP(ap_protected)
+
+[BITS 32]
+ap_protected:
+    mov ax, 0x10
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
+    mov ss, ax
+    
+    ; Same paging setup as the boot CPU
+    mov eax, [TRAMP(ap_boot_params) + 4]    ; cr4
+    mov cr4, eax
+    mov eax, [TRAMP(ap_boot_params)]        ; cr3
+    mov cr3, eax
+    mov eax, cr0
+    or eax, 0x80010000                      ; PG | WP
+    mov cr0, eax
+    
+    ; Kernel stack allocated for this CPU, then into C
+    mov esp, [TRAMP(ap_boot_params) + 8]    ; stack
+    push dword [TRAMP(ap_boot_params) + 12] ; cpu id
+    mov eax, [TRAMP(ap_boot_params) + 16]   ; entry
+    call eax
+    
+.hang:
+    cli
+    hlt
+    jmp .hang
+
+align 8
+ap_gdt:
+    dd 0x0, 0x0
+    dd 0x0000FFFF, 0x00CF9A00   ; Code: base 0, limit 4GB, ring 0
+    dd 0x0000FFFF, 0x00CF9200   ; Data: base 0, limit 4GB, ring 0
+
+ap_gdt_descriptor:
+    dw 23
+    dd TRAMP(ap_gdt)
+
+; struct ap_boot_params in smp.c
+align 4
+ap_boot_params:
+    dd 0    ; cr3
+    dd 0    ; cr4
+    dd 0    ; stack
+    dd 0    ; cpu id
+    dd 0    ; entry
+
+ap_trampoline_end:
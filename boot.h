@@ -0,0 +1,72 @@
+// boot.h
+
+#ifndef BOOT_H
+#define BOOT_H
+
+// Boot information block filled in by boot.asm in real mode.
+// Its address is passed to kernel_main in EBX.
+#define BOOT_INFO_ADDR 0x8000
+
+// Disk layout: boot sector (boot.asm), stage 2 loader (stage2.asm), then
+// the kernel image. Stage 2 learns the kernel's size from its header
+// (kernel_entry.asm) and loads it above 1MB.
+#define STAGE2_SECTORS      4
+#define STAGE2_ADDR         0x1000
+#define KERNEL_LBA          (1 + STAGE2_SECTORS)
+#define KERNEL_ADDR         0x100000
+#define KERNEL_MAGIC        0x4C4E524B  // "KRNL"
+
+// An LZ4-packed kernel image (see user/mklz4.c) starts with this header
+// instead, followed by one LZ4 block that unpacks to the plain image.
+// Stage 2 reads it above the kernel's .bss and unpacks it into place.
+#define KERNEL_LZ4_MAGIC    0x345A4C4B  // "KLZ4"
+
+struct kernel_lz4_header {
+    unsigned int magic;
+    unsigned int packed_size;   // Bytes of LZ4 data after the header
+    unsigned int image_end;     // Copied from the plain image's header
+    unsigned int bss_end;
+};
+
+// Program package (see pkg.h): the disk sectors right after the kernel
+// image, loaded to free low memory below the kernel's boot stack
+#define PROGRAMS_SECTORS    64
+#define PROGRAMS_ADDR       0x40000
+#define PROGRAMS_SIZE       (PROGRAMS_SECTORS * 512)
+
+// BIOS E820 memory map
+#define E820_MAX        32
+#define E820_USABLE     1
+#define E820_RESERVED   2
+#define E820_ACPI       3
+#define E820_NVS        4
+#define E820_BAD        5
+
+struct e820_entry {
+    unsigned long long base;    // Physical start address
+    unsigned long long length;  // Length in bytes
+    unsigned int type;          // E820_USABLE, E820_RESERVED, ...
+    unsigned int acpi;          // ACPI 3.0 extended attributes
+} __attribute__((packed));
+
+// How stage 2 read the disk
+#define BOOT_LOAD_CHS       0   // INT 13h AH=02h, a track at a time
+#define BOOT_LOAD_EDD       1   // INT 13h extensions, AH=42h LBA reads
+#define BOOT_LOAD_MULTIBOOT 2   // Not stage 2: see multiboot.h. Only the
+                                // memory map is filled in.
+
+struct boot_info {
+    unsigned int mmap_count;            // Valid entries in mmap
+    struct e820_entry mmap[E820_MAX];
+    unsigned int boot_drive;            // BIOS drive number
+    unsigned int load_method;           // BOOT_LOAD_CHS or BOOT_LOAD_EDD
+    unsigned int kernel_sectors;        // Kernel image size on disk
+    unsigned long long load_start_tsc;  // TSC before and after stage 2
+    unsigned long long load_end_tsc;    // read the kernel and package
+    unsigned int kernel_packed;         // 1 if the image was LZ4-packed
+    unsigned int unpack_cycles;         // TSC cycles spent unpacking it
+    unsigned long long stage1_tsc;      // TSC when boot.asm started
+    unsigned long long pmode_tsc;       // and when stage 2 left real mode
+} __attribute__((packed));
+
+#endif
@@ -0,0 +1,78 @@
+// boottime.c
+
+#include "boottime.h"
+#include "cpu.h"
+#include "timer.h"
+#include "klib.h"
+
+// External functions from kernel
+extern void print(const char* str);
+extern void print_dec(unsigned int n);
+extern void print_padded(unsigned int n, unsigned int width);
+extern unsigned int cycles_to_us(unsigned long long cycles, unsigned int khz);
+
+struct boot_mark {
+    const char* phase;      // Ending at tsc; 0 for the first mark
+    unsigned long long start;
+    unsigned long long tsc;
+};
+
+static struct boot_mark marks[BOOT_MARKS];
+static unsigned int mark_count = 0;
+
+static void add_mark(const char* phase, unsigned long long start, unsigned long long tsc) {
+    if (mark_count < BOOT_MARKS) {
+        marks[mark_count].phase = phase;
+        marks[mark_count].start = start;
+        marks[mark_count].tsc = tsc;
+        mark_count++;
+    }
+}
+
+// Take over the loader's timestamps. Call first thing in kernel_main.
+// Multiboot loaders leave none, so timing starts at the kernel.
+void boottime_start(const struct boot_info* info) {
+    unsigned long long now = rdtsc();
+    if (info->load_method != BOOT_LOAD_MULTIBOOT && info->stage1_tsc &&
+        info->stage1_tsc < now) {
+        add_mark(0, info->stage1_tsc, info->stage1_tsc);
+        add_mark("stage 1: read stage 2", info->stage1_tsc, info->load_start_tsc);
+        add_mark("stage 2: read kernel", info->load_start_tsc, info->load_end_tsc);
+        add_mark("stage 2: memory map", info->load_end_tsc, info->pmode_tsc);
+        add_mark("kernel entry", info->pmode_tsc, now);
+    } else {
+        add_mark(0, now, now);
+    }
+}
+
+// Record that the phase named ends now
+void boottime_mark(const char* phase) {
+    unsigned long long now = rdtsc();
+    add_mark(phase, mark_count ? marks[mark_count - 1].tsc : now, now);
+}
+
+// Record a phase that started at start and ends now, for work that does
+// not follow straight on from the previous mark
+void boottime_phase(const char* phase, unsigned long long start) {
+    add_mark(phase, start, rdtsc());
+}
+
+// Per-phase durations, and when each phase ended since the first mark
+void boottime_print() {
+    unsigned int khz = timer_tsc_khz();
+    if (mark_count < 2 || khz == 0) {
+        print("No boot timestamps\n");
+        return;
+    }
+
+    print("PHASE                         us     AT ms\n");
+    for (unsigned int i = 1; i < mark_count; i++) {
+        print(marks[i].phase);
+        for (unsigned int n = strlen(marks[i].phase); n < 22; n++) {
+            print(" ");
+        }
+        print_padded(cycles_to_us(marks[i].tsc - marks[i].start, khz), 10);
+        print_padded(cycles_to_us(marks[i].tsc - marks[0].tsc, khz) / 1000, 10);
+        print("\n");
+    }
+}
@@ -0,0 +1,19 @@
+// boottime.h
+
+#ifndef BOOTTIME_H
+#define BOOTTIME_H
+
+#include "boot.h"
+
+// Boot phase timestamps: the loader's, from boot_info, then one per
+// kernel_main init step. A phase runs from the previous mark to its own,
+// or from the start given to boottime_phase().
+#define BOOT_MARKS 24
+
+// Functions
+void boottime_start(const struct boot_info* info);
+void boottime_mark(const char* phase);
+void boottime_phase(const char* phase, unsigned long long start);
+void boottime_print();
+
+#endif
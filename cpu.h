@@ -0,0 +1,125 @@
+// cpu.h
+
+#ifndef CPU_H
+#define CPU_H
+
+// CPUID leaf 1 EDX feature bits
+#define CPUID_PSE   (1 << 3)
+#define CPUID_TSC   (1 << 4)
+#define CPUID_MSR   (1 << 5)
+#define CPUID_APIC  (1 << 9)
+#define CPUID_SEP   (1 << 11)   // SYSENTER/SYSEXIT
+#define CPUID_PGE   (1 << 13)
+#define CPUID_FXSR  (1 << 24)
+#define CPUID_SSE   (1 << 25)
+#define CPUID_SSE2  (1 << 26)
+
+// EFLAGS bits
+#define EFLAGS_IF   0x00000200
+
+// Control register bits
+#define CR0_MP      0x00000002  // WAIT/FWAIT honours TS
+#define CR0_EM      0x00000004  // No FPU: FPU instructions trap
+#define CR0_TS      0x00000008  // Task switched: next FPU use traps (#NM)
+#define CR0_NE      0x00000020  // Native FPU error reporting
+#define CR0_WP      0x00010000  // Read-only pages apply to ring 0 too
+#define CR0_PG      0x80000000
+#define CR4_PSE     0x00000010
+#define CR4_PGE     0x00000080
+#define CR4_OSFXSR  0x00000200  // fxsave/fxrstor and SSE enabled
+#define CR4_OSXMMEXCPT 0x00000400   // SSE exceptions raise #XM
+
+static inline void cpuid(unsigned int leaf, unsigned int* eax, unsigned int* ebx,
+                         unsigned int* ecx, unsigned int* edx) {
+    asm volatile("cpuid"
+                 : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx)
+                 : "a"(leaf), "c"(0));
+}
+
+static inline unsigned int read_cr0() {
+    unsigned int val;
+    asm volatile("mov %%cr0, %0" : "=r"(val));
+    return val;
+}
+
+static inline void write_cr0(unsigned int val) {
+    asm volatile("mov %0, %%cr0" : : "r"(val) : "memory");
+}
+
+static inline unsigned int read_cr2() {
+    unsigned int val;
+    asm volatile("mov %%cr2, %0" : "=r"(val));
+    return val;
+}
+
+static inline unsigned int read_cr3() {
+    unsigned int val;
+    asm volatile("mov %%cr3, %0" : "=r"(val));
+    return val;
+}
+
+static inline void write_cr3(unsigned int val) {
+    asm volatile("mov %0, %%cr3" : : "r"(val) : "memory");
+}
+
+static inline unsigned int read_cr4() {
+    unsigned int val;
+    asm volatile("mov %%cr4, %0" : "=r"(val));
+    return val;
+}
+
+static inline void write_cr4(unsigned int val) {
+    asm volatile("mov %0, %%cr4" : : "r"(val) : "memory");
+}
+
+// Disable interrupts, returning the previous EFLAGS
+static inline unsigned int irq_save() {
+    unsigned int flags;
+    asm volatile("pushf; pop %0; cli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+// Re-enable interrupts if they were enabled before irq_save()
+static inline void irq_restore(unsigned int flags) {
+    if (flags & EFLAGS_IF) {
+        asm volatile("sti" : : : "memory");
+    }
+}
+
+// Read the time stamp counter
+static inline unsigned long long rdtsc() {
+    unsigned int lo, hi;
+    asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((unsigned long long)hi << 32) | lo;
+}
+
+// 64-by-32 bit division without libgcc's __udivdi3
+static inline unsigned long long div64(unsigned long long n, unsigned int d) {
+    unsigned int hi = n >> 32;
+    unsigned int lo = n;
+    unsigned int q_hi = hi / d;
+    unsigned int q_lo, r;
+    asm("divl %4" : "=a"(q_lo), "=d"(r) : "a"(lo), "d"(hi % d), "rm"(d));
+    return ((unsigned long long)q_hi << 32) | q_lo;
+}
+
+static inline unsigned long long rdmsr(unsigned int msr) {
+    unsigned int lo, hi;
+    asm volatile("rdmsr" : "=a"(lo), "=d"(hi) : "c"(msr));
+    return ((unsigned long long)hi << 32) | lo;
+}
+
+static inline void wrmsr(unsigned int msr, unsigned long long val) {
+    asm volatile("wrmsr" : : "c"(msr), "a"((unsigned int)val), "d"((unsigned int)(val >> 32)));
+}
+
+// Spin-wait hint
+static inline void cpu_relax() {
+    asm volatile("pause" : : : "memory");
+}
+
+static inline void invlpg(unsigned int addr) {
+    asm volatile("invlpg (%0)" : : "r"(addr) : "memory");
+}
+
+#endif
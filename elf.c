@@ -0,0 +1,106 @@
+// elf.c
+
+#include "elf.h"
+#include "fs.h"
+#include "paging.h"
+#include "memory.h"
+#include "process.h"
+#include "klib.h"
+
+// External functions from kernel
+extern void print(const char* str);
+
+// Whether [vaddr, vaddr + size) lies where programs may load: above the
+// kernel, below the user stack
+static int user_segment(unsigned int vaddr, unsigned int size) {
+    unsigned int limit = USER_STACK_TOP - USER_STACK_SIZE;
+    return vaddr >= USER_CODE_BASE && vaddr <= limit && size <= limit - vaddr;
+}
+
+// Map one PT_LOAD segment into a page directory, reading its contents
+// from the file a page at a time. Pages shared with an earlier segment
+// are reused. Returns 0 on success.
+static int load_segment(unsigned int directory, const char* name, const struct elf_phdr* ph) {
+    unsigned int flags = PAGE_USER | (ph->flags & PF_W ? PAGE_WRITE : 0);
+    unsigned int file_end = ph->vaddr + ph->filesz;
+    unsigned int mem_end = ph->vaddr + ph->memsz;
+    
+    for (unsigned int page = ph->vaddr & ~(PAGE_SIZE - 1); page < mem_end; page += PAGE_SIZE) {
+        unsigned int frame = paging_get_page(directory, page);
+        if (!frame) {
+            void* fresh = frame_alloc();
+            if (!fresh) {
+                return -1;
+            }
+            memset(fresh, 0, PAGE_SIZE);
+            if (paging_map_page(directory, page, (unsigned int)fresh, flags) != 0) {
+                frame_free(fresh);
+                return -1;
+            }
+            frame = (unsigned int)fresh;
+        } else if (flags & PAGE_WRITE) {
+            // Writable if either segment sharing the page is
+            paging_map_page(directory, page, frame, flags);
+        }
+        
+        // Part of this page backed by the file
+        unsigned int start = page > ph->vaddr ? page : ph->vaddr;
+        unsigned int end = page + PAGE_SIZE < file_end ? page + PAGE_SIZE : file_end;
+        if (start < end) {
+            unsigned int length = end - start;
+            if (fs_read_at(name, ph->offset + (start - ph->vaddr),
+                           (void*)(frame + (start - page)), length) != (int)length) {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+// Start the ELF32 executable in file name as a ring 3 process. Returns
+// its PID, or -1.
+int elf_exec(const char* name) {
+    struct elf_header header;
+    if (fs_read_at(name, 0, &header, sizeof(header)) != sizeof(header)) {
+        print("No such program\n");
+        return -1;
+    }
+    
+    if (*(unsigned int*)header.ident != ELF_MAGIC || header.ident[4] != ELFCLASS32 ||
+        header.ident[5] != ELFDATA2LSB || header.type != ET_EXEC ||
+        header.machine != EM_386 || header.phentsize != sizeof(struct elf_phdr) ||
+        !user_segment(header.entry, 1)) {
+        print("Not an i386 ELF executable\n");
+        return -1;
+    }
+    
+    struct pcb* p = process_new_user(name);
+    if (!p) {
+        return -1;
+    }
+    
+    for (unsigned int i = 0; i < header.phnum; i++) {
+        struct elf_phdr ph;
+        if (fs_read_at(name, header.phoff + i * sizeof(ph), &ph, sizeof(ph)) != sizeof(ph)) {
+            print("Truncated ELF file\n");
+            process_discard(p);
+            return -1;
+        }
+        if (ph.type != PT_LOAD || ph.memsz == 0) {
+            continue;
+        }
+        
+        if (ph.filesz > ph.memsz || !user_segment(ph.vaddr, ph.memsz)) {
+            print("Bad ELF segment\n");
+            process_discard(p);
+            return -1;
+        }
+        if (load_segment(p->cr3, name, &ph) != 0) {
+            print("Could not load ELF segment\n");
+            process_discard(p);
+            return -1;
+        }
+    }
+    
+    return process_start_user(p, header.entry);
+}
@@ -0,0 +1,47 @@
+// elf.h
+
+#ifndef ELF_H
+#define ELF_H
+
+// ELF32 file header
+struct elf_header {
+    unsigned char ident[16];    // Magic, class, data encoding, version
+    unsigned short type;
+    unsigned short machine;
+    unsigned int version;
+    unsigned int entry;         // Virtual address of the entry point
+    unsigned int phoff;         // Program header table file offset
+    unsigned int shoff;
+    unsigned int flags;
+    unsigned short ehsize;
+    unsigned short phentsize;
+    unsigned short phnum;
+    unsigned short shentsize;
+    unsigned short shnum;
+    unsigned short shstrndx;
+} __attribute__((packed));
+
+// ELF32 program header
+struct elf_phdr {
+    unsigned int type;
+    unsigned int offset;        // Segment contents in the file
+    unsigned int vaddr;
+    unsigned int paddr;
+    unsigned int filesz;        // Bytes in the file...
+    unsigned int memsz;         // ...and in memory, the rest zeroed
+    unsigned int flags;
+    unsigned int align;
+} __attribute__((packed));
+
+#define ELF_MAGIC       0x464C457F  // "\x7F" "ELF"
+#define ELFCLASS32      1
+#define ELFDATA2LSB     1
+#define ET_EXEC         2
+#define EM_386          3
+#define PT_LOAD         1
+#define PF_W            0x2
+
+// Functions
+int elf_exec(const char* name);
+
+#endif
@@ -0,0 +1,177 @@
+// fpu.c
+
+#include "fpu.h"
+#include "process.h"
+#include "cpu.h"
+#include "smp.h"
+
+// External functions from kernel
+extern void print(const char* str);
+extern void print_dec(unsigned int n);
+
+// FPU state is switched lazily. A switch only sets CR0.TS; the first FPU
+// or SSE instruction of the next process then traps (#NM), and only then
+// is the state of the previous user saved and the new one loaded.
+// Processes that never touch the FPU never trap.
+
+static int fxsr = 0;
+
+// State after fninit with the default MXCSR, loaded on a process's first use
+static struct fpu_state initial_state;
+
+// Statistics
+static unsigned int nm_traps = 0;
+static unsigned int fpu_restores = 0;
+static unsigned int fpu_saves = 0;
+
+static inline void fxsave(struct fpu_state* state) {
+    asm volatile("fxsave %0" : "=m"(*state));
+}
+
+static inline void fxrstor(struct fpu_state* state) {
+    asm volatile("fxrstor %0" : : "m"(*state));
+}
+
+static inline void clts() {
+    asm volatile("clts");
+}
+
+static inline void stts() {
+    write_cr0(read_cr0() | CR0_TS);
+}
+
+// Enable the FPU and SSE on this CPU, with TS set so the first use
+// traps. Called on every CPU, the boot CPU first.
+void fpu_init() {
+    unsigned int eax, ebx, ecx, edx;
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    
+    // Without fxsave there is no way to switch SSE state: keep it off
+    if (!(edx & CPUID_FXSR) || !(edx & CPUID_SSE)) {
+        write_cr0(read_cr0() | CR0_EM);
+        if (this_cpu()->id == 0) {
+            print("FPU: no SSE/FXSR, FPU instructions disabled\n");
+        }
+        return;
+    }
+    
+    write_cr0((read_cr0() & ~(CR0_EM | CR0_TS)) | CR0_MP | CR0_NE);
+    write_cr4(read_cr4() | CR4_OSFXSR | CR4_OSXMMEXCPT);
+    asm volatile("fninit");
+    
+    if (this_cpu()->id == 0) {
+        fxsave(&initial_state);
+        fxsr = 1;
+        print("FPU: SSE");
+        if (edx & CPUID_SSE2) {
+            print(", SSE2");
+        }
+        print(" enabled, lazy switching\n");
+    }
+    
+    this_cpu()->fpu_owner = 0;
+    stts();
+}
+
+int fpu_present() {
+    return fxsr;
+}
+
+// Device-not-available (#NM) handler: give the FPU to the current
+// process. Returns 0 if the trap was not caused by a lazy switch.
+int fpu_handle_nm() {
+    struct cpu* cpu = this_cpu();
+    struct pcb* p = cpu->current;
+    if (!fxsr || !p) {
+        return 0;
+    }
+    
+    clts();
+    cpu->fpu_active = 1;
+    nm_traps++;
+    
+    // Its state may still be in this CPU's registers, if nobody else
+    // used the FPU here since and it did not run on another CPU
+    if (cpu->fpu_owner == p && p->fpu_cpu == cpu->id) {
+        return 1;
+    }
+    
+    fxrstor(p->fpu_used ? &p->fpu : &initial_state);
+    p->fpu_used = 1;
+    p->fpu_cpu = cpu->id;
+    cpu->fpu_owner = p;
+    fpu_restores++;
+    return 1;
+}
+
+// Called by schedule() when prev leaves this CPU. If it used the FPU
+// during its slice, its state is saved now, as it may next run on
+// another CPU. The registers stay valid for it until someone else traps.
+void fpu_switch_out(struct pcb* prev) {
+    struct cpu* cpu = this_cpu();
+    if (!cpu->fpu_active) {
+        return;
+    }
+    
+    fxsave(&prev->fpu);
+    fpu_saves++;
+    cpu->fpu_active = 0;
+    stts();
+}
+
+// Let the kernel use the SSE registers until fpu_kernel_end(), with
+// interrupts disabled. Live state of the current process is saved first;
+// whoever owned the registers reloads them on its next #NM.
+unsigned int fpu_kernel_begin() {
+    unsigned int flags = irq_save();
+    struct cpu* cpu = this_cpu();
+    if (cpu->fpu_active) {
+        fxsave(&cpu->current->fpu);
+        fpu_saves++;
+        cpu->fpu_active = 0;
+    }
+    cpu->fpu_owner = 0;
+    clts();
+    return flags;
+}
+
+void fpu_kernel_end(unsigned int flags) {
+    stts();
+    irq_restore(flags);
+}
+
+// Give a forked child the FPU registers of the current process
+void fpu_fork(struct pcb* child) {
+    unsigned int flags = irq_save();
+    struct cpu* cpu = this_cpu();
+    struct pcb* parent = cpu->current;
+    if (cpu->fpu_active) {
+        fxsave(&parent->fpu);  // Still live; the registers stay valid
+        fpu_saves++;
+    }
+    if (parent->fpu_used) {
+        child->fpu = parent->fpu;
+        child->fpu_used = 1;
+    }
+    irq_restore(flags);
+}
+
+// Forget a process that is being freed, so a new PCB at the same
+// address does not inherit its registers
+void fpu_release(struct pcb* p) {
+    for (unsigned int i = 0; i < cpu_count; i++) {
+        if (cpus[i].fpu_owner == p) {
+            cpus[i].fpu_owner = 0;
+        }
+    }
+}
+
+void fpu_stats() {
+    print("FPU: ");
+    print_dec(nm_traps);
+    print(" #NM traps, ");
+    print_dec(fpu_restores);
+    print(" restores, ");
+    print_dec(fpu_saves);
+    print(" saves\n");
+}
@@ -0,0 +1,24 @@
+// fpu.h
+
+#ifndef FPU_H
+#define FPU_H
+
+// x87/MMX/SSE register image saved by fxsave
+struct fpu_state {
+    unsigned char area[512];
+} __attribute__((aligned(16)));
+
+struct pcb;
+
+// Functions
+void fpu_init();
+int fpu_present();
+int fpu_handle_nm();
+void fpu_switch_out(struct pcb* prev);
+void fpu_release(struct pcb* p);
+void fpu_fork(struct pcb* child);
+unsigned int fpu_kernel_begin();
+void fpu_kernel_end(unsigned int flags);
+void fpu_stats();
+
+#endif
@@ -2,36 +2,27 @@
 
 #include "fs.h"
 #include "memory.h"
+#include "klib.h"
+#include "pkg.h"
+#include "initcall.h"
+#include "sync.h"
 
 // External functions from kernel
 extern void print(const char* str);
 extern void print_dec(unsigned int n);
 extern void putchar(char c);
 
-// External function from memory manager
-extern void memory_register_fs(void* addr, unsigned int size);
-
 // Global file system instance
 static struct fs filesystem;
 
-// Initialize the file system
+// Serializes every fs_* call: processes on several CPUs use the file
+// system through system calls. A mutex, since the calls print.
+static struct mutex fs_lock;
+
+// Initialize the file system. The data area for writable files is only
+// allocated when the first one is created.
 void fs_init(void) {
     
-    // Allocate memory for data area
-    // Total size: MAX_FILES * FILE_SIZE
-    unsigned int total_size = MAX_FILES * FILE_SIZE;
-    filesystem.data_area = (unsigned char*)malloc(total_size);
-    
-    if (!filesystem.data_area) {
-        print("Failed to allocate memory for file system!\n");
-        return;
-    }
-    
-    // Register this allocation with memory manager so it won't be freed
-    memory_register_fs(filesystem.data_area, total_size);
-    
-    filesystem.data_size = total_size;
-    
     // Initialize all file entries as free
     for (int i = 0; i < MAX_FILES; i++) {
         filesystem.files[i].flags = FILE_FREE;
@@ -39,134 +30,146 @@ void fs_init(void) {
         filesystem.files[i].data_offset = i * FILE_SIZE;  // Each file gets FILE_SIZE bytes
         
         // Clear filename
-        for (int j = 0; j < MAX_FILENAME_LENGTH; j++) {
-            filesystem.files[i].name[j] = '\0';
-        }
-    }
-    
-    // Clear data area
-    for (unsigned int i = 0; i < total_size; i++) {
-        filesystem.data_area[i] = 0;
+        memset(filesystem.files[i].name, 0, MAX_FILENAME_LENGTH);
     }
     
+    mutex_init(&fs_lock);
+    filesystem.data_area = 0;
+    filesystem.data_size = 0;
     filesystem.initialized = 1;
     
     print("File system initialized: ");
     print_dec(MAX_FILES);
     print(" files, ");
     print_dec(FILE_SIZE);
-    print(" bytes each (");
-    print_dec(total_size);
-    print(" bytes total)\n");
+    print(" bytes each\n");
+}
+
+initcall(fs_init, INITCALL_BOOT);
+
+// Allocate the data area on first use. Each file's part is cleared when
+// the file is created, so the area is not. Called with fs_lock held, so
+// two first creates cannot both allocate one. Returns 0, or -1 if out
+// of memory.
+static int alloc_data_area() {
+    if (filesystem.data_area) {
+        return 0;
+    }
+    
+    // Total size: MAX_FILES * FILE_SIZE
+    unsigned int total_size = MAX_FILES * FILE_SIZE;
+    filesystem.data_area = (unsigned char*)malloc(total_size);
+    
+    if (!filesystem.data_area) {
+        print("Failed to allocate memory for file system!\n");
+        return -1;
+    }
+    
+    filesystem.data_size = total_size;
+    return 0;
+}
+
+// Index of a file, or -1
+static int find_file(const char* name) {
+    for (int i = 0; i < MAX_FILES; i++) {
+        if ((filesystem.files[i].flags & FILE_USED) &&
+            strcmp(filesystem.files[i].name, name) == 0) {
+            return i;
+        }
+    }
+    return -1;
 }
 
-// Helper function to compare strings
-static int str_compare(const char* s1, const char* s2) {
-    while (*s1 && *s2) {
-        if (*s1 != *s2) return 0;
-        s1++;
-        s2++;
-    }
-    return (*s1 == *s2);
+// Index of an unused slot, or -1
+static int free_slot(void) {
+    for (int i = 0; i < MAX_FILES; i++) {
+        if (!(filesystem.files[i].flags & FILE_USED)) {
+            return i;
+        }
+    }
+    return -1;
 }
 
-// Helper function to copy strings
-static void str_copy(char* dest, const char* src, int max_len) {
-    int i;
-    for (i = 0; i < max_len - 1 && src[i]; i++) {
-        dest[i] = src[i];
+// Contents of a file
+static const unsigned char* file_data(int index) {
+    if (filesystem.files[index].flags & FILE_IMAGE) {
+        return filesystem.files[index].image;
     }
-    dest[i] = '\0';
+    return filesystem.data_area + filesystem.files[index].data_offset;
 }
 
 // Create a new file
-int fs_create_file(const char* name) {
+static int create_file(const char* name) {
     if (!filesystem.initialized) {
         print("File system not initialized!\n");
         return -1;
     }
     
     // Check if name is too long
-    int name_len = 0;
-    while (name[name_len] && name_len < MAX_FILENAME_LENGTH) {
-        name_len++;
-    }
-    if (name_len >= MAX_FILENAME_LENGTH) {
+    if (strlen(name) >= MAX_FILENAME_LENGTH) {
         print("Filename too long!\n");
         return -1;
     }
     
     // Check if file already exists
-    for (int i = 0; i < MAX_FILES; i++) {
-        if (filesystem.files[i].flags & FILE_USED) {
-            if (str_compare(filesystem.files[i].name, name)) {
-                print("File already exists!\n");
-                return -1;
-            }
-        }
+    if (find_file(name) != -1) {
+        print("File already exists!\n");
+        return -1;
+    }
+    
+    if (alloc_data_area() != 0) {
+        return -1;
     }
     
     // Find a free slot
-    for (int i = 0; i < MAX_FILES; i++) {
-        if (!(filesystem.files[i].flags & FILE_USED)) {
-            // Found free slot
-            filesystem.files[i].flags = FILE_USED;
-            filesystem.files[i].size = 0;  // Start with empty file
-            str_copy(filesystem.files[i].name, name, MAX_FILENAME_LENGTH);
-            
-            // Clear the file's data area
-            unsigned char* data = filesystem.data_area + filesystem.files[i].data_offset;
-            for (int j = 0; j < FILE_SIZE; j++) {
-                data[j] = 0;
-            }
-            
-            print("File created: ");
-            print(name);
-            print("\n");
-            return i;  // Return file index
-        }
+    int i = free_slot();
+    if (i == -1) {
+        print("No free file slots!\n");
+        return -1;
     }
     
-    print("No free file slots!\n");
-    return -1;
+    filesystem.files[i].flags = FILE_USED;
+    filesystem.files[i].size = 0;  // Start with empty file
+    filesystem.files[i].image = 0;
+    strlcpy(filesystem.files[i].name, name, MAX_FILENAME_LENGTH);
+    
+    // Clear the file's data area
+    memset(filesystem.data_area + filesystem.files[i].data_offset, 0, FILE_SIZE);
+    
+    print("File created: ");
+    print(name);
+    print("\n");
+    return i;  // Return file index
 }
 
 // Delete a file
-int fs_delete_file(const char* name) {
+static int delete_file(const char* name) {
     if (!filesystem.initialized) {
         print("File system not initialized!\n");
         return -1;
     }
     
     // Find the file
-    int file_index = -1;
-    for (int i = 0; i < MAX_FILES; i++) {
-        if (filesystem.files[i].flags & FILE_USED) {
-            if (str_compare(filesystem.files[i].name, name)) {
-                file_index = i;
-                break;
-            }
-        }
-    }
+    int file_index = find_file(name);
     
     if (file_index == -1) {
         print("File not found!\n");
         return -1;
     }
     
+    // Image files have no part of the data area
+    int image = filesystem.files[file_index].flags & FILE_IMAGE;
+    
     // Mark file as free
     filesystem.files[file_index].flags = FILE_FREE;
     filesystem.files[file_index].size = 0;
     
     // Clear filename
-    for (int i = 0; i < MAX_FILENAME_LENGTH; i++) {
-        filesystem.files[file_index].name[i] = '\0';
-    }
+    memset(filesystem.files[file_index].name, 0, MAX_FILENAME_LENGTH);
     
     // Clear file data (optional, but good for security)
-    unsigned char* file_data = filesystem.data_area + filesystem.files[file_index].data_offset;
-    for (int i = 0; i < FILE_SIZE; i++) {
-        file_data[i] = 0;
+    if (!image) {
+        memset(filesystem.data_area + filesystem.files[file_index].data_offset, 0, FILE_SIZE);
     }
     
     print("File deleted: ");
@@ -177,22 +180,14 @@ int fs_delete_file(const char* name) {
 }
 
 // Read data from a file
-int fs_read_file(const char* name, unsigned char* buffer, unsigned int size) {
+static int read_file(const char* name, unsigned char* buffer, unsigned int size) {
     if (!filesystem.initialized) {
         print("File system not initialized!\n");
         return -1;
     }
     
     // Find the file
-    int file_index = -1;
-    for (int i = 0; i < MAX_FILES; i++) {
-        if (filesystem.files[i].flags & FILE_USED) {
-            if (str_compare(filesystem.files[i].name, name)) {
-                file_index = i;
-                break;
-            }
-        }
-    }
+    int file_index = find_file(name);
     
     if (file_index == -1) {
         print("File not found!\n");
@@ -206,37 +201,31 @@ int fs_read_file(const char* name, unsigned char* buffer, unsigned int size) {
     }
     
     // Read data from file
-    unsigned char* file_data = filesystem.data_area + filesystem.files[file_index].data_offset;
-    for (unsigned int i = 0; i < read_size; i++) {
-        buffer[i] = file_data[i];
-    }
+    memcpy(buffer, file_data(file_index), read_size);
     
     return read_size;
 }
 
 // Write data to a file
-int fs_write_file(const char* name, const unsigned char* data, unsigned int size) {
+static int write_file(const char* name, const unsigned char* data, unsigned int size) {
     if (!filesystem.initialized) {
         print("File system not initialized!\n");
         return -1;
     }
     
     // Find the file
-    int file_index = -1;
-    for (int i = 0; i < MAX_FILES; i++) {
-        if (filesystem.files[i].flags & FILE_USED) {
-            if (str_compare(filesystem.files[i].name, name)) {
-                file_index = i;
-                break;
-            }
-        }
-    }
+    int file_index = find_file(name);
     
     if (file_index == -1) {
         print("File not found!\n");
         return -1;
     }
     
+    if (filesystem.files[file_index].flags & FILE_IMAGE) {
+        print("File is read-only!\n");
+        return -1;
+    }
+    
     // Check size limit
     if (size > FILE_SIZE) {
         print("Data too large! Max size: ");
@@ -246,10 +235,7 @@ int fs_write_file(const char* name, const unsigned char* data, unsigned int size
     }
     
     // Write data to file
-    unsigned char* file_data = filesystem.data_area + filesystem.files[file_index].data_offset;
-    for (unsigned int i = 0; i < size; i++) {
-        file_data[i] = data[i];
-    }
+    memcpy(filesystem.data_area + filesystem.files[file_index].data_offset, data, size);
     
     // Update file size
     filesystem.files[file_index].size = size;
@@ -263,7 +249,7 @@ int fs_write_file(const char* name, const unsigned char* data, unsigned int size
     return size;
 }
 
-void fs_list_files(void) {
+static void list_files() {
     if (!filesystem.initialized) {
         print("File system not initialized!\n");
         return;
@@ -279,8 +265,7 @@ void fs_list_files(void) {
         if (filesystem.files[i].flags & FILE_USED) {
             // Print filename (pad to 14 chars)
             print(filesystem.files[i].name);
-            int name_len = 0;
-            while (filesystem.files[i].name[name_len]) name_len++;
+            int name_len = strlen(filesystem.files[i].name);
             for (int j = name_len; j < 14; j++) {
                 putchar(' ');
             }
@@ -288,7 +273,7 @@ void fs_list_files(void) {
             // Print size
             print("  ");
             print_dec(filesystem.files[i].size);
-            print(" bytes\n");
+            print(filesystem.files[i].flags & FILE_IMAGE ? " bytes, read-only\n" : " bytes\n");
             
             file_count++;
         }
@@ -302,3 +287,132 @@ void fs_list_files(void) {
         print(" file(s)\n");
     }
 }
+
+// Read part of a file, for files too large to read in one go. Returns
+// the bytes read, fewer at the end of the file, or -1 if it is missing.
+static int read_at(const char* name, unsigned int offset, void* buffer, unsigned int size) {
+    if (!filesystem.initialized) {
+        return -1;
+    }
+    
+    int file_index = find_file(name);
+    if (file_index == -1) {
+        return -1;
+    }
+    
+    unsigned int file_size = filesystem.files[file_index].size;
+    if (offset >= file_size) {
+        return 0;
+    }
+    if (size > file_size - offset) {
+        size = file_size - offset;
+    }
+    memcpy(buffer, file_data(file_index) + offset, size);
+    return size;
+}
+
+// Add a read-only file whose contents stay at data. Returns 0, or -1 if
+// the name is empty or taken or the directory is full.
+static int add_image(const char* name, const void* data, unsigned int size) {
+    if (!filesystem.initialized || name[0] == '\0' || find_file(name) != -1) {
+        return -1;
+    }
+    
+    int i = free_slot();
+    if (i == -1) {
+        return -1;
+    }
+    filesystem.files[i].flags = FILE_USED | FILE_IMAGE;
+    filesystem.files[i].size = size;
+    filesystem.files[i].image = (const unsigned char*)data;
+    strlcpy(filesystem.files[i].name, name, MAX_FILENAME_LENGTH);
+    return 0;
+}
+
+// Add the files of a program package (see pkg.h) as read-only files.
+// Their contents stay where the bootloader put the package.
+static void load_package(const void* package, unsigned int max_size) {
+    const struct pkg_header* header = (const struct pkg_header*)package;
+    if (!filesystem.initialized || header->magic != PKG_MAGIC) {
+        return;
+    }
+    if (header->count > (max_size - sizeof(struct pkg_header)) / sizeof(struct pkg_entry)) {
+        print("Program package: bad header\n");
+        return;
+    }
+    
+    const struct pkg_entry* entries = (const struct pkg_entry*)(header + 1);
+    unsigned int added = 0;
+    for (unsigned int i = 0; i < header->count; i++) {
+        const struct pkg_entry* entry = &entries[i];
+        if (entry->offset > max_size || entry->size > max_size - entry->offset) {
+            continue;  // Cut off: more than the bootloader loads
+        }
+        
+        char name[MAX_FILENAME_LENGTH];
+        strlcpy(name, entry->name, MAX_FILENAME_LENGTH);
+        if (add_image(name, (const unsigned char*)package + entry->offset, entry->size) == 0) {
+            added++;
+        }
+    }
+    
+    print("Program package: ");
+    print_dec(added);
+    print(" read-only files\n");
+}
+
+// Entry points: the functions above, under fs_lock
+
+int fs_create_file(const char* name) {
+    mutex_lock(&fs_lock);
+    int result = create_file(name);
+    mutex_unlock(&fs_lock);
+    return result;
+}
+
+int fs_delete_file(const char* name) {
+    mutex_lock(&fs_lock);
+    int result = delete_file(name);
+    mutex_unlock(&fs_lock);
+    return result;
+}
+
+int fs_read_file(const char* name, unsigned char* buffer, unsigned int size) {
+    mutex_lock(&fs_lock);
+    int result = read_file(name, buffer, size);
+    mutex_unlock(&fs_lock);
+    return result;
+}
+
+int fs_write_file(const char* name, const unsigned char* data, unsigned int size) {
+    mutex_lock(&fs_lock);
+    int result = write_file(name, data, size);
+    mutex_unlock(&fs_lock);
+    return result;
+}
+
+void fs_list_files(void) {
+    mutex_lock(&fs_lock);
+    list_files();
+    mutex_unlock(&fs_lock);
+}
+
+int fs_read_at(const char* name, unsigned int offset, void* buffer, unsigned int size) {
+    mutex_lock(&fs_lock);
+    int result = read_at(name, offset, buffer, size);
+    mutex_unlock(&fs_lock);
+    return result;
+}
+
+int fs_add_image(const char* name, const void* data, unsigned int size) {
+    mutex_lock(&fs_lock);
+    int result = add_image(name, data, size);
+    mutex_unlock(&fs_lock);
+    return result;
+}
+
+void fs_load_package(const void* package, unsigned int max_size) {
+    mutex_lock(&fs_lock);
+    load_package(package, max_size);
+    mutex_unlock(&fs_lock);
+}
@@ -11,6 +11,7 @@
 // File flags
 #define FILE_FREE 0x00
 #define FILE_USED 0x01
+#define FILE_IMAGE 0x02        // Read-only, contents outside the data area
 
 // File entry structure (directory entry)
 struct file_entry {
@@ -18,6 +19,7 @@ struct file_entry {
     unsigned char flags;             // File flags (free/used)
     unsigned int size;               // File size (always FILE_SIZE for now)
     unsigned int data_offset;        // Offset to file data
+    const unsigned char* image;      // Contents of a FILE_IMAGE file
 };
 
 // File system structure
@@ -35,5 +37,8 @@ int fs_delete_file(const char* name);
 int fs_read_file(const char* name, unsigned char* buffer, unsigned int size);
 int fs_write_file(const char* name, const unsigned char* data, unsigned int size);
 void fs_list_files(void);
+int fs_read_at(const char* name, unsigned int offset, void* buffer, unsigned int size);
+int fs_add_image(const char* name, const void* data, unsigned int size);
+void fs_load_package(const void* package, unsigned int max_size);
 
 #endif
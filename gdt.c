@@ -0,0 +1,104 @@
+// gdt.c
+
+#include "gdt.h"
+#include "smp.h"
+
+// interrupt.asm finds a CPU's GS selector from its TSS selector, so
+// the distance between the two must stay (MAX_CPUS * 8)
+#define GDT_TSS     (GDT_PERCPU + MAX_CPUS)
+#define GDT_ENTRIES (GDT_TSS + MAX_CPUS)
+
+// Access bytes
+#define GDT_CODE    0x9A    // Present, ring 0, executable, readable
+#define GDT_DATA    0x92    // Present, ring 0, writable
+#define GDT_USER_CODE 0xFA  // Present, ring 3, executable, readable
+#define GDT_USER_DATA 0xF2  // Present, ring 3, writable
+#define GDT_TSS_TYPE  0x89  // Present, ring 0, available 32-bit TSS
+
+// Granularity: 4KB units, 32-bit
+#define GDT_FLAT    0xCF
+#define GDT_BYTES   0x40    // Byte granular, 32-bit
+
+// Task state segment. Only the ring 0 stack is used: the CPU switches
+// to it when an interrupt or system call arrives from ring 3.
+struct tss_entry {
+    unsigned int prev_tss;
+    unsigned int esp0;          // Kernel stack of the running process
+    unsigned int ss0;
+    unsigned int esp1, ss1, esp2, ss2;
+    unsigned int cr3, eip, eflags;
+    unsigned int eax, ecx, edx, ebx, esp, ebp, esi, edi;
+    unsigned int es, cs, ss, ds, fs, gs, ldt;
+    unsigned short trap;
+    unsigned short iomap_base;  // Past the limit: no I/O ports for ring 3
+} __attribute__((packed));
+
+static struct gdt_entry gdt[GDT_ENTRIES];
+static struct gdt_ptr gdtp;
+static struct tss_entry tss[MAX_CPUS];
+
+static void gdt_set_entry(int num, unsigned int base, unsigned int limit,
+                          unsigned char access, unsigned char granularity) {
+    gdt[num].base_lo = base & 0xFFFF;
+    gdt[num].base_mid = (base >> 16) & 0xFF;
+    gdt[num].base_hi = (base >> 24) & 0xFF;
+    gdt[num].limit_lo = limit & 0xFFFF;
+    gdt[num].granularity = (granularity & 0xF0) | ((limit >> 16) & 0x0F);
+    gdt[num].access = access;
+}
+
+// Build the kernel GDT and load it on the boot CPU. Replaces the
+// bootloader's GDT, which lives in memory the kernel reuses.
+void gdt_init() {
+    gdt_set_entry(0, 0, 0, 0, 0);
+    gdt_set_entry(1, 0, 0xFFFFF, GDT_CODE, GDT_FLAT);
+    gdt_set_entry(2, 0, 0xFFFFF, GDT_DATA, GDT_FLAT);
+    gdt_set_entry(3, 0, 0xFFFFF, GDT_USER_CODE, GDT_FLAT);
+    gdt_set_entry(4, 0, 0xFFFFF, GDT_USER_DATA, GDT_FLAT);
+    
+    for (int i = 0; i < MAX_CPUS; i++) {
+        cpus[i].self = &cpus[i];
+        cpus[i].id = i;
+        gdt_set_entry(GDT_PERCPU + i, (unsigned int)&cpus[i], sizeof(struct cpu) - 1,
+                      GDT_DATA, GDT_BYTES);
+        
+        tss[i].ss0 = KERNEL_DS;
+        tss[i].iomap_base = sizeof(struct tss_entry);
+        gdt_set_entry(GDT_TSS + i, (unsigned int)&tss[i], sizeof(struct tss_entry) - 1,
+                      GDT_TSS_TYPE, 0);
+    }
+    
+    gdtp.limit = sizeof(gdt) - 1;
+    gdtp.base = (unsigned int)&gdt;
+    
+    gdt_load(0);
+}
+
+// Load the GDT on this CPU, reload the flat segments, point GS at the
+// CPU's per-CPU data and load its TSS
+void gdt_load(unsigned int cpu_id) {
+    asm volatile("lgdt %0\n\t"
+                 "ljmp %1, $1f\n"
+                 "1:\n\t"
+                 "mov %2, %%ds\n\t"
+                 "mov %2, %%es\n\t"
+                 "mov %2, %%fs\n\t"
+                 "mov %2, %%ss\n\t"
+                 "mov %3, %%gs\n\t"
+                 "ltr %w4"
+                 :
+                 : "m"(gdtp), "i"(KERNEL_CS), "r"(KERNEL_DS), "r"(PERCPU_SEL(cpu_id)),
+                   "r"((GDT_TSS + cpu_id) << 3)
+                 : "memory");
+}
+
+// Stack the CPU switches to on entry from ring 3: the top of the
+// kernel stack of the process about to run
+void gdt_set_kernel_stack(unsigned int cpu_id, unsigned int esp0) {
+    tss[cpu_id].esp0 = esp0;
+}
+
+// Address of a CPU's esp0 field. SYSENTER starts with ESP pointing here.
+unsigned int gdt_kernel_stack_slot(unsigned int cpu_id) {
+    return (unsigned int)&tss[cpu_id].esp0;
+}
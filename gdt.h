@@ -0,0 +1,42 @@
+// gdt.h
+
+#ifndef GDT_H
+#define GDT_H
+
+// GDT entry structure
+struct gdt_entry {
+    unsigned short limit_lo;    // Lower 16 bits of the limit
+    unsigned short base_lo;     // Lower 16 bits of the base
+    unsigned char base_mid;     // Bits 16-23 of the base
+    unsigned char access;       // Present, ring, type
+    unsigned char granularity;  // Flags and limit bits 16-19
+    unsigned char base_hi;      // Bits 24-31 of the base
+} __attribute__((packed));
+
+// GDT pointer structure
+struct gdt_ptr {
+    unsigned short limit;
+    unsigned int base;
+} __attribute__((packed));
+
+// Segment selectors (same layout as the bootloader's GDT)
+#define KERNEL_CS   0x08
+#define KERNEL_DS   0x10
+
+// Ring 3 segments, selectors with RPL 3. SYSEXIT expects them right
+// after the kernel segments.
+#define USER_CS     0x1B
+#define USER_DS     0x23
+
+// One GS data segment per CPU follows the flat segments; its base is
+// that CPU's struct cpu. One TSS per CPU comes after those.
+#define GDT_PERCPU  5
+#define PERCPU_SEL(id) ((GDT_PERCPU + (id)) << 3)
+
+// Functions
+void gdt_init();
+void gdt_load(unsigned int cpu_id);
+void gdt_set_kernel_stack(unsigned int cpu_id, unsigned int esp0);
+unsigned int gdt_kernel_stack_slot(unsigned int cpu_id);
+
+#endif
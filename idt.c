@@ -1,6 +1,15 @@
 // idt.c 
 
 #include "idt.h"
+#include "paging.h"
+#include "cpu.h"
+#include "timer.h"
+#include "sched.h"
+#include "lapic.h"
+#include "ioapic.h"
+#include "irq.h"
+#include "softirq.h"
+#include "fpu.h"
 
 // IDT entries
 struct idt_entry idt[256];
@@ -58,9 +67,25 @@ extern void irq13();
 extern void irq14();
 extern void irq15();
 
+// Scheduler entry for voluntary yields
+extern void yield_isr();
+
+// Inter-processor interrupts and local APIC spurious interrupts
+extern void ipi_tick_isr();
+extern void ipi_resched_isr();
+extern void spurious_isr();
+extern void lapic_timer_isr();
+
+// System call gate, reachable from ring 3
+extern void syscall_isr();
+
+// Set once the IOAPIC delivers device IRQs instead of the 8259 PICs
+static int apic_mode = 0;
+
 // Print function from kernel.c
 extern void print(const char* str);
 extern void putchar(char c);
+extern void print_dec(unsigned int n);
 
 // Helper function to print hex numbers (static to avoid multiple definition)
 static void print_hex(unsigned int n) {
@@ -176,12 +201,62 @@ void idt_init() {
     idt_set_gate(46, (unsigned int)irq14, 0x08, 0x8E);
     idt_set_gate(47, (unsigned int)irq15, 0x08, 0x8E);
     
+    // Voluntary context switches
+    idt_set_gate(YIELD_VECTOR, (unsigned int)yield_isr, 0x08, 0x8E);
+    
+    // SMP
+    idt_set_gate(IPI_TICK_VECTOR, (unsigned int)ipi_tick_isr, 0x08, 0x8E);
+    idt_set_gate(IPI_RESCHED_VECTOR, (unsigned int)ipi_resched_isr, 0x08, 0x8E);
+    idt_set_gate(SPURIOUS_VECTOR, (unsigned int)spurious_isr, 0x08, 0x8E);
+    idt_set_gate(LAPIC_TIMER_VECTOR, (unsigned int)lapic_timer_isr, 0x08, 0x8E);
+    
+    // System calls: DPL 3 so user mode may use int 0x80
+    idt_set_gate(SYSCALL_VECTOR, (unsigned int)syscall_isr, 0x08, 0xEE);
+    
     // Load the IDT
     idt_load((unsigned int)&idtp);
     
     print("IDT initialized\n");
 }
 
+// Switch device IRQs from the 8259 PICs to the IOAPIC. The vectors stay
+// the same (32 + IRQ), delivered to the boot CPU's local APIC.
+void idt_use_apic() {
+    outb(0x21, 0xFF);
+    outb(0xA1, 0xFF);
+    apic_mode = 1;
+    
+    for (unsigned int irq = 0; irq < 16; irq++) {
+        if (irq_has_handler(irq)) {
+            idt_unmask_irq(irq);
+        }
+    }
+}
+
+// Let an ISA IRQ through, once it has a handler
+void idt_unmask_irq(unsigned int irq) {
+    if (apic_mode) {
+        ioapic_route_isa(irq, ISA_IRQ_VECTOR(irq), lapic_id());
+    } else if (irq < 8) {
+        outb(0x21, inb(0x21) & ~(1 << irq));
+    } else {
+        // Slave IRQs arrive through the cascade on IRQ2
+        outb(0xA1, inb(0xA1) & ~(1 << (irq - 8)));
+        outb(0x21, inb(0x21) & ~(1 << 2));
+    }
+}
+
+// Stop an ISA IRQ from being delivered
+void idt_mask_irq(unsigned int irq) {
+    if (apic_mode) {
+        ioapic_mask_isa(irq);
+    } else if (irq < 8) {
+        outb(0x21, inb(0x21) | (1 << irq));
+    } else {
+        outb(0xA1, inb(0xA1) | (1 << (irq - 8)));
+    }
+}
+
 // Exception messages
 const char *exception_messages[] = {
     "Division By Zero",
@@ -220,6 +295,16 @@ const char *exception_messages[] = {
 
 // ISR handler
 void isr_handler(struct registers regs) {
+    // Page faults may just be demand-zero heap pages
+    if (regs.int_no == 14 && paging_handle_fault(regs.err_code)) {
+        return;
+    }
+    
+    // The first FPU/SSE instruction after a switch
+    if (regs.int_no == 7 && fpu_handle_nm()) {
+        return;
+    }
+    
     print("Exception: ");
     print(exception_messages[regs.int_no]);
     print(" (");
@@ -232,38 +317,70 @@ void isr_handler(struct registers regs) {
         print("\n");
     }
     
+    if (regs.int_no == 14) {
+        print("Faulting address: ");
+        print_hex(read_cr2());
+        print("\n");
+    }
+    
+    // A fault in ring 3, or on a user address the kernel was handed by a
+    // system call, only takes down the process
+    struct pcb* p = current_process;
+    if ((regs.cs & 3) || (regs.int_no == 14 && p->user && read_cr2() >= KERNEL_SPACE_END)) {
+        print("Killed process ");
+        print_dec(p->pid);
+        print(" (");
+        print(p->name);
+        print(")\n");
+        process_exit();
+    }
+    
     // Halt on exception
     while (1) {
         asm volatile("hlt");
     }
 }
 
-// External keyboard handler
-extern void keyboard_handler();
-
-// External timer handler
-extern void timer_handler();
-
-// IRQ handler
-void irq_handler(struct registers regs) {
-    // Send EOI (End of Interrupt) signal to PICs
-    if (regs.int_no >= 40) {
-        // Send to slave PIC
-        outb(0xA0, 0x20);
+// IRQ handler. Returns the register frame to resume.
+struct registers* irq_handler(struct registers* regs) {
+    // Yields come from software, there is no PIC interrupt to acknowledge
+    if (regs->int_no == YIELD_VECTOR) {
+        return schedule(regs);
+    }
+    
+    // Time spent in the handler is charged to the interrupted process
+    unsigned long long start = rdtsc();
+    struct pcb* interrupted = current_process;
+    struct registers* next = regs;
+    
+    // IPIs and the APIC timer come from the local APIC, device IRQs from
+    // the IOAPIC (which is acknowledged through the local APIC) or the PICs
+    if (apic_mode || regs->int_no >= IPI_TICK_VECTOR) {
+        lapic_eoi();
+    } else {
+        // Send EOI (End of Interrupt) signal to PICs
+        if (regs->int_no >= 40) {
+            // Send to slave PIC
+            outb(0xA0, 0x20);
+        }
+        // Send to master PIC
+        outb(0x20, 0x20);
     }
-    // Send to master PIC
-    outb(0x20, 0x20);
     
-    // Handle specific IRQs
-    switch(regs.int_no) {
-        case 32:  // Timer (IRQ0)
-            timer_handler();
-            break;
-        case 33:  // Keyboard (IRQ1)
-            keyboard_handler();
-            break;
-        default:
-            // Ignore other IRQs for now
-            break;
+    // Top halves: acknowledge the device and defer the rest
+    next = irq_dispatch(regs);
+    
+    // Bottom halves, with interrupts enabled
+    unsigned long long enabled = softirq_irq_exit();
+    
+    // A process woken by this IRQ may outrank the interrupted one. Not
+    // while this IRQ interrupted bottom halves: they finish first.
+    if (next == regs && sched_need_resched() && !this_cpu()->in_softirq) {
+        next = schedule(regs);
     }
+    
+    unsigned long long total = rdtsc() - start;
+    interrupted->irq_cycles += total;
+    irq_account_disabled(total - enabled);
+    return next;
 }
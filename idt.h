@@ -20,15 +20,35 @@ struct idt_ptr {
 
 // Registers structure for interrupt handlers
 struct registers {
+    unsigned int gs;                                     // Restored only on return to ring 3
     unsigned int ds;                                     // Data segment selector
     unsigned int edi, esi, ebp, esp, ebx, edx, ecx, eax; // Pushed by pusha
     unsigned int int_no, err_code;                      // Interrupt number and error code
     unsigned int eip, cs, eflags, useresp, ss;          // Pushed by processor
 };
 
+// Vector used by process_yield() to call the scheduler
+#define YIELD_VECTOR 48
+
+// Inter-processor interrupts sent through the local APIC
+#define IPI_TICK_VECTOR     49  // Timer tick forwarded by the boot CPU
+#define IPI_RESCHED_VECTOR  50  // New work was queued for the target CPU
+
+// Per-CPU local APIC timer tick
+#define LAPIC_TIMER_VECTOR  51
+
+// System calls from ring 3 (see syscall.h)
+#define SYSCALL_VECTOR      0x80
+
+// Local APIC spurious interrupts, which need no EOI
+#define SPURIOUS_VECTOR     255
+
 // Function declarations
 void idt_init();
 void idt_set_gate(unsigned char num, unsigned int base, unsigned short sel, unsigned char flags);
+void idt_use_apic();
+void idt_mask_irq(unsigned int irq);
+void idt_unmask_irq(unsigned int irq);
 
 // Assembly functions
 extern void idt_load(unsigned int);
@@ -46,6 +66,6 @@ static inline void outb(unsigned short port, unsigned char val) {
 
 // Interrupt handlers
 void isr_handler(struct registers regs);
-void irq_handler(struct registers regs);
+struct registers* irq_handler(struct registers* regs);
 
 #endif
@@ -0,0 +1,54 @@
+// initcall.c
+
+#include "initcall.h"
+#include "process.h"
+#include "boottime.h"
+#include "cpu.h"
+
+// External functions from kernel
+extern void print(const char* str);
+extern void console_hold();
+extern void console_release();
+
+// Registered entries of each level, from link.ld
+extern const struct initcall initcall1_start[];
+extern const struct initcall initcall1_end[];
+extern const struct initcall initcall2_start[];
+extern const struct initcall initcall2_end[];
+
+static const struct initcall* const level_start[INITCALL_LEVELS + 1] = {
+    0, initcall1_start, initcall2_start
+};
+static const struct initcall* const level_end[INITCALL_LEVELS + 1] = {
+    0, initcall1_end, initcall2_end
+};
+
+// Run the init functions of one level in link order. Each gets its own
+// boot phase in 'boottime', timed from when it is called.
+void initcall_run(unsigned int level) {
+    if (level == 0 || level > INITCALL_LEVELS) {
+        return;
+    }
+
+    for (const struct initcall* call = level_start[level]; call < level_end[level]; call++) {
+        unsigned long long start = rdtsc();
+        call->fn();
+        boottime_phase(call->name, start);
+    }
+}
+
+// Their messages wait for the next shell prompt
+static void deferred_main() {
+    console_hold();
+    initcall_run(INITCALL_DEFERRED);
+    console_release();
+}
+
+// Run the INITCALL_DEFERRED level in the background, so it does not hold
+// up the shell prompt. Runs it here instead if no thread can be created.
+void initcall_start_deferred() {
+    if (process_create("initcalls", deferred_main) < 0) {
+        print("initcall: no thread, running deferred calls now\n");
+        deferred_main();
+    }
+}
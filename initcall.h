@@ -0,0 +1,33 @@
+// initcall.h
+
+#ifndef INITCALL_H
+#define INITCALL_H
+
+// Subsystems register their init function with initcall() instead of
+// being called from kernel_main. Each level has its own section,
+// .initcall.<level>, which link.ld gathers between initcall<level>_start
+// and initcall<level>_end, in link order.
+#define INITCALL_BOOT       1   // Before the shell, once the core is up
+#define INITCALL_DEFERRED   2   // After the prompt, in a kernel thread
+#define INITCALL_LEVELS     2
+
+typedef void (*initcall_fn)();
+
+struct initcall {
+    initcall_fn fn;
+    const char* name;
+};
+
+// Expands level first, so INITCALL_BOOT names .initcall.1
+#define INITCALL_SECTION(level) INITCALL_SECTION_NAME(level)
+#define INITCALL_SECTION_NAME(level) ".initcall." #level
+
+#define initcall(fn, level) \
+    static const struct initcall initcall_##fn \
+    __attribute__((used, section(INITCALL_SECTION(level)), aligned(4))) = { fn, #fn }
+
+// Functions
+void initcall_run(unsigned int level);
+void initcall_start_deferred();
+
+#endif
@@ -5,6 +5,9 @@
 ; External C handlers
 [EXTERN isr_handler]
 [EXTERN irq_handler]
+[EXTERN sched_switch_done]
+[EXTERN syscall_handler]
+[EXTERN sysenter_return]
 
 ; Load IDT
 global idt_load
@@ -13,60 +16,158 @@ idt_load:
     lidt [eax]          ; Load IDT
     ret
 
-; Common ISR code
-isr_common_stub:
-    ; Save CPU state
+; GS selector of a CPU = its TSS selector - TSS_TO_PERCPU (see gdt.c)
+TSS_TO_PERCPU equ 64
+
+; Save the interrupted state below the vector and error code, as
+; struct registers, and switch to the kernel data segments
+%macro SAVE_STATE 0
     pusha               ; Push edi,esi,ebp,esp,ebx,edx,ecx,eax
+    cld                 ; C code assumes DF=0; ring 3 or SYSENTER may leave it set
     mov ax, ds          ; Lower 16-bits of eax = ds
     push eax            ; Save the data segment descriptor
+    mov ax, gs
+    push eax
     
     mov ax, 0x10        ; Load kernel data segment descriptor
     mov ds, ax
     mov es, ax
-    mov fs, ax
-    mov gs, ax
-    
-    ; Call C handler
-    call isr_handler
     
-    ; Restore state
+    ; GS selects this CPU's per-CPU data, except after an entry from
+    ; ring 3. This CPU's TSS tells which GS segment is ours.
+    test byte [esp + 52], 3     ; Interrupted CS
+    jz %%kernel
+    str ax
+    sub ax, TSS_TO_PERCPU
+    mov gs, ax
+%%kernel:
+%endmacro
+
+; Undo SAVE_STATE, leaving the frame the CPU pushed
+%macro RESTORE_STATE 0
+    pop eax             ; User GS, only reloaded on the way back to ring 3
+    test byte [esp + 48], 3
+    jz %%kernel
+    mov gs, ax
+%%kernel:
     pop eax             ; Reload original data segment descriptor
     mov ds, ax
     mov es, ax
-    mov fs, ax
-    mov gs, ax
     
     popa                ; Pop edi,esi,ebp...
     add esp, 8          ; Clean up pushed error code and ISR number
+%endmacro
+
+; Common ISR code
+isr_common_stub:
+    SAVE_STATE
+    
+    ; Call C handler
+    call isr_handler
+    
+    RESTORE_STATE
     sti
     iret                ; Pop cs, eip, eflags, ss, esp
 
 ; Common IRQ code
 irq_common_stub:
-    ; Save CPU state
-    pusha
-    mov ax, ds
-    push eax
-    
-    mov ax, 0x10
-    mov ds, ax
-    mov es, ax
-    mov fs, ax
-    mov gs, ax
+    SAVE_STATE
     
-    ; Call C handler
+    ; Call C handler with a pointer to the saved frame. It returns the
+    ; frame to resume, which belongs to another process after a switch.
+    push esp
     call irq_handler
+    mov esp, eax
     
-    ; Restore state
-    pop eax
-    mov ds, ax
-    mov es, ax
-    mov fs, ax
-    mov gs, ax
+    ; Off the previous process's stack: let other CPUs run it
+    call sched_switch_done
     
-    popa
-    add esp, 8
+    RESTORE_STATE
+    sti
+    iret
+
+; System calls through int 0x80. The handler runs with interrupts
+; enabled; it may block or be preempted like any kernel code.
+global syscall_isr
+syscall_isr:
+    push byte 0
+    push dword 0x80     ; SYSCALL_VECTOR
+    SAVE_STATE
     sti
+    
+    push esp
+    call syscall_handler
+    add esp, 4
+    
+    cli
+    RESTORE_STATE
+    iret
+
+; SYSENTER from the vsyscall page. The CPU loads only CS, SS, EIP and
+; ESP, which points at this CPU's TSS esp0. Build the frame int 0x80
+; would have pushed: the vsyscall code passes the user stack in ebp and
+; the second and third arguments in esi and edi.
+global sysenter_entry
+sysenter_entry:
+    mov esp, [esp]      ; Kernel stack of the current process
+    push dword 0x23     ; USER_DS
+    push ebp            ; User stack
+    push dword 0x200    ; EFLAGS_IF
+    push dword 0x1B     ; USER_CS
+    push dword [sysenter_return]
+    push byte 0
+    push dword 0x80
+    mov ecx, esi
+    mov edx, edi
+    SAVE_STATE
+    sti
+    
+    push esp
+    call syscall_handler
+    add esp, 4
+    
+    ; SYSEXIT resumes at edx with the stack in ecx, still on the
+    ; vsyscall page, which restores both
+    cli
+    RESTORE_STATE
+    mov edx, [esp]      ; eip
+    mov ecx, [esp + 12] ; useresp
+    sti
+    sysexit
+
+; Software interrupt used by process_yield() to enter the scheduler
+global yield_isr
+yield_isr:
+    cli
+    push byte 0
+    push byte 48        ; YIELD_VECTOR
+    jmp irq_common_stub
+
+; Inter-processor interrupts
+global ipi_tick_isr
+ipi_tick_isr:
+    cli
+    push byte 0
+    push byte 49        ; IPI_TICK_VECTOR
+    jmp irq_common_stub
+
+global ipi_resched_isr
+ipi_resched_isr:
+    cli
+    push byte 0
+    push byte 50        ; IPI_RESCHED_VECTOR
+    jmp irq_common_stub
+
+global lapic_timer_isr
+lapic_timer_isr:
+    cli
+    push byte 0
+    push byte 51        ; LAPIC_TIMER_VECTOR
+    jmp irq_common_stub
+
+; Local APIC spurious interrupt: no EOI, nothing to do
+global spurious_isr
+spurious_isr:
     iret
 
 ; Macro for ISRs that don't push error code
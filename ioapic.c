@@ -0,0 +1,110 @@
+// ioapic.c
+
+#include "ioapic.h"
+#include "acpi.h"
+#include "paging.h"
+#include "spinlock.h"
+
+// External functions from kernel
+extern void print(const char* str);
+extern void print_dec(unsigned int n);
+extern void print_hex(unsigned int n);
+
+// Registers are reached through an index and a data window
+#define IOAPIC_REGSEL   0x00
+#define IOAPIC_WINDOW   0x10
+
+#define IOAPIC_VERSION      0x01
+#define IOAPIC_REDTBL(n)    (0x10 + 2 * (n))
+
+// Redirection entry bits (low dword)
+#define REDIR_ACTIVE_LOW    0x02000
+#define REDIR_LEVEL         0x08000
+#define REDIR_MASKED        0x10000
+
+static volatile unsigned int* ioapic = 0;
+static unsigned int redirection_entries = 0;
+static const struct madt_info* madt = 0;
+
+// The index register makes every access a two-step sequence
+static struct spinlock ioapic_lock = SPINLOCK_INIT;
+
+static unsigned int ioapic_read(unsigned int reg) {
+    ioapic[IOAPIC_REGSEL / 4] = reg;
+    return ioapic[IOAPIC_WINDOW / 4];
+}
+
+static void ioapic_write(unsigned int reg, unsigned int val) {
+    ioapic[IOAPIC_REGSEL / 4] = reg;
+    ioapic[IOAPIC_WINDOW / 4] = val;
+}
+
+// Map the IOAPIC listed in the MADT and mask all of its inputs.
+// Returns 0 on success. Must run after paging_init().
+int ioapic_init() {
+    madt = acpi_madt();
+    if (!madt || !madt->ioapic_address) {
+        print("No IOAPIC\n");
+        return -1;
+    }
+    if (paging_map_mmio(madt->ioapic_address) != 0) {
+        print("IOAPIC: cannot map registers\n");
+        return -1;
+    }
+    
+    ioapic = (volatile unsigned int*)madt->ioapic_address;
+    redirection_entries = ((ioapic_read(IOAPIC_VERSION) >> 16) & 0xFF) + 1;
+    for (unsigned int i = 0; i < redirection_entries; i++) {
+        ioapic_write(IOAPIC_REDTBL(i), REDIR_MASKED);
+        ioapic_write(IOAPIC_REDTBL(i) + 1, 0);
+    }
+    
+    print("IOAPIC at ");
+    print_hex(madt->ioapic_address);
+    print(", ");
+    print_dec(redirection_entries);
+    print(" inputs\n");
+    return 0;
+}
+
+// Redirection entry of an ISA IRQ, or -1 if this IOAPIC does not serve it
+static int isa_entry(unsigned int irq) {
+    if (!ioapic || irq >= ISA_IRQS) {
+        return -1;
+    }
+    unsigned int entry = madt->isa_gsi[irq] - madt->ioapic_gsi_base;
+    return entry < redirection_entries ? (int)entry : -1;
+}
+
+// Deliver an ISA IRQ as vector to one CPU, with the polarity and trigger
+// mode the MADT asks for
+void ioapic_route_isa(unsigned int irq, unsigned int vector, unsigned int apic_id) {
+    int entry = isa_entry(irq);
+    if (entry < 0) {
+        return;
+    }
+    
+    unsigned int low = vector;
+    if ((madt->isa_flags[irq] & MPS_POLARITY_MASK) == MPS_POLARITY_LOW) {
+        low |= REDIR_ACTIVE_LOW;
+    }
+    if ((madt->isa_flags[irq] & MPS_TRIGGER_MASK) == MPS_TRIGGER_LEVEL) {
+        low |= REDIR_LEVEL;
+    }
+    
+    unsigned int flags = spin_lock_irqsave(&ioapic_lock);
+    ioapic_write(IOAPIC_REDTBL(entry) + 1, apic_id << 24);
+    ioapic_write(IOAPIC_REDTBL(entry), low);
+    spin_unlock_irqrestore(&ioapic_lock, flags);
+}
+
+void ioapic_mask_isa(unsigned int irq) {
+    int entry = isa_entry(irq);
+    if (entry < 0) {
+        return;
+    }
+    
+    unsigned int flags = spin_lock_irqsave(&ioapic_lock);
+    ioapic_write(IOAPIC_REDTBL(entry), ioapic_read(IOAPIC_REDTBL(entry)) | REDIR_MASKED);
+    spin_unlock_irqrestore(&ioapic_lock, flags);
+}
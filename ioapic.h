@@ -0,0 +1,11 @@
+// ioapic.h
+
+#ifndef IOAPIC_H
+#define IOAPIC_H
+
+// Functions
+int ioapic_init();
+void ioapic_route_isa(unsigned int irq, unsigned int vector, unsigned int apic_id);
+void ioapic_mask_isa(unsigned int irq);
+
+#endif
@@ -0,0 +1,344 @@
+// ipc.c
+
+#include "ipc.h"
+#include "process.h"
+#include "sched.h"
+#include "wait.h"
+#include "paging.h"
+#include "memory.h"
+#include "smp.h"
+
+// Messages are two words, passed in registers from the sender's system
+// call to the receiver's. Bigger payloads go as whole pages, which change
+// hands through their page table entries and are never copied: taken
+// from the sender by ipc_send_pages(), mapped at the receiver's break by
+// ipc_receive().
+
+// Sender blocked in ipc_send() until the reply, on its own stack
+struct ipc_waiter {
+    struct pcb* process;
+    unsigned int pid;
+    int reply;
+    int done;
+    int received;                   // The receiver took the message
+    struct ipc_waiter* next;
+};
+
+struct message {
+    unsigned int sender;
+    unsigned int word[2];
+    unsigned int* ptes;             // Page payload, PTEs taken from the sender
+    unsigned int pages;
+    struct ipc_waiter* waiter;      // 0 for posted messages
+};
+
+// A zeroed port is free
+struct port {
+    unsigned int owner;             // PID receiving from it, 0 if free
+    struct message queue[IPC_QUEUE];
+    unsigned int head;
+    unsigned int count;
+    struct pcb* receiver;           // Owner blocked in ipc_receive()
+    struct ipc_waiter* replies;     // Received, waiting for ipc_reply()
+    struct wait_queue senders;      // Waiting for queue space. Its lock guards the port.
+};
+
+static struct port ports[IPC_PORTS];
+
+static struct port* port_get(unsigned int id) {
+    return id < IPC_PORTS ? &ports[id] : 0;
+}
+
+// Return the pages of a message nobody received
+static void release_pages(struct message* msg) {
+    for (unsigned int i = 0; i < msg->pages; i++) {
+        frame_put((void*)(msg->ptes[i] & ~0xFFF));
+    }
+    kfree(msg->ptes);
+    msg->ptes = 0;
+    msg->pages = 0;
+}
+
+// Whether a sync sender could queue on a port: it exists, is open and
+// is not the sender's own
+static int port_accepts(unsigned int id) {
+    struct port* port = port_get(id);
+    if (!port) {
+        return 0;
+    }
+
+    unsigned int flags = spin_lock_irqsave(&port->senders.lock);
+    int open = port->owner && port->owner != current_process->pid;
+    spin_unlock_irqrestore(&port->senders.lock, flags);
+    return open;
+}
+
+// Give the pages of a message nobody took back to the sender, mapped
+// where they were. Shared pages are still mapped there: drop the extra
+// reference instead.
+static void return_pages(struct message* msg, unsigned int directory, unsigned int addr, int share) {
+    for (unsigned int i = 0; i < msg->pages; i++) {
+        unsigned int pte = msg->ptes[i];
+        if (share) {
+            frame_put((void*)(pte & ~0xFFF));
+        } else {
+            paging_map_page(directory, addr + i * PAGE_SIZE, pte & ~0xFFF, pte & 0xFFF);
+        }
+    }
+    kfree(msg->ptes);
+    msg->ptes = 0;
+    msg->pages = 0;
+}
+
+// Wake a sender blocked until the reply. Called with the port lock held.
+static void finish(struct ipc_waiter* waiter, int reply) {
+    waiter->reply = reply;
+    waiter->done = 1;
+    sched_wakeup(waiter->process);
+}
+
+// Create a port owned by the current process. Returns its number or -1.
+int ipc_port_create() {
+    for (unsigned int id = 0; id < IPC_PORTS; id++) {
+        struct port* port = &ports[id];
+        unsigned int flags = spin_lock_irqsave(&port->senders.lock);
+        int free = port->owner == 0;
+        if (free) {
+            port->owner = current_process->pid;
+            port->head = 0;
+            port->count = 0;
+            port->receiver = 0;
+            port->replies = 0;
+        }
+        spin_unlock_irqrestore(&port->senders.lock, flags);
+        if (free) {
+            return id;
+        }
+    }
+    return -1;
+}
+
+// Queue a message, waiting for space if sync. A sync sender then blocks
+// until the receiver replies. Returns the reply (0 for posts), -1 if the
+// port is gone or full. Pages go to the receiver only if it took the
+// message; otherwise msg still holds them for the sender to take back.
+static int send(unsigned int id, struct message* msg, int sync) {
+    struct port* port = port_get(id);
+    if (!port) {
+        return -1;
+    }
+
+    struct pcb* self = current_process;
+    struct ipc_waiter waiter = { self, self->pid, -1, 0, 0, 0 };
+    msg->sender = self->pid;
+    msg->waiter = sync ? &waiter : 0;
+
+    unsigned int flags = spin_lock_irqsave(&port->senders.lock);
+    while (sync && port->owner && port->owner != self->pid && port->count == IPC_QUEUE) {
+        waitq_sleep(&port->senders);
+    }
+
+    // Nobody would ever reply to an owner waiting on its own port
+    if (!port->owner || port->count == IPC_QUEUE || (sync && port->owner == self->pid)) {
+        spin_unlock_irqrestore(&port->senders.lock, flags);
+        return -1;
+    }
+
+    port->queue[(port->head + port->count) % IPC_QUEUE] = *msg;
+    port->count++;
+    if (port->receiver) {
+        sched_wakeup(port->receiver);
+        port->receiver = 0;
+    }
+
+    while (sync && !waiter.done) {
+        sched_block(&port->senders.lock);
+    }
+    spin_unlock_irqrestore(&port->senders.lock, flags);
+    if (waiter.received) {
+        msg->ptes = 0;
+        msg->pages = 0;
+    }
+    return waiter.done ? waiter.reply : 0;
+}
+
+// Send two words and wait for the reply
+int ipc_send(unsigned int port, unsigned int word0, unsigned int word1) {
+    struct message msg = { 0, { word0, word1 }, 0, 0, 0 };
+    return send(port, &msg, 1);
+}
+
+// Queue two words without waiting. Fails if the port's queue is full.
+int ipc_post(unsigned int port, unsigned int word0, unsigned int word1) {
+    struct message msg = { 0, { word0, word1 }, 0, 0, 0 };
+    return send(port, &msg, 0);
+}
+
+// Send the pages at addr and wait for the reply. count is the number of
+// pages, with IPC_SHARE to keep them mapped copy-on-write instead of
+// moving them out. Every page must be present.
+int ipc_send_pages(unsigned int port, unsigned int addr, unsigned int count) {
+    int share = (count & IPC_SHARE) != 0;
+    count &= ~IPC_SHARE;
+    unsigned int end = addr + count * PAGE_SIZE;
+    if (count == 0 || count > IPC_MAX_PAGES || (addr & (PAGE_SIZE - 1)) ||
+        addr < USER_CODE_BASE || end > VSYSCALL_ADDR || end < addr) {
+        return -1;
+    }
+
+    unsigned int directory = current_process->cr3;
+    for (unsigned int i = 0; i < count; i++) {
+        if (!paging_get_page(directory, addr + i * PAGE_SIZE)) {
+            return -1;
+        }
+    }
+    if (!port_accepts(port)) {
+        return -1;
+    }
+
+    struct message msg = { 0, { 0, 0 }, malloc(count * sizeof(unsigned int)), 0, 0 };
+    if (!msg.ptes) {
+        return -1;
+    }
+    for (unsigned int i = 0; i < count; i++) {
+        unsigned int pte = paging_give_page(directory, addr + i * PAGE_SIZE, share);
+        if (!pte) {
+            return_pages(&msg, directory, addr, share);
+            return -1;
+        }
+        msg.ptes[msg.pages++] = pte;
+    }
+
+    int reply = send(port, &msg, 1);
+    if (msg.pages) {
+        return_pages(&msg, directory, addr, share);
+    }
+    return reply;
+}
+
+// Map the pages of a message at the current process's break. Returns
+// their address, 0 (with the pages released) if they do not fit.
+static unsigned int map_pages(struct message* msg) {
+    struct pcb* self = current_process;
+    unsigned int base = (self->heap_end + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    unsigned int end = base + msg->pages * PAGE_SIZE;
+    if (base < self->heap_end || end < base || end > USER_HEAP_END) {
+        release_pages(msg);
+        return 0;
+    }
+
+    for (unsigned int i = 0; i < msg->pages; i++) {
+        unsigned int pte = msg->ptes[i];
+        if (paging_map_page(self->cr3, base + i * PAGE_SIZE, pte & ~0xFFF,
+                            pte & (PAGE_WRITE | PAGE_USER | PAGE_COW)) != 0) {
+            // Unmap what was mapped so far, so release_pages() has them all
+            while (i-- > 0) {
+                paging_unmap_page(self->cr3, base + i * PAGE_SIZE);
+            }
+            release_pages(msg);
+            return 0;
+        }
+    }
+    kfree(msg->ptes);
+    self->heap_end = end;
+    return base;
+}
+
+// Wait for the next message on a port owned by the current process.
+// Returns 0, or -1 if the port is not ours. Pages that do not fit below
+// USER_HEAP_END are dropped: msg->pages is then 0.
+int ipc_receive(unsigned int id, struct ipc_msg* msg) {
+    struct port* port = port_get(id);
+    struct pcb* self = current_process;
+    if (!port) {
+        return -1;
+    }
+
+    unsigned int flags = spin_lock_irqsave(&port->senders.lock);
+    if (port->owner != self->pid) {
+        spin_unlock_irqrestore(&port->senders.lock, flags);
+        return -1;
+    }
+    while (port->count == 0) {
+        port->receiver = self;
+        sched_block(&port->senders.lock);
+    }
+
+    struct message m = port->queue[port->head];
+    port->head = (port->head + 1) % IPC_QUEUE;
+    port->count--;
+    waitq_wake_one(&port->senders);
+    if (m.waiter) {
+        m.waiter->received = 1;
+        m.waiter->next = port->replies;
+        port->replies = m.waiter;
+    }
+    spin_unlock_irqrestore(&port->senders.lock, flags);
+
+    msg->sender = m.sender;
+    msg->waiting = m.waiter != 0;
+    msg->word[0] = m.word[0];
+    msg->word[1] = m.word[1];
+    msg->pages = m.pages;
+    msg->page = m.pages ? map_pages(&m) : 0;
+    if (!msg->page) {
+        msg->pages = 0;
+    }
+    return 0;
+}
+
+// Unblock the sender pid waiting for a reply from this port
+int ipc_reply(unsigned int id, unsigned int pid, int value) {
+    struct port* port = port_get(id);
+    if (!port) {
+        return -1;
+    }
+
+    int found = 0;
+    unsigned int flags = spin_lock_irqsave(&port->senders.lock);
+    if (port->owner == current_process->pid) {
+        struct ipc_waiter** link = &port->replies;
+        while (*link && (*link)->pid != pid) {
+            link = &(*link)->next;
+        }
+        if (*link) {
+            struct ipc_waiter* waiter = *link;
+            *link = waiter->next;
+            finish(waiter, value);
+            found = 1;
+        }
+    }
+    spin_unlock_irqrestore(&port->senders.lock, flags);
+    return found ? 0 : -1;
+}
+
+// Close the ports of an exiting process. Blocked senders get -1 and
+// take back the pages of their queued messages.
+void ipc_exit(unsigned int pid) {
+    for (unsigned int id = 0; id < IPC_PORTS; id++) {
+        struct port* port = &ports[id];
+        if (port->owner != pid) {
+            continue;  // Only pid itself can make it pid
+        }
+
+        unsigned int flags = spin_lock_irqsave(&port->senders.lock);
+        port->owner = 0;
+        while (port->count > 0) {
+            struct message* m = &port->queue[port->head];
+            if (m->waiter) {
+                finish(m->waiter, -1);
+            } else {
+                release_pages(m);
+            }
+            port->head = (port->head + 1) % IPC_QUEUE;
+            port->count--;
+        }
+        while (port->replies) {
+            struct ipc_waiter* waiter = port->replies;
+            port->replies = waiter->next;
+            finish(waiter, -1);
+        }
+        waitq_wake_all(&port->senders);
+        spin_unlock_irqrestore(&port->senders.lock, flags);
+    }
+}
@@ -0,0 +1,23 @@
+// ipc.h
+
+#ifndef IPC_H
+#define IPC_H
+
+#include "syscall.h"
+
+// Message ports. Each port belongs to the process that created it, which
+// is the only one receiving from it; any process may send to it.
+#define IPC_PORTS       32
+#define IPC_QUEUE       16      // Messages waiting per port
+#define IPC_MAX_PAGES   1024    // Largest page payload (4MB)
+
+// Functions
+int ipc_port_create();
+int ipc_send(unsigned int port, unsigned int word0, unsigned int word1);
+int ipc_post(unsigned int port, unsigned int word0, unsigned int word1);
+int ipc_send_pages(unsigned int port, unsigned int addr, unsigned int count);
+int ipc_receive(unsigned int port, struct ipc_msg* msg);
+int ipc_reply(unsigned int port, unsigned int pid, int value);
+void ipc_exit(unsigned int pid);
+
+#endif
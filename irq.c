@@ -0,0 +1,223 @@
+// irq.c
+
+#include "irq.h"
+#include "idt.h"
+#include "cpu.h"
+#include "smp.h"
+#include "timer.h"
+#include "spinlock.h"
+
+// External functions from kernel
+extern void print(const char* str);
+extern void print_dec(unsigned int n);
+extern void print_padded(unsigned int n, unsigned int width);
+extern unsigned int cycles_to_ns(unsigned long long cycles, unsigned int khz);
+
+// One handler on a vector; shared vectors chain them in registration order
+struct irq_action {
+    irq_fn handler;
+    void* ctx;
+    const char* name;
+    struct irq_action* next;
+};
+
+// Kept per CPU so the interrupt path never shares a cache line
+struct irq_counters {
+    unsigned int count;
+    unsigned int max_cycles;
+    unsigned long long total_cycles;
+    unsigned int latency[LATENCY_BUCKETS];
+};
+
+static struct irq_action* actions[IRQ_VECTORS];
+static struct irq_action action_pool[IRQ_MAX_ACTIONS];
+static unsigned int actions_used = 0;
+static struct spinlock irq_lock = SPINLOCK_INIT;
+
+static struct irq_counters counters[MAX_CPUS][IRQ_VECTORS];
+
+// Longest stretch each CPU spent in irq_handler() with interrupts disabled
+static unsigned int disabled_max[MAX_CPUS];
+
+// Add a handler to a hardware vector (32-63). Returns 0 on success.
+// Handlers run with interrupts off, in the order they were registered.
+int irq_register_vector(unsigned int vector, irq_fn handler, void* ctx, const char* name) {
+    if (vector < IRQ_BASE || vector >= IRQ_BASE + IRQ_VECTORS || !handler) {
+        return -1;
+    }
+    
+    unsigned int flags = spin_lock_irqsave(&irq_lock);
+    if (actions_used == IRQ_MAX_ACTIONS) {
+        spin_unlock_irqrestore(&irq_lock, flags);
+        return -1;
+    }
+    
+    struct irq_action* action = &action_pool[actions_used++];
+    action->handler = handler;
+    action->ctx = ctx;
+    action->name = name;
+    action->next = 0;
+    
+    // Filled in before it is linked: other CPUs walk the chain unlocked
+    struct irq_action** link = &actions[vector - IRQ_BASE];
+    while (*link) {
+        link = &(*link)->next;
+    }
+    *(struct irq_action* volatile*)link = action;
+    spin_unlock_irqrestore(&irq_lock, flags);
+    return 0;
+}
+
+// Add a handler for ISA IRQ 0-15 and unmask it
+int irq_register(unsigned int irq, irq_fn handler, void* ctx, const char* name) {
+    if (irq >= 16 || irq_register_vector(ISA_IRQ_VECTOR(irq), handler, ctx, name) != 0) {
+        return -1;
+    }
+    idt_unmask_irq(irq);
+    return 0;
+}
+
+int irq_has_handler(unsigned int irq) {
+    return irq < 16 && actions[ISA_IRQ_VECTOR(irq) - IRQ_BASE] != 0;
+}
+
+// Run every handler on the vector of regs and account the time they took.
+// Returns the frame to resume; the first handler that switches wins.
+struct registers* irq_dispatch(struct registers* regs) {
+    unsigned int vector = regs->int_no - IRQ_BASE;
+    if (vector >= IRQ_VECTORS) {
+        return regs;
+    }
+    
+    unsigned long long start = rdtsc();
+    struct registers* next = regs;
+    for (struct irq_action* a = actions[vector]; a; a = a->next) {
+        struct registers* frame = a->handler(regs, a->ctx);
+        if (next == regs) {
+            next = frame;
+        }
+    }
+    unsigned int cycles = rdtsc() - start;
+    
+    // A switch moves to another stack but not another CPU
+    struct irq_counters* c = &counters[this_cpu()->id][vector];
+    c->count++;
+    c->total_cycles += cycles;
+    if (cycles > c->max_cycles) {
+        c->max_cycles = cycles;
+    }
+    
+    int bucket = 31 - __builtin_clz(cycles | 1) - (LATENCY_SHIFT - 1);
+    if (bucket < 0) {
+        bucket = 0;
+    } else if (bucket >= LATENCY_BUCKETS) {
+        bucket = LATENCY_BUCKETS - 1;
+    }
+    c->latency[bucket]++;
+    return next;
+}
+
+// Record how long one pass through irq_handler() kept interrupts disabled
+void irq_account_disabled(unsigned int cycles) {
+    unsigned int id = this_cpu()->id;
+    if (cycles > disabled_max[id]) {
+        disabled_max[id] = cycles;
+    }
+}
+
+// Print a latency bound as ns below 10us, else as us
+static void print_latency(unsigned int ns) {
+    if (ns < 10000) {
+        print_dec(ns);
+        print("ns");
+    } else {
+        print_dec(ns / 1000);
+        print("us");
+    }
+}
+
+// Print per-vector counters and handler latency histograms, summed over CPUs
+void irq_stats() {
+    unsigned int khz = timer_tsc_khz();
+    
+    print("VEC  IRQ       COUNT    AVG ns    MAX ns  HANDLERS\n");
+    
+    for (unsigned int v = 0; v < IRQ_VECTORS; v++) {
+        struct irq_counters sum = {0};
+        for (unsigned int cpu = 0; cpu < cpu_count; cpu++) {
+            struct irq_counters* c = &counters[cpu][v];
+            sum.count += c->count;
+            sum.total_cycles += c->total_cycles;
+            if (c->max_cycles > sum.max_cycles) {
+                sum.max_cycles = c->max_cycles;
+            }
+            for (int b = 0; b < LATENCY_BUCKETS; b++) {
+                sum.latency[b] += c->latency[b];
+            }
+        }
+        if (sum.count == 0 && !actions[v]) {
+            continue;
+        }
+        
+        print_padded(IRQ_BASE + v, 3);
+        if (v < 16) {
+            print_padded(v, 5);
+        } else {
+            print("    -");
+        }
+        print_padded(sum.count, 12);
+        print_padded(sum.count ? cycles_to_ns(div64(sum.total_cycles, sum.count), khz) : 0, 10);
+        print_padded(cycles_to_ns(sum.max_cycles, khz), 10);
+        print("  ");
+        if (!actions[v]) {
+            print("(unhandled)");
+        }
+        for (struct irq_action* a = actions[v]; a; a = a->next) {
+            print(a->name);
+            if (a->next) {
+                print(", ");
+            }
+        }
+        print("\n");
+        
+        if (cpu_count > 1) {
+            print("          ");
+            for (unsigned int cpu = 0; cpu < cpu_count; cpu++) {
+                print(" CPU");
+                print_dec(cpu);
+                print(":");
+                print_dec(counters[cpu][v].count);
+            }
+            print("\n");
+        }
+        
+        // Only the buckets that were hit
+        if (sum.count) {
+            print("          ");
+            for (int b = 0; b < LATENCY_BUCKETS; b++) {
+                if (!sum.latency[b]) {
+                    continue;
+                }
+                if (b == LATENCY_BUCKETS - 1) {
+                    print(" >=");
+                    print_latency(cycles_to_ns(1ULL << (b + LATENCY_SHIFT - 1), khz));
+                } else {
+                    print(" <");
+                    print_latency(cycles_to_ns(1ULL << (b + LATENCY_SHIFT), khz));
+                }
+                print(":");
+                print_dec(sum.latency[b]);
+            }
+            print("\n");
+        }
+    }
+    
+    print("\nLongest interrupts-off time in IRQ handling:");
+    for (unsigned int cpu = 0; cpu < cpu_count; cpu++) {
+        print(" CPU");
+        print_dec(cpu);
+        print(":");
+        print_latency(cycles_to_ns(disabled_max[cpu], khz));
+    }
+    print("\n");
+}
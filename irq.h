@@ -0,0 +1,34 @@
+// irq.h
+
+#ifndef IRQ_H
+#define IRQ_H
+
+// Vectors 32-63 are hardware interrupts: ISA IRQs 0-15 first, then the
+// local APIC vectors (IPIs and the APIC timer)
+#define IRQ_BASE        32
+#define IRQ_VECTORS     32
+#define ISA_IRQ_VECTOR(irq) (IRQ_BASE + (irq))
+
+// Handlers registered on one vector, shared IRQs included
+#define IRQ_MAX_ACTIONS 32
+
+// Handler latency histogram: bucket i counts handlers that took fewer
+// than 2^(i + 8) TSC cycles, the last bucket everything slower
+#define LATENCY_BUCKETS 12
+#define LATENCY_SHIFT   8
+
+struct registers;
+
+// Returns the register frame to resume: regs, or another process's
+// frame if the handler switched
+typedef struct registers* (*irq_fn)(struct registers* regs, void* ctx);
+
+// Functions
+int irq_register(unsigned int irq, irq_fn handler, void* ctx, const char* name);
+int irq_register_vector(unsigned int vector, irq_fn handler, void* ctx, const char* name);
+int irq_has_handler(unsigned int irq);
+struct registers* irq_dispatch(struct registers* regs);
+void irq_account_disabled(unsigned int cycles);
+void irq_stats();
+
+#endif
@@ -4,6 +4,26 @@
 #include "keyboard.h"
 #include "memory.h"
 #include "fs.h"
+#include "process.h"
+#include "paging.h"
+#include "cpu.h"
+#include "timer.h"
+#include "sync.h"
+#include "gdt.h"
+#include "acpi.h"
+#include "lapic.h"
+#include "ioapic.h"
+#include "irq.h"
+#include "softirq.h"
+#include "fpu.h"
+#include "klib.h"
+#include "smp.h"
+#include "spinlock.h"
+#include "syscall.h"
+#include "elf.h"
+#include "multiboot.h"
+#include "boottime.h"
+#include "initcall.h"
 
 // VGA text mode constants
 #define VGA_ADDRESS 0xB8000
@@ -23,11 +43,28 @@ static unsigned int cursor_y = 2;  // Start below bootloader message
 static unsigned int prompt_x = 0;
 static unsigned int prompt_y = 0;
 
+// Serializes screen output between CPUs
+static struct spinlock console_lock = SPINLOCK_INIT;
+
+// Output of a background thread, held back until the shell next prints
+// its prompt so it does not land in the middle of a command line
+#define HELD_OUTPUT_SIZE 512
+
+static unsigned int held_pid = 0;
+static char held_output[HELD_OUTPUT_SIZE];
+static unsigned int held_length = 0;
+static int held_dropped = 0;
+
 // Forward declarations
 void print(const char* str);
 void print_dec(unsigned int n);
+void print_padded(unsigned int n, unsigned int width);
 void print_hex(unsigned int n);
 void putchar(char c);
+static void console_putchar(char c);
+void console_hold();
+void console_release();
+static void console_flush_held();
 void clear_screen();
 void update_cursor();
 void enable_cursor();
@@ -35,167 +72,73 @@ void scroll_screen();
 void process_command(const char* cmd);
 void run_shell();
 
-// Export timer handler for IDT
-void timer_handler();
-
-// Process management (integrated into kernel for now)
-#define MAX_PROCESSES 8
-#define PROCESS_READY    0
-#define PROCESS_RUNNING  1
-#define PROCESS_BLOCKED  2
-#define PROCESS_ZOMBIE   3
-
-struct pcb {
-    unsigned int pid;
-    unsigned int state;
-    char name[32];
-};
-
-static struct pcb process_table[MAX_PROCESSES];
-static int next_pid = 1;
-struct pcb* current_process = 0;
-
-// Initialize process management
-void init_processes() {
-    
-    // Clear process table
-    for (int i = 0; i < MAX_PROCESSES; i++) {
-        process_table[i].pid = 0;
-        process_table[i].state = PROCESS_ZOMBIE;
-        for (int j = 0; j < 32; j++) {
-            process_table[i].name[j] = '\0';
-        }
+// Body of the processes started by 'run': burn some CPU, report, exit
+static void test_process_main() {
+    volatile unsigned int counter = 0;
+    for (unsigned int i = 0; i < 200000000; i++) {
+        counter++;
     }
     
-    // Create kernel process
-    process_table[0].pid = 0;
-    process_table[0].state = PROCESS_RUNNING;
-    const char* kname = "kernel";
-    for (int i = 0; kname[i] && i < 31; i++) {
-        process_table[0].name[i] = kname[i];
-    }
-    
-    current_process = &process_table[0];
-    print("Process manager initialized\n");
+    unsigned int flags = irq_save();
+    print("\n[");
+    print(current_process->name);
+    print(" PID ");
+    print_dec(current_process->pid);
+    print("] finished after ");
+    print_dec(counter);
+    print(" iterations\n");
+    irq_restore(flags);
 }
 
-// Create a new process
-int create_process(const char* name) {
-    // Find free slot
-    int slot = -1;
-    for (int i = 1; i < MAX_PROCESSES; i++) {
-        if (process_table[i].state == PROCESS_ZOMBIE) {
-            slot = i;
-            break;
-        }
-    }
-    
-    if (slot == -1) {
-        print("No free process slots\n");
-        return -1;
+// Refresh interval of 'top'
+#define TOP_REFRESH_MS  1000
+
+// Shared state for 'synctest'
+#define SYNC_WORKERS    3
+#define SYNC_ROUNDS     200
+static struct mutex sync_lock;
+static struct semaphore sync_done;
+static unsigned int sync_counter;
+
+// Increment the shared counter non-atomically, yielding inside the
+// critical section so the other workers pile up on the mutex
+static void sync_worker_main() {
+    for (int i = 0; i < SYNC_ROUNDS; i++) {
+        mutex_lock(&sync_lock);
+        unsigned int value = sync_counter;
+        process_yield();
+        sync_counter = value + 1;
+        mutex_unlock(&sync_lock);
     }
-    
-    // Initialize PCB
-    process_table[slot].pid = next_pid++;
-    process_table[slot].state = PROCESS_READY;
-    
-    // Copy name
-    int i;
-    for (i = 0; i < 31 && name[i]; i++) {
-        process_table[slot].name[i] = name[i];
-    }
-    process_table[slot].name[i] = '\0';
-    
-    print("Process created: ");
-    print(name);
-    print(" (PID ");
-    print_dec(process_table[slot].pid);
-    print(")\n");
-    
-    return process_table[slot].pid;
+    sem_up(&sync_done);
 }
 
-// Simple round-robin scheduler
-void schedule() {
-    // Find next ready process
-    int current_pid = current_process->pid;
-    int next_slot = -1;
-    
-    // Look for next ready process after current
-    for (int i = current_pid + 1; i < MAX_PROCESSES; i++) {
-        if (process_table[i].state == PROCESS_READY) {
-            next_slot = i;
-            break;
-        }
-    }
-    
-    // If not found, wrap around
-    if (next_slot == -1) {
-        for (int i = 0; i <= current_pid; i++) {
-            if (process_table[i].state == PROCESS_READY || 
-                process_table[i].state == PROCESS_RUNNING) {
-                next_slot = i;
-                break;
+// Shared state for 'fputest'
+#define FPU_WORKERS     3
+#define FPU_ROUNDS      100
+static struct semaphore fpu_done;
+static unsigned int fpu_errors;
+static unsigned int fpu_next_id;
+
+// Keep a pattern of its own in xmm0 across many switches, while the
+// other workers load theirs
+static void fpu_worker_main() {
+    unsigned int id = __sync_add_and_fetch(&fpu_next_id, 1);
+    
+    unsigned int pattern[4] __attribute__((aligned(16))) = { id, id * 3, id * 5, id * 7 };
+    unsigned int check[4] __attribute__((aligned(16)));
+    asm volatile("movaps %0, %%xmm0" : : "m"(pattern));
+    
+    for (int i = 0; i < FPU_ROUNDS; i++) {
+        process_yield();
+        asm volatile("movaps %%xmm0, %0" : "=m"(check));
+        for (int j = 0; j < 4; j++) {
+            if (check[j] != pattern[j]) {
+                __sync_fetch_and_add(&fpu_errors, 1);
             }
         }
     }
-    
-    // Switch process (simplified - no actual context switch)
-    if (next_slot != -1 && next_slot != current_pid) {
-        if (current_process->state == PROCESS_RUNNING) {
-            current_process->state = PROCESS_READY;
-        }
-        current_process = &process_table[next_slot];
-        current_process->state = PROCESS_RUNNING;
-    }
-}
-
-// Timer tick counter
-static unsigned int timer_ticks = 0;
-
-// Timer handler
-void timer_handler() {
-    timer_ticks++;
-    
-    // Schedule every 30 ticks (about 1 second)
-    if (timer_ticks % 30 == 0) {
-        schedule();
-    }
-}
-
-// List processes
-void list_processes() {
-    print("PID  STATE    NAME\n");
-    print("---  -------  ----------------\n");
-    
-    for (int i = 0; i < MAX_PROCESSES; i++) {
-        if (process_table[i].state != PROCESS_ZOMBIE) {
-            // Print PID
-            if (process_table[i].pid < 10) print(" ");
-            print_dec(process_table[i].pid);
-            print("   ");
-            
-            // Print state
-            switch (process_table[i].state) {
-                case PROCESS_READY:
-                    print("READY   ");
-                    break;
-                case PROCESS_RUNNING:
-                    print("RUNNING ");
-                    break;
-                case PROCESS_BLOCKED:
-                    print("BLOCKED ");
-                    break;
-                default:
-                    print("UNKNOWN ");
-            }
-            
-            // Print name
-            print(" ");
-            print(process_table[i].name);
-            print("\n");
-        }
-    }
+    sem_up(&fpu_done);
 }
 
 // Update hardware cursor position
@@ -228,20 +171,60 @@ void scroll_screen() {
     unsigned short* vga_buffer = (unsigned short*)VGA_ADDRESS;
     
     // Move all lines up by one
-    for (int y = 0; y < VGA_HEIGHT - 1; y++) {
-        for (int x = 0; x < VGA_WIDTH; x++) {
-            vga_buffer[y * VGA_WIDTH + x] = vga_buffer[(y + 1) * VGA_WIDTH + x];
-        }
-    }
+    memmove(vga_buffer, vga_buffer + VGA_WIDTH, (VGA_HEIGHT - 1) * VGA_WIDTH * 2);
     
     // Clear the last line
-    for (int x = 0; x < VGA_WIDTH; x++) {
-        vga_buffer[(VGA_HEIGHT - 1) * VGA_WIDTH + x] = (WHITE_ON_BLACK << 8) | ' ';
-    }
+    memsetw(vga_buffer + (VGA_HEIGHT - 1) * VGA_WIDTH, (WHITE_ON_BLACK << 8) | ' ', VGA_WIDTH);
 }
 
 // Function to write a character to the screen
 void putchar(char c) {
+    unsigned int flags = spin_lock_irqsave(&console_lock);
+    if (held_pid && current_process && current_process->pid == held_pid) {
+        if (held_length < HELD_OUTPUT_SIZE) {
+            held_output[held_length++] = c;
+        } else {
+            held_dropped = 1;
+        }
+    } else {
+        console_putchar(c);
+    }
+    spin_unlock_irqrestore(&console_lock, flags);
+}
+
+// Hold back the calling thread's output until console_release()
+void console_hold() {
+    unsigned int flags = spin_lock_irqsave(&console_lock);
+    held_pid = current_process ? current_process->pid : 0;
+    spin_unlock_irqrestore(&console_lock, flags);
+}
+
+// Stop holding output. What was held shows before the next prompt.
+void console_release() {
+    unsigned int flags = spin_lock_irqsave(&console_lock);
+    held_pid = 0;
+    spin_unlock_irqrestore(&console_lock, flags);
+}
+
+// Print the held output, and mark any that did not fit; the shell
+// calls this before each prompt
+static void console_flush_held() {
+    unsigned int flags = spin_lock_irqsave(&console_lock);
+    for (unsigned int i = 0; i < held_length; i++) {
+        console_putchar(held_output[i]);
+    }
+    if (held_dropped) {
+        for (const char* s = "...(output truncated)\n"; *s; s++) {
+            console_putchar(*s);
+        }
+    }
+    held_length = 0;
+    held_dropped = 0;
+    spin_unlock_irqrestore(&console_lock, flags);
+}
+
+// putchar() with console_lock held
+static void console_putchar(char c) {
     if (c == '\n') {
         cursor_x = 0;
         cursor_y++;
@@ -303,10 +286,7 @@ void print(const char* str) {
 
 // Clear the screen
 void clear_screen() {
-    unsigned short* vga_buffer = (unsigned short*)VGA_ADDRESS;
-    for (int i = 0; i < VGA_WIDTH * VGA_HEIGHT; i++) {
-        vga_buffer[i] = (WHITE_ON_BLACK << 8) | ' ';
-    }
+    memsetw((void*)VGA_ADDRESS, (WHITE_ON_BLACK << 8) | ' ', VGA_WIDTH * VGA_HEIGHT);
     cursor_x = 0;
     cursor_y = 0;
     update_cursor();
@@ -332,6 +312,32 @@ void print_dec(unsigned int n) {
     }
 }
 
+// Right-align a decimal number in width columns
+void print_padded(unsigned int n, unsigned int width) {
+    unsigned int digits = 1;
+    for (unsigned int v = n; v >= 10; v /= 10) {
+        digits++;
+    }
+    for (; digits < width; digits++) {
+        print(" ");
+    }
+    print_dec(n);
+}
+
+// TSC cycles as time, at the rate timer_tsc_khz() measured. 0 while the
+// rate is unknown (khz 0).
+unsigned int cycles_to_ns(unsigned long long cycles, unsigned int khz) {
+    return khz ? div64(cycles * 1000000, khz) : 0;
+}
+
+unsigned int cycles_to_us(unsigned long long cycles, unsigned int khz) {
+    return khz ? div64(cycles * 1000, khz) : 0;
+}
+
+unsigned int cycles_to_ms(unsigned long long cycles, unsigned int khz) {
+    return khz ? div64(cycles, khz) : 0;
+}
+
 // Helper to print hex numbers
 void print_hex(unsigned int n) {
     print("0x");
@@ -349,6 +355,7 @@ static char command_buffer[CMD_BUFFER_SIZE];
 static int cmd_index = 0;
 
 // External functions from memory
+extern void memory_total();
 extern void memory_free();
 extern void memory_used();
 extern void free_all();
@@ -363,7 +370,9 @@ extern int fs_delete_file(const char* name);
 // Wrapper to show memory stats
 void show_mem_stats() {
     print("Memory Statistics:\n");
-    print("  Total: 1024 KB\n");
+    print("  Total: ");
+    memory_total();
+    print(" KB\n");
     print("  Used: ");
     memory_used();  // This will print "used,free"
     print(" bytes\n");
@@ -387,9 +396,18 @@ void process_command(const char* cmd) {
         print("  echo     - Echo text back\n");
         print("  mem      - Show memory statistics\n");
         print("  memtest  - Test memory allocation\n");
-        print("  memfree  - Free all allocated memory\n");
+        print("  memfree  - Release cached free memory\n");
+        print("  vmtest   - Test demand-zero paging\n");
         print("  ps       - List running processes\n");
-        print("  run      - Create a test process\n");
+        print("  top      - Show CPU usage per process (any key quits)\n");
+        print("  uptime   - Show time since boot and idle statistics\n");
+        print("  boottime - Show how long each boot phase took\n");
+        print("  irqstat  - Show interrupt counts and handler latencies\n");
+        print("  run      - Start a test process, or a program (usage: run [program])\n");
+        print("  synctest - Test mutexes and semaphores\n");
+        print("  fputest  - Test lazy FPU/SSE context switching\n");
+        print("  klibbench - Time memcpy/memset/memcmp/strlen variants\n");
+        print("  syscallbench - Time int 0x80 and SYSENTER round trips from ring 3\n");
         print("  ls       - List files\n");
         print("  create   - Create a file (usage: create filename)\n");
         print("  write    - Write to file (usage: write filename text)\n");
@@ -406,6 +424,7 @@ void process_command(const char* cmd) {
         print("- Keyboard input\n");
         print("- Memory management\n");
         print("- Process management\n");
+        print("- Symmetric multiprocessing\n");
         print("- Basic command shell\n");
     } else if (cmd[0] == 'e' && cmd[1] == 'c' && cmd[2] == 'h' && cmd[3] == 'o' && cmd[4] == ' ') {
         print(&cmd[5]);
@@ -453,14 +472,145 @@ void process_command(const char* cmd) {
             print("Allocation failed!\n");
         }
         
+        // Freed blocks should be handed out again
+        kfree(p1);
+        kfree(p2);
+        void* p3 = malloc(100);
+        if (p1 && p3 == p1) {
+            print("Freed block reused - OK\n");
+        } else {
+            print("Freed block not reused!\n");
+        }
+        kfree(p3);
         
     } else if (cmd[0] == 'm' && cmd[1] == 'e' && cmd[2] == 'm' && cmd[3] == 'f' && cmd[4] == 'r' && cmd[5] == 'e' && cmd[6] == 'e' && cmd[7] == '\0') {
         free_all();
-        print("All memory freed\n");
+        print("Cached memory released\n");
+    } else if (cmd[0] == 'v' && cmd[1] == 'm' && cmd[2] == 't' && cmd[3] == 'e' && cmd[4] == 's' && cmd[5] == 't' && cmd[6] == '\0') {
+        // Grow the heap without touching it, then touch a few pages
+        print("Testing demand-zero paging...\n");
+        
+        // Keep the scheduler from switching address spaces under us
+        asm volatile("cli");
+        
+        unsigned char* heap = (unsigned char*)process_sbrk(1024 * 1024);
+        if (heap == (unsigned char*)-1) {
+            print("Heap growth failed!\n");
+            asm volatile("sti");
+            return;
+        }
+        print("Heap grown by 1024 KB at ");
+        print_hex((unsigned int)heap);
+        print("\n");
+        
+        print("Free before touch: ");
+        memory_free();
+        print(" KB\n");
+        
+        int zeroed = 1;
+        for (int i = 0; i < 4; i++) {
+            unsigned char* page = heap + i * 64 * PAGE_SIZE;
+            if (page[1] != 0) {
+                zeroed = 0;
+            }
+            page[0] = 0xAA;
+        }
+        
+        print("Free after touching 4 pages: ");
+        memory_free();
+        print(" KB\n");
+        
+        if (zeroed) {
+            print("Fresh pages are zeroed - OK\n");
+        } else {
+            print("Fresh pages not zeroed!\n");
+        }
+        
+        process_sbrk(-1024 * 1024);
+        asm volatile("sti");
     } else if (cmd[0] == 'p' && cmd[1] == 's' && cmd[2] == '\0') {
-        list_processes();
+        process_list();
+    } else if (cmd[0] == 't' && cmd[1] == 'o' && cmd[2] == 'p' && cmd[3] == '\0') {
+        // Redraw until a key is pressed
+        while (1) {
+            clear_screen();
+            process_top();
+            print("\nPress any key to quit\n");
+            ksleep(TOP_REFRESH_MS);
+            
+            if (keyboard_has_char()) {
+                keyboard_getchar();
+                break;
+            }
+        }
+    } else if (cmd[0] == 'u' && cmd[1] == 'p' && cmd[2] == 't' && cmd[3] == 'i' && cmd[4] == 'm' && cmd[5] == 'e' && cmd[6] == '\0') {
+        timer_stats();
+    } else if (strcmp(cmd, "boottime") == 0) {
+        boottime_print();
+    } else if (cmd[0] == 'i' && cmd[1] == 'r' && cmd[2] == 'q' && cmd[3] == 's' && cmd[4] == 't' && cmd[5] == 'a' && cmd[6] == 't' && cmd[7] == '\0') {
+        irq_stats();
+        print("\n");
+        softirq_stats();
     } else if (cmd[0] == 'r' && cmd[1] == 'u' && cmd[2] == 'n' && cmd[3] == '\0') {
-        create_process("test_process");
+        process_create("test_process", test_process_main);
+    } else if (cmd[0] == 'r' && cmd[1] == 'u' && cmd[2] == 'n' && cmd[3] == ' ') {
+        // Run a program from the file system
+        const char* name = &cmd[4];
+        while (*name == ' ') name++;
+        elf_exec(name);
+    } else if (cmd[0] == 's' && cmd[1] == 'y' && cmd[2] == 'n' && cmd[3] == 'c' && cmd[4] == 't' && cmd[5] == 'e' && cmd[6] == 's' && cmd[7] == 't' && cmd[8] == '\0') {
+        mutex_init(&sync_lock);
+        sem_init(&sync_done, 0);
+        sync_counter = 0;
+        
+        int started = 0;
+        for (int i = 0; i < SYNC_WORKERS; i++) {
+            if (process_create("sync_worker", sync_worker_main) >= 0) {
+                started++;
+            }
+        }
+        
+        // Sleep until every worker has finished
+        for (int i = 0; i < started; i++) {
+            sem_down(&sync_done);
+        }
+        
+        print("Counter: ");
+        print_dec(sync_counter);
+        print(", expected ");
+        print_dec(started * SYNC_ROUNDS);
+        if (sync_counter == (unsigned int)(started * SYNC_ROUNDS)) {
+            print(" - OK\n");
+        } else {
+            print(" - FAILED\n");
+        }
+    } else if (cmd[0] == 'f' && cmd[1] == 'p' && cmd[2] == 'u' && cmd[3] == 't' && cmd[4] == 'e' && cmd[5] == 's' && cmd[6] == 't' && cmd[7] == '\0') {
+        if (!fpu_present()) {
+            print("No SSE support\n");
+            return;
+        }
+        sem_init(&fpu_done, 0);
+        fpu_errors = 0;
+        fpu_next_id = 0;
+        
+        int started = 0;
+        for (int i = 0; i < FPU_WORKERS; i++) {
+            if (process_create("fpu_worker", fpu_worker_main) >= 0) {
+                started++;
+            }
+        }
+        for (int i = 0; i < started; i++) {
+            sem_down(&fpu_done);
+        }
+        
+        print("Register mismatches: ");
+        print_dec(fpu_errors);
+        print(fpu_errors ? " - FAILED\n" : " - OK\n");
+        fpu_stats();
+    } else if (strcmp(cmd, "klibbench") == 0) {
+        klib_bench();
+    } else if (strcmp(cmd, "syscallbench") == 0) {
+        syscall_bench();
     } else if (cmd[0] == 'l' && cmd[1] == 's' && cmd[2] == '\0') {
         fs_list_files();
     } else if (cmd[0] == 'c' && cmd[1] == 'r' && cmd[2] == 'e' && cmd[3] == 'a' && cmd[4] == 't' && cmd[5] == 'e' && cmd[6] == ' ') {
@@ -492,11 +642,11 @@ void process_command(const char* cmd) {
         
         // Extract filename
         char fname[MAX_FILENAME_LENGTH];
-        int i;
-        for (i = 0; i < filename_len && i < MAX_FILENAME_LENGTH - 1; i++) {
-            fname[i] = filename[i];
+        if (filename_len > MAX_FILENAME_LENGTH - 1) {
+            filename_len = MAX_FILENAME_LENGTH - 1;
         }
-        fname[i] = '\0';
+        memcpy(fname, filename, filename_len);
+        fname[filename_len] = '\0';
         
         // Find start of text
         const char* text = filename + filename_len;
@@ -508,8 +658,7 @@ void process_command(const char* cmd) {
         }
         
         // Calculate text length
-        int text_len = 0;
-        while (text[text_len]) text_len++;
+        int text_len = strlen(text);
         
         // Write to file
         fs_write_file(fname, (const unsigned char*)text, text_len);
@@ -554,6 +703,7 @@ void run_shell() {
     print("\nType 'help' for available commands.\n\n");
     
     while (1) {
+        console_flush_held();
         print(">");
         
         // Save prompt position
@@ -564,12 +714,8 @@ void run_shell() {
         
         // Read command
         while (1) {
-            // Wait for keyboard input
-            while (!keyboard_has_char()) {
-                asm volatile("hlt");
-            }
-            
-            char c = keyboard_getchar();
+            // Sleep until a key is pressed
+            char c = keyboard_read();
             
             if (c == '\n') {
                 command_buffer[cmd_index] = '\0';
@@ -591,34 +737,133 @@ void run_shell() {
     }
 }
 
-// Kernel entry point
-void kernel_main() {
+// End of the kernel image, from link.ld
+extern char image_end[];
+
+// How stage 2 loaded the kernel. Its TSC readings are converted with the
+// frequency measured since timer_init, so call this late in the boot.
+static void print_boot_load(struct boot_info* boot_info) {
+    if (boot_info->load_method == BOOT_LOAD_MULTIBOOT) {
+        print("Booted by a Multiboot loader, command line: ");
+        print(multiboot_cmdline());
+        print("\n");
+        return;
+    }
+    
+    print("Kernel image: ");
+    print_dec(boot_info->kernel_sectors / 2);
+    print(boot_info->load_method == BOOT_LOAD_EDD ? " KB read with EDD" : " KB read with CHS");
+    
+    unsigned int khz = timer_tsc_khz();
+    if (khz) {
+        print(" in ");
+        print_dec(cycles_to_ms(boot_info->load_end_tsc - boot_info->load_start_tsc, khz));
+        print(" ms");
+    }
+    print("\n");
+    
+    // Part of the load time above
+    if (boot_info->kernel_packed) {
+        print("LZ4: unpacked to ");
+        print_dec(((unsigned int)image_end - KERNEL_ADDR) / 1024);
+        print(" KB");
+        if (khz) {
+            print(" in ");
+            print_dec(cycles_to_us(boot_info->unpack_cycles, khz));
+            print(" us");
+        }
+        print("\n");
+    }
+}
+
+// Kernel entry point (info comes from the bootloader in EBX, magic in EAX)
+void kernel_main(void* info, unsigned int magic) {
+    // Copy out a Multiboot loader's information before anything can
+    // overwrite it
+    struct boot_info* boot_info = multiboot_parse(magic, info);
+    boottime_start(boot_info);
+    
     clear_screen();
     
     enable_cursor();
     
     print("Kernel loaded successfully!\n");
     print("\n");
+    boottime_mark("console");
+    
+    // Our own GDT first: GS must point at the per-CPU data
+    gdt_init();
+    boottime_mark("GDT");
     
     print("Initializing IDT...\n");
     idt_init();
+    boottime_mark("IDT");
+    
+    print("Initializing FPU...\n");
+    fpu_init();
+    klib_init();
+    boottime_mark("FPU, klib");
     
     print("Initializing keyboard...\n");
     keyboard_init();
+    boottime_mark("keyboard");
     
     print("Initializing memory...\n");
-    memory_init();
-    print("Memory: 1MB at 0x200000\n");
-    
-    print("Initializing file system...\n");
-    fs_init();
+    memory_init(boot_info->mmap, boot_info->mmap_count);
+    print("Memory: ");
+    memory_total();
+    print(" KB usable\n");
+    boottime_mark("memory");
+    
+    print("Initializing ACPI...\n");
+    acpi_init();
+    boottime_mark("ACPI");
+    
+    print("Initializing paging...\n");
+    paging_init();
+    syscall_init();
+    boottime_mark("paging, syscalls");
+    
+    print("Initializing local APIC...\n");
+    lapic_init();
+    
+    // Device IRQs through the IOAPIC when there is one
+    if (lapic_present() && ioapic_init() == 0) {
+        idt_use_apic();
+    } else {
+        print("Using 8259 PIC\n");
+    }
+    boottime_mark("APIC, IOAPIC");
     
     print("Initializing process manager...\n");
-    init_processes();
+    process_init();
+    boottime_mark("processes");
+    
+    print("Initializing timer...\n");
+    timer_init();
+    boottime_mark("timer");
     
     print("Enabling interrupts...\n");
     asm volatile("sti");
     
+    timer_init_lapic();
+    boottime_mark("APIC timer");
+    
+    // Subsystems that registered with initcall(); the file system is
+    // one of them, so the programs go in afterwards
+    initcall_run(INITCALL_BOOT);
+    if (boot_info->load_method == BOOT_LOAD_MULTIBOOT) {
+        multiboot_load_modules();
+    } else {
+        fs_load_package((void*)PROGRAMS_ADDR, PROGRAMS_SIZE);
+    }
+    boottime_mark("programs");
+    
+    print_boot_load(boot_info);
+    
+    // The rest, application processors among them, once the prompt is up
+    initcall_start_deferred();
+    
     run_shell();
     
     while (1) {
@@ -1,15 +1,58 @@
 ; kernel_entry.asm
 [BITS 32]
 [EXTERN kernel_main]
+[EXTERN image_end]
+[EXTERN kernel_end]
+
+KERNEL_MAGIC equ 0x4C4E524B     ; "KRNL", see boot.h
+
+; Multiboot headers, so QEMU -kernel (Multiboot 1) and GRUB (either) can
+; load kernel.elf directly. kernel_main tells the boots apart by EAX.
+MB1_MAGIC    equ 0x1BADB002
+MB1_FLAGS    equ 0x3            ; Page-aligned modules, memory information
+MB2_MAGIC    equ 0xE85250D6
+MB2_LENGTH   equ multiboot2_end - multiboot2_header
 
 section .text
 global _start
 
 _start:
+    jmp short entry
+
+    ; Header stage2.asm reads to size the load: bytes to read from disk
+    ; end at image_end, the bss after them up to kernel_end is zeroed
+    align 4
+    dd KERNEL_MAGIC
+    dd image_end
+    dd kernel_end
+
+    ; Multiboot 1: within the first 8KB of the file, 4-byte aligned
+    align 4
+    dd MB1_MAGIC
+    dd MB1_FLAGS
+    dd 0x100000000 - (MB1_MAGIC + MB1_FLAGS)
+
+    ; Multiboot 2: within the first 32KB, 8-byte aligned, then tags
+    align 8
+multiboot2_header:
+    dd MB2_MAGIC
+    dd 0                        ; i386
+    dd MB2_LENGTH
+    dd 0x100000000 - (MB2_MAGIC + MB2_LENGTH)
+    dw 6, 0                     ; Page-aligned modules
+    dd 8
+    dw 0, 0                     ; End of tags
+    dd 8
+multiboot2_end:
+
+entry:
     ; Set up the stack
     mov esp, 0x90000
     
-    ; Call the C kernel main function
+    ; Call the C kernel main function with the boot info pointer and
+    ; the Multiboot magic, if a Multiboot loader started us
+    push eax
+    push ebx
     call kernel_main
     
     ; If kernel_main returns (it shouldn't), halt
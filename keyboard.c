@@ -2,6 +2,11 @@
 
 #include "keyboard.h"
 #include "idt.h"
+#include "wait.h"
+#include "cpu.h"
+#include "irq.h"
+#include "softirq.h"
+#include "spinlock.h"
 
 // External functions from kernel
 extern void putchar(char c);
@@ -23,6 +28,16 @@ static char keyboard_buffer[KEYBOARD_BUFFER_SIZE];
 static int buffer_start = 0;
 static int buffer_end = 0;
 
+// Processes sleeping in keyboard_read(). Its lock also protects the buffer.
+static struct wait_queue readers;
+
+// Raw scancodes from the IRQ handler to the bottom half. IRQ1 and its
+// bottom half stay on the boot CPU, so one writer and one reader.
+#define SCANCODE_RING_SIZE 64
+static unsigned char scancode_ring[SCANCODE_RING_SIZE];
+static volatile unsigned int scancode_head = 0;
+static volatile unsigned int scancode_tail = 0;
+
 // US QWERTZ keyboard scancode to ASCII lookup tables
 // Normal keys (without shift)
 static const unsigned char scancode_to_ascii[128] = {
@@ -101,8 +116,8 @@ static void add_to_buffer(char c) {
     }
 }
 
-// Read character from keyboard buffer
-char keyboard_getchar() {
+// Take a character from the buffer, with readers.lock held
+static char take_from_buffer() {
     if (buffer_start == buffer_end) {
         return 0;  // Buffer empty
     }
@@ -112,11 +127,33 @@ char keyboard_getchar() {
     return c;
 }
 
+// Read character from keyboard buffer
+char keyboard_getchar() {
+    unsigned int flags = spin_lock_irqsave(&readers.lock);
+    char c = take_from_buffer();
+    spin_unlock_irqrestore(&readers.lock, flags);
+    return c;
+}
+
 // Check if keyboard buffer has data
 int keyboard_has_char() {
     return buffer_start != buffer_end;
 }
 
+// Read a character, sleeping until one arrives
+char keyboard_read() {
+    unsigned int flags = spin_lock_irqsave(&readers.lock);
+    
+    // Checked under the lock, so the wakeup cannot be missed
+    while (buffer_start == buffer_end) {
+        waitq_sleep(&readers);
+    }
+    char c = take_from_buffer();
+    
+    spin_unlock_irqrestore(&readers.lock, flags);
+    return c;
+}
+
 // Process scancode and convert to ASCII
 static void process_scancode(unsigned char scancode) {
     // Check if it's a key release (high bit set)
@@ -178,17 +215,37 @@ static void process_scancode(unsigned char scancode) {
     
     // Add to buffer (shell will handle echo)
     if (ascii) {
+        unsigned int flags = spin_lock_irqsave(&readers.lock);
         add_to_buffer(ascii);
+        waitq_wake_one(&readers);
+        spin_unlock_irqrestore(&readers.lock, flags);
     }
 }
 
-// Keyboard interrupt handler (called from IRQ1)
-void keyboard_handler() {
+// Keyboard interrupt handler (IRQ1): only takes the scancode off the
+// controller, translation happens in the bottom half
+static struct registers* keyboard_handler(struct registers* regs, void* ctx) {
+    (void)ctx;
+    
     // Read scancode from keyboard controller
     unsigned char scancode = inb(KEYBOARD_DATA_PORT);
     
-    // Process the scancode
-    process_scancode(scancode);
+    unsigned int next_head = (scancode_head + 1) % SCANCODE_RING_SIZE;
+    if (next_head != scancode_tail) {  // Dropped if the ring is full
+        scancode_ring[scancode_head] = scancode;
+        scancode_head = next_head;
+    }
+    softirq_raise(SOFTIRQ_KEYBOARD);
+    return regs;
+}
+
+// Keyboard bottom half: process the scancodes queued by the handler
+static void keyboard_softirq() {
+    while (scancode_tail != scancode_head) {
+        unsigned char scancode = scancode_ring[scancode_tail];
+        scancode_tail = (scancode_tail + 1) % SCANCODE_RING_SIZE;
+        process_scancode(scancode);
+    }
 }
 
 // Initialize keyboard driver
@@ -196,6 +253,7 @@ void keyboard_init() {
     // Clear keyboard buffer
     buffer_start = 0;
     buffer_end = 0;
+    waitq_init(&readers);
     
     // Clear key states
     shift_pressed = 0;
@@ -208,5 +266,8 @@ void keyboard_init() {
         inb(KEYBOARD_DATA_PORT);
     }
     
+    softirq_register(SOFTIRQ_KEYBOARD, keyboard_softirq, "keyboard");
+    irq_register(1, keyboard_handler, 0, "keyboard");
+    
     print("Keyboard driver initialized\n");
 }
@@ -6,13 +6,13 @@
 // Initialize keyboard driver
 void keyboard_init();
 
-// Keyboard interrupt handler
-void keyboard_handler();
-
 // Get a character from keyboard buffer (returns 0 if buffer empty)
 char keyboard_getchar();
 
 // Check if keyboard buffer has characters
 int keyboard_has_char();
 
+// Get a character, sleeping until one is available
+char keyboard_read();
+
 #endif
@@ -0,0 +1,338 @@
+// klib.c
+
+#include "klib.h"
+#include "fpu.h"
+#include "cpu.h"
+#include "memory.h"
+
+// External functions from kernel
+extern void print(const char* str);
+extern void print_dec(unsigned int n);
+extern void print_padded(unsigned int n, unsigned int width);
+
+// Set by klib_init() when SSE2 is available and enabled
+static int use_sse2 = 0;
+
+// Each word of a string with a zero byte has the top bit of that byte set
+#define ONES    0x01010101
+#define HIGHS   0x80808080
+#define HAS_ZERO(w) (((w) - ONES) & ~(w) & HIGHS)
+
+// Pick the fastest routines this CPU supports
+void klib_init() {
+    unsigned int eax, ebx, ecx, edx;
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    use_sse2 = fpu_present() && (edx & CPUID_SSE2);
+    
+    print("klib: rep movsd/stosd");
+    if (use_sse2) {
+        print(", SSE2 from ");
+        print_dec(KLIB_SSE_MIN);
+        print(" bytes");
+    }
+    print("\n");
+}
+
+// Byte at a time, the reference the others are measured against
+static void copy_bytes(unsigned char* dst, const unsigned char* src, unsigned int n) {
+    for (unsigned int i = 0; i < n; i++) {
+        dst[i] = src[i];
+    }
+}
+
+// rep movsd for the bulk once the destination is dword aligned
+static void copy_rep(void* dst, const void* src, unsigned int n) {
+    unsigned int head = -(unsigned int)dst & 3;
+    if (head > n) {
+        head = n;
+    }
+    unsigned int dwords = (n - head) >> 2;
+    unsigned int tail = (n - head) & 3;
+    asm volatile("rep movsb" : "+D"(dst), "+S"(src), "+c"(head) : : "memory");
+    asm volatile("rep movsl" : "+D"(dst), "+S"(src), "+c"(dwords) : : "memory");
+    asm volatile("rep movsb" : "+D"(dst), "+S"(src), "+c"(tail) : : "memory");
+}
+
+// 64 bytes per iteration through xmm0-3 into a 16-byte aligned
+// destination. The compiler never allocates SSE registers (no -msse),
+// so they need no clobbers.
+static void copy_sse2(void* dst, const void* src, unsigned int n) {
+    unsigned int head = -(unsigned int)dst & 15;
+    copy_rep(dst, src, head);
+    unsigned char* d = (unsigned char*)dst + head;
+    const unsigned char* s = (const unsigned char*)src + head;
+    n -= head;
+    
+    unsigned int blocks = n >> 6;
+    if (blocks) {
+        unsigned int flags = fpu_kernel_begin();
+        asm volatile("1:\n\t"
+                     "movdqu   (%1), %%xmm0\n\t"
+                     "movdqu 16(%1), %%xmm1\n\t"
+                     "movdqu 32(%1), %%xmm2\n\t"
+                     "movdqu 48(%1), %%xmm3\n\t"
+                     "movdqa %%xmm0,   (%0)\n\t"
+                     "movdqa %%xmm1, 16(%0)\n\t"
+                     "movdqa %%xmm2, 32(%0)\n\t"
+                     "movdqa %%xmm3, 48(%0)\n\t"
+                     "add $64, %0\n\t"
+                     "add $64, %1\n\t"
+                     "dec %2\n\t"
+                     "jnz 1b"
+                     : "+r"(d), "+r"(s), "+r"(blocks) : : "memory");
+        fpu_kernel_end(flags);
+    }
+    copy_rep(d, s, n & 63);
+}
+
+void* memcpy(void* dst, const void* src, unsigned int n) {
+    if (use_sse2 && n >= KLIB_SSE_MIN) {
+        copy_sse2(dst, src, n);
+    } else {
+        copy_rep(dst, src, n);
+    }
+    return dst;
+}
+
+// Copy between buffers that may overlap
+void* memmove(void* dst, const void* src, unsigned int n) {
+    if ((unsigned int)dst - (unsigned int)src >= n) {
+        return memcpy(dst, src, n);  // No harmful overlap copying forwards
+    }
+    
+    // Backwards from the last byte, with the direction flag set
+    unsigned char* d = (unsigned char*)dst + n - 1;
+    const unsigned char* s = (const unsigned char*)src + n - 1;
+    unsigned int tail = n & 3;
+    unsigned int dwords = n >> 2;
+    asm volatile("std\n\t"
+                 "rep movsb\n\t"
+                 "sub $3, %%edi\n\t"
+                 "sub $3, %%esi\n\t"
+                 "mov %3, %%ecx\n\t"
+                 "rep movsl\n\t"
+                 "cld"
+                 : "+D"(d), "+S"(s), "+c"(tail) : "r"(dwords) : "memory");
+    return dst;
+}
+
+static void fill_bytes(unsigned char* dst, unsigned char c, unsigned int n) {
+    for (unsigned int i = 0; i < n; i++) {
+        dst[i] = c;
+    }
+}
+
+static void fill_rep(void* dst, unsigned char c, unsigned int n) {
+    unsigned int head = -(unsigned int)dst & 3;
+    if (head > n) {
+        head = n;
+    }
+    unsigned int dwords = (n - head) >> 2;
+    unsigned int tail = (n - head) & 3;
+    unsigned int pattern = c * ONES;
+    asm volatile("rep stosb" : "+D"(dst), "+c"(head) : "a"(pattern) : "memory");
+    asm volatile("rep stosl" : "+D"(dst), "+c"(dwords) : "a"(pattern) : "memory");
+    asm volatile("rep stosb" : "+D"(dst), "+c"(tail) : "a"(pattern) : "memory");
+}
+
+static void fill_sse2(void* dst, unsigned char c, unsigned int n) {
+    unsigned int head = -(unsigned int)dst & 15;
+    fill_rep(dst, c, head);
+    unsigned char* d = (unsigned char*)dst + head;
+    n -= head;
+    
+    unsigned int blocks = n >> 6;
+    if (blocks) {
+        unsigned int flags = fpu_kernel_begin();
+        asm volatile("movd %2, %%xmm0\n\t"
+                     "pshufd $0, %%xmm0, %%xmm0\n\t"
+                     "1:\n\t"
+                     "movdqa %%xmm0,   (%0)\n\t"
+                     "movdqa %%xmm0, 16(%0)\n\t"
+                     "movdqa %%xmm0, 32(%0)\n\t"
+                     "movdqa %%xmm0, 48(%0)\n\t"
+                     "add $64, %0\n\t"
+                     "dec %1\n\t"
+                     "jnz 1b"
+                     : "+r"(d), "+r"(blocks) : "r"(c * ONES) : "memory");
+        fpu_kernel_end(flags);
+    }
+    fill_rep(d, c, n & 63);
+}
+
+void* memset(void* dst, int c, unsigned int n) {
+    if (use_sse2 && n >= KLIB_SSE_MIN) {
+        fill_sse2(dst, c, n);
+    } else {
+        fill_rep(dst, c, n);
+    }
+    return dst;
+}
+
+// Fill count 16-bit words, such as VGA text cells
+void* memsetw(void* dst, unsigned short value, unsigned int count) {
+    void* d = dst;
+    asm volatile("rep stosw" : "+D"(d), "+c"(count) : "a"(value) : "memory");
+    return dst;
+}
+
+static int compare_bytes(const unsigned char* a, const unsigned char* b, unsigned int n) {
+    for (unsigned int i = 0; i < n; i++) {
+        if (a[i] != b[i]) {
+            return a[i] - b[i];
+        }
+    }
+    return 0;
+}
+
+// A dword at a time while equal, the first difference found bytewise
+int memcmp(const void* a, const void* b, unsigned int n) {
+    const unsigned int* wa = (const unsigned int*)a;
+    const unsigned int* wb = (const unsigned int*)b;
+    while (n >= 4 && *wa == *wb) {
+        wa++;
+        wb++;
+        n -= 4;
+    }
+    return compare_bytes((const unsigned char*)wa, (const unsigned char*)wb, n);
+}
+
+static unsigned int length_bytes(const char* s) {
+    unsigned int n = 0;
+    while (s[n]) {
+        n++;
+    }
+    return n;
+}
+
+// Bytewise up to a dword boundary, then a dword at a time. Aligned
+// loads never cross into an unmapped page past the terminator.
+unsigned int strlen(const char* s) {
+    const char* p = s;
+    while ((unsigned int)p & 3) {
+        if (!*p) {
+            return p - s;
+        }
+        p++;
+    }
+    
+    const unsigned int* w = (const unsigned int*)p;
+    while (!HAS_ZERO(*w)) {
+        w++;
+    }
+    p = (const char*)w;
+    while (*p) {
+        p++;
+    }
+    return p - s;
+}
+
+int strcmp(const char* a, const char* b) {
+    while (*a && *a == *b) {
+        a++;
+        b++;
+    }
+    return (unsigned char)*a - (unsigned char)*b;
+}
+
+// Copy a string into a buffer of size bytes, always terminated.
+// Returns the length of src, truncation happened if it is >= size.
+unsigned int strlcpy(char* dst, const char* src, unsigned int size) {
+    unsigned int len = strlen(src);
+    if (size) {
+        unsigned int n = len < size - 1 ? len : size - 1;
+        copy_rep(dst, src, n);
+        dst[n] = '\0';
+    }
+    return len;
+}
+
+// Benchmark sizes and repetitions; the best run is reported
+#define BENCH_SIZES     5
+#define BENCH_RUNS      8
+#define BENCH_MAX       8192
+
+static const unsigned int bench_sizes[BENCH_SIZES] = { 64, 256, 1024, 4096, 8192 };
+
+enum {
+    BENCH_COPY_BYTES, BENCH_COPY_REP, BENCH_COPY_SSE2,
+    BENCH_FILL_BYTES, BENCH_FILL_REP, BENCH_FILL_SSE2,
+    BENCH_CMP_BYTES, BENCH_CMP_WORDS,
+    BENCH_LEN_BYTES, BENCH_LEN_WORDS,
+    BENCH_ROUTINES
+};
+
+static const char* bench_names[BENCH_ROUTINES] = {
+    "memcpy  bytes     ", "memcpy  rep movsd ", "memcpy  sse2      ",
+    "memset  bytes     ", "memset  rep stosd ", "memset  sse2      ",
+    "memcmp  bytes     ", "memcmp  dwords    ",
+    "strlen  bytes     ", "strlen  dwords    ",
+};
+
+static void bench_run(int routine, unsigned char* a, unsigned char* b, unsigned int n) {
+    switch (routine) {
+        case BENCH_COPY_BYTES: copy_bytes(a, b, n); break;
+        case BENCH_COPY_REP:   copy_rep(a, b, n); break;
+        case BENCH_COPY_SSE2:  copy_sse2(a, b, n); break;
+        case BENCH_FILL_BYTES: fill_bytes(a, 0x5A, n); break;
+        case BENCH_FILL_REP:   fill_rep(a, 0x5A, n); break;
+        case BENCH_FILL_SSE2:  fill_sse2(a, 0x5A, n); break;
+        case BENCH_CMP_BYTES:  compare_bytes(a, b, n); break;
+        case BENCH_CMP_WORDS:  memcmp(a, b, n); break;
+        case BENCH_LEN_BYTES:  length_bytes((const char*)a); break;
+        case BENCH_LEN_WORDS:  strlen((const char*)a); break;
+    }
+}
+
+// Print the best-of-BENCH_RUNS cycle count of every routine and size
+void klib_bench() {
+    unsigned char* a = (unsigned char*)malloc(BENCH_MAX);
+    unsigned char* b = (unsigned char*)malloc(BENCH_MAX);
+    if (!a || !b) {
+        print("Out of memory\n");
+        kfree(a);
+        kfree(b);
+        return;
+    }
+    
+    print("TSC cycles      bytes:");
+    for (int i = 0; i < BENCH_SIZES; i++) {
+        print_padded(bench_sizes[i], 8);
+    }
+    print("\n");
+    
+    for (int r = 0; r < BENCH_ROUTINES; r++) {
+        if (!use_sse2 && (r == BENCH_COPY_SSE2 || r == BENCH_FILL_SSE2)) {
+            continue;
+        }
+        
+        print(bench_names[r]);
+        print("    ");
+        for (int i = 0; i < BENCH_SIZES; i++) {
+            unsigned int n = bench_sizes[i];
+            
+            // Equal buffers for memcmp, an n-1 character string for strlen
+            fill_rep(a, 'x', n);
+            fill_rep(b, 'x', n);
+            a[n - 1] = '\0';
+            b[n - 1] = '\0';
+            
+            unsigned int best = 0xFFFFFFFF;
+            for (int run = 0; run < BENCH_RUNS; run++) {
+                unsigned int flags = irq_save();
+                unsigned long long start = rdtsc();
+                bench_run(r, a, b, n);
+                unsigned int cycles = rdtsc() - start;
+                irq_restore(flags);
+                if (cycles < best) {
+                    best = cycles;
+                }
+            }
+            print_padded(best, 8);
+        }
+        print("\n");
+    }
+    
+    kfree(a);
+    kfree(b);
+}
@@ -0,0 +1,22 @@
+// klib.h
+
+#ifndef KLIB_H
+#define KLIB_H
+
+// Copies and fills at least this large use SSE2 when the CPU has it;
+// below it saving the FPU state costs more than it gains
+#define KLIB_SSE_MIN    2048
+
+// Functions
+void klib_init();
+void* memcpy(void* dst, const void* src, unsigned int n);
+void* memmove(void* dst, const void* src, unsigned int n);
+void* memset(void* dst, int c, unsigned int n);
+void* memsetw(void* dst, unsigned short value, unsigned int count);
+int memcmp(const void* a, const void* b, unsigned int n);
+unsigned int strlen(const char* s);
+int strcmp(const char* a, const char* b);
+unsigned int strlcpy(char* dst, const char* src, unsigned int size);
+void klib_bench();
+
+#endif
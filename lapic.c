@@ -0,0 +1,122 @@
+// lapic.c
+
+#include "lapic.h"
+#include "idt.h"
+#include "paging.h"
+#include "cpu.h"
+
+// External functions from kernel
+extern void print(const char* str);
+extern void print_hex(unsigned int n);
+
+// APIC base MSR
+#define IA32_APIC_BASE          0x1B
+#define IA32_APIC_BASE_ENABLE   0x800
+
+// Mapped register window, 0 without a local APIC
+static volatile unsigned int* lapic = 0;
+
+static inline unsigned int lapic_read(unsigned int reg) {
+    return lapic[reg / 4];
+}
+
+static inline void lapic_write(unsigned int reg, unsigned int val) {
+    lapic[reg / 4] = val;
+}
+
+// Timer input clock is the bus clock divided by 16
+#define LAPIC_TIMER_DIVIDE_16   0x3
+
+// Turn on this CPU's local APIC and accept all interrupt priorities
+static void lapic_enable() {
+    lapic_write(LAPIC_SVR, LAPIC_SVR_ENABLE | SPURIOUS_VECTOR);
+    lapic_write(LAPIC_TPR, 0);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_TIMER_MASKED);
+    lapic_write(LAPIC_TIMER_DIVIDE, LAPIC_TIMER_DIVIDE_16);
+    lapic_write(LAPIC_ESR, 0);
+    lapic_write(LAPIC_ESR, 0);
+}
+
+// Find and map the boot CPU's local APIC. Returns 0 on success.
+// Must run after paging_init().
+int lapic_init() {
+    unsigned int eax, ebx, ecx, edx;
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    if (!(edx & CPUID_APIC) || !(edx & CPUID_MSR)) {
+        print("No local APIC\n");
+        return -1;
+    }
+    
+    unsigned int base = (unsigned int)rdmsr(IA32_APIC_BASE) & ~0xFFF;
+    wrmsr(IA32_APIC_BASE, base | IA32_APIC_BASE_ENABLE);
+    
+    if (paging_map_mmio(base) != 0) {
+        print("Local APIC: cannot map registers\n");
+        return -1;
+    }
+    lapic = (volatile unsigned int*)base;
+    lapic_enable();
+    
+    print("Local APIC at ");
+    print_hex(base);
+    print("\n");
+    return 0;
+}
+
+// Enable the local APIC of an application processor
+void lapic_init_ap() {
+    lapic_enable();
+}
+
+int lapic_present() {
+    return lapic != 0;
+}
+
+unsigned int lapic_id() {
+    return lapic_read(LAPIC_ID) >> 24;
+}
+
+// Acknowledge an interrupt delivered by the local APIC
+void lapic_eoi() {
+    lapic_write(LAPIC_EOI, 0);
+}
+
+// Program this CPU's timer: periodic or one-shot, optionally masked.
+// Counts down from count at a sixteenth of the bus clock; 0 stops it.
+void lapic_timer_set(unsigned int mode, unsigned int count) {
+    lapic_write(LAPIC_LVT_TIMER, mode | LAPIC_TIMER_VECTOR);
+    lapic_write(LAPIC_TIMER_INIT, count);
+}
+
+unsigned int lapic_timer_current() {
+    return lapic_read(LAPIC_TIMER_CURRENT);
+}
+
+// Interrupts stay off throughout: an IPI sent from an interrupt between
+// the two ICR writes would retarget this one
+static void lapic_send(unsigned int apic_id, unsigned int command) {
+    unsigned int flags = irq_save();
+    // The previous IPI must have been accepted before ICR is reused
+    while (lapic_read(LAPIC_ICR_LO) & ICR_PENDING) {
+        cpu_relax();
+    }
+    lapic_write(LAPIC_ICR_HI, apic_id << 24);
+    lapic_write(LAPIC_ICR_LO, command);
+    irq_restore(flags);
+}
+
+// Send a fixed interrupt to one CPU
+void lapic_send_ipi(unsigned int apic_id, unsigned int vector) {
+    lapic_send(apic_id, ICR_FIXED | ICR_ASSERT | vector);
+}
+
+// INIT IPI: puts an AP into wait-for-SIPI state
+void lapic_send_init(unsigned int apic_id) {
+    lapic_send(apic_id, ICR_INIT | ICR_ASSERT | ICR_LEVEL);
+}
+
+// Startup IPI: the AP starts in real mode at addr, which must be a
+// page-aligned address below 1MB
+void lapic_send_startup(unsigned int apic_id, unsigned int addr) {
+    lapic_send(apic_id, ICR_STARTUP | ICR_ASSERT | ((addr >> 12) & 0xFF));
+}
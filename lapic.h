@@ -0,0 +1,51 @@
+// lapic.h
+
+#ifndef LAPIC_H
+#define LAPIC_H
+
+// Default physical address of the local APIC registers
+#define LAPIC_DEFAULT_BASE  0xFEE00000
+
+// Register offsets
+#define LAPIC_ID        0x020
+#define LAPIC_VERSION   0x030
+#define LAPIC_TPR       0x080   // Task priority
+#define LAPIC_EOI       0x0B0
+#define LAPIC_SVR       0x0F0   // Spurious interrupt vector
+#define LAPIC_ESR       0x280   // Error status
+#define LAPIC_ICR_LO    0x300   // Interrupt command
+#define LAPIC_ICR_HI    0x310
+#define LAPIC_LVT_TIMER 0x320
+#define LAPIC_TIMER_INIT    0x380   // Initial count
+#define LAPIC_TIMER_CURRENT 0x390   // Current count
+#define LAPIC_TIMER_DIVIDE  0x3E0
+
+// SVR bits
+#define LAPIC_SVR_ENABLE    0x100
+
+// LVT timer bits
+#define LAPIC_TIMER_ONESHOT     0x00000
+#define LAPIC_TIMER_PERIODIC    0x20000
+#define LAPIC_TIMER_MASKED      0x10000
+
+// ICR bits
+#define ICR_FIXED           0x00000
+#define ICR_INIT            0x00500
+#define ICR_STARTUP         0x00600
+#define ICR_PENDING         0x01000 // Delivery status
+#define ICR_ASSERT          0x04000
+#define ICR_LEVEL           0x08000
+
+// Functions
+int lapic_init();
+void lapic_init_ap();
+unsigned int lapic_id();
+void lapic_eoi();
+void lapic_send_ipi(unsigned int apic_id, unsigned int vector);
+void lapic_send_init(unsigned int apic_id);
+void lapic_send_startup(unsigned int apic_id, unsigned int addr);
+int lapic_present();
+void lapic_timer_set(unsigned int mode, unsigned int count);
+unsigned int lapic_timer_current();
+
+#endif
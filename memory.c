@@ -1,6 +1,9 @@
 // memory.c
 
 #include "memory.h"
+#include "paging.h"
+#include "spinlock.h"
+#include "klib.h"
 
 // External function from kernel
 extern void print(const char* str);
@@ -10,64 +13,550 @@ extern void print_dec(unsigned int n);
 // Track if memory is initialized
 static int memory_initialized = 0;
 
-// Define a fixed memory region (start at 2MB, size 1MB)
-#define MEMORY_START 0x200000
-#define MEMORY_SIZE  0x100000  // 1MB
-#define MEMORY_END   (MEMORY_START + MEMORY_SIZE)
+// Protects the frame allocator, slab caches and run cache
+static struct spinlock memory_lock = SPINLOCK_INIT;
 
-// Very simple allocator - just track next free address
-static unsigned int next_free_addr = MEMORY_START;
+// Fallback region if the BIOS gave us no memory map (start at 2MB, size 1MB)
+#define FALLBACK_START 0x200000
+#define FALLBACK_SIZE  0x100000
 
-// Track the file system allocation separately
-static unsigned int fs_allocation_start = 0;
-static unsigned int fs_allocation_size = 0;
+// Nothing below 1MB is handed out: it holds the IVT, BIOS data,
+// boot info, the kernel stack and VGA memory
+#define LOW_MEMORY_END 0x100000
+
+// Only memory the kernel identity-maps is managed (see paging.h)
+#define PHYS_LIMIT KERNEL_SPACE_END
+
+// Every heap page starts with a one cache line header
+#define CACHE_LINE_SIZE  64
+#define SLAB_HEADER_SIZE CACHE_LINE_SIZE
+
+// Power-of-two size classes: 16, 32, ... 1024 bytes
+#define SLAB_MIN_SHIFT   4
+#define SLAB_MAX_SHIFT   10
+#define SLAB_CLASSES     (SLAB_MAX_SHIFT - SLAB_MIN_SHIFT + 1)
+#define SLAB_MAX_SIZE    (1 << SLAB_MAX_SHIFT)
+
+#define SLAB_MAGIC  0x51AB51AB
+#define LARGE_MAGIC 0x1A26E000
+
+// Page header for both slab pages and large allocations.
+// For large allocations only magic and pages are used.
+struct slab {
+    unsigned int magic;
+    unsigned int pages;         // Pages spanned (1 for slabs)
+    unsigned int size_class;    // Index into slab_caches
+    unsigned int inuse;         // Objects handed out
+    void* freelist;             // Free objects in this slab
+    struct slab* next;          // Partial list links
+    struct slab* prev;
+};
+
+// One cache per size class, holding slabs that still have free objects
+struct slab_cache {
+    unsigned int object_size;
+    unsigned int objects_per_slab;
+    struct slab* partial;
+};
+
+static struct slab_cache slab_caches[SLAB_CLASSES];
+
+// Freed large allocations are kept whole so contiguous runs can be
+// reused even though the frame stack only holds single pages. Runs of
+// up to RUN_CACHE_PAGES pages sit on one list per length; longer ones
+// share a list that is searched first fit and split. Cached frames
+// count as free, and are split up once untouched memory runs out.
+#define RUN_CACHE_PAGES 8
+
+struct free_run {
+    struct free_run* next;
+    unsigned int pages;
+};
+
+static void* free_runs[RUN_CACHE_PAGES + 1];
+static struct free_run* long_runs = 0;
+
+// Usable RAM ranges, page aligned
+#define MAX_REGIONS 32
+
+struct mem_region {
+    unsigned int start;
+    unsigned int end;
+};
+
+static struct mem_region regions[MAX_REGIONS];
+static int region_count = 0;
+
+// Extra mappings of each frame, for user pages shared copy-on-write.
+// Indexed by frame number; 0 for frames with a single owner.
+static unsigned short* frame_shares = 0;
+static unsigned int frame_share_count = 0;
+
+// Frame allocator: released frames form an intrusive stack, fresh frames
+// are bumped from the untouched part of the current region
+static int current_region = 0;
+static unsigned int frontier = 0;
+static void* free_frames = 0;
+static unsigned int total_frames = 0;
+static unsigned int used_frames = 0;
+
+// End of the kernel image (from linker script)
+extern char kernel_end[];
+
+// Add a usable range, trimmed to whole pages above low memory and the kernel
+static void add_region(unsigned long long base, unsigned long long length) {
+    unsigned long long end = base + length;
+    unsigned int floor = (unsigned int)kernel_end;
+
+    if (floor < LOW_MEMORY_END) {
+        floor = LOW_MEMORY_END;
+    }
+    if (end > PHYS_LIMIT) {
+        end = PHYS_LIMIT;
+    }
+    if (base < floor) {
+        base = floor;
+    }
+    if (region_count >= MAX_REGIONS || base >= end) {
+        return;
+    }
+
+    unsigned int start = ((unsigned int)base + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    unsigned int stop = (unsigned int)end & ~(PAGE_SIZE - 1);
+    if (start >= stop) {
+        return;
+    }
+
+    regions[region_count].start = start;
+    regions[region_count].end = stop;
+    region_count++;
+    total_frames += (stop - start) / PAGE_SIZE;
+}
+
+// Highest managed physical address
+unsigned int memory_top() {
+    unsigned int top = 0;
+    for (int i = 0; i < region_count; i++) {
+        if (regions[i].end > top) {
+            top = regions[i].end;
+        }
+    }
+    return top;
+}
+
+static void* contig_alloc(unsigned int count);
+
+// Cache a run whose frames are already counted as free
+static void run_put(void* run, unsigned int count) {
+    if (count <= RUN_CACHE_PAGES) {
+        *(void**)run = free_runs[count];
+        free_runs[count] = run;
+        return;
+    }
+
+    struct free_run* entry = (struct free_run*)run;
+    entry->pages = count;
+    entry->next = long_runs;
+    long_runs = entry;
+}
+
+// Take count pages from the run cache, or 0. A longer run gives up its
+// tail and the rest goes back to the list for its new length.
+static void* run_take(unsigned int count) {
+    if (count <= RUN_CACHE_PAGES && free_runs[count]) {
+        void* run = free_runs[count];
+        free_runs[count] = *(void**)run;
+        used_frames += count;
+        return run;
+    }
+
+    struct free_run** link = &long_runs;
+    while (*link && (*link)->pages < count) {
+        link = &(*link)->next;
+    }
+    struct free_run* entry = *link;
+    if (!entry) {
+        return 0;
+    }
+
+    unsigned int rest = entry->pages - count;
+    if (rest <= RUN_CACHE_PAGES) {
+        *link = entry->next;
+        if (rest > 0) {
+            run_put(entry, rest);
+        }
+    } else {
+        entry->pages = rest;
+    }
+    used_frames += count;
+    return (void*)((unsigned int)entry + rest * PAGE_SIZE);
+}
+
+// Last resort: the tail of a cached run longer than count, or 0
+static void* run_split(unsigned int count) {
+    for (unsigned int pages = count + 1; pages <= RUN_CACHE_PAGES; pages++) {
+        if (free_runs[pages]) {
+            void* run = free_runs[pages];
+            free_runs[pages] = *(void**)run;
+            run_put(run, pages - count);
+            used_frames += count;
+            return (void*)((unsigned int)run + (pages - count) * PAGE_SIZE);
+        }
+    }
+    return 0;
+}
+
+// Put the frames of a cached run on the free stack
+static void run_release(void* run, unsigned int count) {
+    for (unsigned int i = 0; i < count; i++) {
+        void* frame = (void*)((unsigned int)run + i * PAGE_SIZE);
+        *(void**)frame = free_frames;
+        free_frames = frame;
+    }
+}
+
+// Frame allocator internals, called with memory_lock held
+static void* single_alloc() {
+    if (free_frames) {
+        void* frame = free_frames;
+        free_frames = *(void**)frame;
+        used_frames++;
+        return frame;
+    }
+    return contig_alloc(1);
+}
+
+static void* contig_alloc(unsigned int count) {
+    void* cached = run_take(count);
+    if (cached) {
+        return cached;
+    }
+
+    while (current_region < region_count) {
+        struct mem_region* region = &regions[current_region];
+        if (count <= (region->end - frontier) / PAGE_SIZE) {
+            void* run = (void*)frontier;
+            frontier += count * PAGE_SIZE;
+            used_frames += count;
+            return run;
+        }
+
+        // Hand the tail of this region to the free stack and move on
+        while (frontier < region->end) {
+            *(void**)frontier = free_frames;
+            free_frames = (void*)frontier;
+            frontier += PAGE_SIZE;
+        }
+        current_region++;
+        if (current_region < region_count) {
+            frontier = regions[current_region].start;
+        }
+    }
+    return run_split(count);  // 0 when out of memory
+}
+
+static void single_free(void* frame) {
+    *(void**)frame = free_frames;
+    free_frames = frame;
+    used_frames--;
+}
+
+// Allocate one 4KB physical frame
+void* frame_alloc() {
+    unsigned int flags = spin_lock_irqsave(&memory_lock);
+    void* frame = single_alloc();
+    spin_unlock_irqrestore(&memory_lock, flags);
+    return frame;
+}
+
+// Allocate physically contiguous frames from freed runs or untouched memory
+void* frame_alloc_contig(unsigned int count) {
+    unsigned int flags = spin_lock_irqsave(&memory_lock);
+    void* run = contig_alloc(count);
+    spin_unlock_irqrestore(&memory_lock, flags);
+    return run;
+}
+
+// Return a frame to the free stack
+void frame_free(void* frame) {
+    unsigned int flags = spin_lock_irqsave(&memory_lock);
+    single_free(frame);
+    spin_unlock_irqrestore(&memory_lock, flags);
+}
+
+// One more page table maps a frame (copy-on-write sharing). Returns 0
+// on success, -1 if it cannot be shared.
+int frame_get(void* frame) {
+    unsigned int index = (unsigned int)frame / PAGE_SIZE;
+    if (index >= frame_share_count) {
+        return -1;
+    }
+
+    unsigned int flags = spin_lock_irqsave(&memory_lock);
+    int ok = frame_shares[index] < 0xFFFF;
+    if (ok) {
+        frame_shares[index]++;
+    }
+    spin_unlock_irqrestore(&memory_lock, flags);
+    return ok ? 0 : -1;
+}
+
+// A page table stops mapping a frame: free it with its last mapping
+void frame_put(void* frame) {
+    unsigned int index = (unsigned int)frame / PAGE_SIZE;
+    unsigned int flags = spin_lock_irqsave(&memory_lock);
+    if (index < frame_share_count && frame_shares[index] > 0) {
+        frame_shares[index]--;
+    } else {
+        single_free(frame);
+    }
+    spin_unlock_irqrestore(&memory_lock, flags);
+}
+
+// Whether other page tables map a frame too
+int frame_shared(void* frame) {
+    unsigned int index = (unsigned int)frame / PAGE_SIZE;
+    return index < frame_share_count && frame_shares[index] > 0;
+}
+
+// Frames in use, for measurements
+unsigned int frame_used_count() {
+    return used_frames;
+}
+
+// Heap pages are physical frames
+static void* page_alloc(unsigned int count) {
+    if (count == 1) {
+        return single_alloc();
+    }
+    return contig_alloc(count);
+}
+
+static void page_free(void* addr, unsigned int count) {
+    for (unsigned int i = 0; i < count; i++) {
+        single_free((void*)((unsigned int)addr + i * PAGE_SIZE));
+    }
+}
+
+// Map a request size to its size class
+static unsigned int size_to_class(unsigned int size) {
+    if (size <= (1 << SLAB_MIN_SHIFT)) {
+        return 0;
+    }
+    // Index of the highest set bit of (size - 1), plus one, rounds up
+    unsigned int shift = 32 - __builtin_clz(size - 1);
+    return shift - SLAB_MIN_SHIFT;
+}
+
+static void partial_add(struct slab_cache* cache, struct slab* slab) {
+    slab->prev = 0;
+    slab->next = cache->partial;
+    if (cache->partial) {
+        cache->partial->prev = slab;
+    }
+    cache->partial = slab;
+}
+
+static void partial_remove(struct slab_cache* cache, struct slab* slab) {
+    if (slab->prev) {
+        slab->prev->next = slab->next;
+    } else {
+        cache->partial = slab->next;
+    }
+    if (slab->next) {
+        slab->next->prev = slab->prev;
+    }
+    slab->next = 0;
+    slab->prev = 0;
+}
+
+// Carve a fresh page into objects of one size class
+static struct slab* slab_create(unsigned int size_class) {
+    struct slab_cache* cache = &slab_caches[size_class];
+    struct slab* slab = (struct slab*)page_alloc(1);
+    if (!slab) {
+        return 0;
+    }
+
+    slab->magic = SLAB_MAGIC;
+    slab->pages = 1;
+    slab->size_class = size_class;
+    slab->inuse = 0;
+    slab->freelist = 0;
+
+    // Thread the free list back to front so objects are handed out in order
+    unsigned int base = (unsigned int)slab + SLAB_HEADER_SIZE;
+    for (int i = cache->objects_per_slab - 1; i >= 0; i--) {
+        void* obj = (void*)(base + i * cache->object_size);
+        *(void**)obj = slab->freelist;
+        slab->freelist = obj;
+    }
+
+    partial_add(cache, slab);
+    return slab;
+}
+
+// Initialize the frame allocator from the BIOS memory map, then the slab caches
+void memory_init(const struct e820_entry* map, unsigned int count) {
+    region_count = 0;
+    total_frames = 0;
+    used_frames = 0;
+    free_frames = 0;
+
+    for (unsigned int i = 0; i < count; i++) {
+        if (map[i].type == E820_USABLE) {
+            add_region(map[i].base, map[i].length);
+        }
+    }
+
+    if (region_count == 0) {
+        print("No E820 memory map, using 1MB at 0x200000\n");
+        add_region(FALLBACK_START, FALLBACK_SIZE);
+    }
+
+    current_region = 0;
+    frontier = regions[0].start;
+
+    for (int i = 0; i <= RUN_CACHE_PAGES; i++) {
+        free_runs[i] = 0;
+    }
+    long_runs = 0;
+
+    for (int i = 0; i < SLAB_CLASSES; i++) {
+        slab_caches[i].object_size = 1 << (SLAB_MIN_SHIFT + i);
+        slab_caches[i].objects_per_slab = (PAGE_SIZE - SLAB_HEADER_SIZE) / slab_caches[i].object_size;
+        slab_caches[i].partial = 0;
+    }
+
+    // One counter per frame up to the top of RAM
+    frame_share_count = memory_top() / PAGE_SIZE;
+    unsigned int bytes = frame_share_count * sizeof(unsigned short);
+    frame_shares = (unsigned short*)contig_alloc((bytes + PAGE_SIZE - 1) / PAGE_SIZE);
+    if (frame_shares) {
+        memset(frame_shares, 0, bytes);
+    } else {
+        frame_share_count = 0;
+    }
 
-// Initialize memory - does almost nothing
-void memory_init() {
     memory_initialized = 1;
-    next_free_addr = MEMORY_START;
-    fs_allocation_start = 0;
-    fs_allocation_size = 0;
 }
 
-// Very simple malloc - just bump the pointer
+static void* heap_alloc(unsigned int size);
+static void heap_free(void* ptr);
+
+// Allocate memory. Small requests come from the slab caches, larger
+// ones get whole pages. Objects of 64 bytes and up are cache-line aligned.
 void* malloc(unsigned int size) {
     // Check if initialized
-    if (!memory_initialized) {
+    if (!memory_initialized || size == 0) {
         return 0;
     }
-    
-    // Check for space
-    if (next_free_addr + size > MEMORY_END) {
-        return 0;  // Out of memory
+
+    unsigned int flags = spin_lock_irqsave(&memory_lock);
+    void* ptr = heap_alloc(size);
+    spin_unlock_irqrestore(&memory_lock, flags);
+    return ptr;
+}
+
+// malloc() with memory_lock held
+static void* heap_alloc(unsigned int size) {
+    if (size > SLAB_MAX_SIZE) {
+        unsigned int count = (size + SLAB_HEADER_SIZE + PAGE_SIZE - 1) / PAGE_SIZE;
+        struct slab* header = (struct slab*)page_alloc(count);
+        if (!header) {
+            return 0;
+        }
+        header->magic = LARGE_MAGIC;
+        header->pages = count;
+        return (void*)((unsigned int)header + SLAB_HEADER_SIZE);
     }
-    
-    // Get current address
-    void* result = (void*)next_free_addr;
-    
-    // Move pointer forward
-    next_free_addr += size;
-    
-    // Align to 4 bytes
-    next_free_addr = (next_free_addr + 3) & ~3;
-    
-    return result;
+
+    unsigned int size_class = size_to_class(size);
+    struct slab_cache* cache = &slab_caches[size_class];
+    struct slab* slab = cache->partial;
+    if (!slab) {
+        slab = slab_create(size_class);
+        if (!slab) {
+            return 0;  // Out of memory
+        }
+    }
+
+    void* obj = slab->freelist;
+    slab->freelist = *(void**)obj;
+    slab->inuse++;
+
+    // Full slabs leave the partial list until something is freed
+    if (!slab->freelist) {
+        partial_remove(cache, slab);
+    }
+
+    return obj;
 }
 
-// Special function for file system to register its allocation
-void memory_register_fs(void* addr, unsigned int size) {
-    fs_allocation_start = (unsigned int)addr;
-    fs_allocation_size = size;
+// Free memory returned by malloc
+void kfree(void* ptr) {
+    if (!ptr) {
+        return;
+    }
+
+    unsigned int flags = spin_lock_irqsave(&memory_lock);
+    heap_free(ptr);
+    spin_unlock_irqrestore(&memory_lock, flags);
+}
+
+// kfree() with memory_lock held
+static void heap_free(void* ptr) {
+    // The owning page header sits at the start of the page
+    struct slab* slab = (struct slab*)((unsigned int)ptr & ~(PAGE_SIZE - 1));
+
+    if (slab->magic == LARGE_MAGIC) {
+        unsigned int count = slab->pages;
+        slab->magic = 0;
+        used_frames -= count;
+        run_put(slab, count);
+        return;
+    }
+
+    if (slab->magic != SLAB_MAGIC) {
+        print("kfree: bad pointer\n");
+        return;
+    }
+
+    struct slab_cache* cache = &slab_caches[slab->size_class];
+
+    // A full slab becomes partial again
+    if (!slab->freelist) {
+        partial_add(cache, slab);
+    }
+
+    *(void**)ptr = slab->freelist;
+    slab->freelist = ptr;
+    slab->inuse--;
+
+    // Keep one empty slab per class cached, release the rest
+    if (slab->inuse == 0 && (slab->next || slab->prev)) {
+        partial_remove(cache, slab);
+        slab->magic = 0;
+        page_free(slab, 1);
+    }
 }
 
 // Print memory statistics
+void memory_total() {
+    if (!memory_initialized) {
+        return;
+    }
+
+    print_dec(total_frames * (PAGE_SIZE / 1024));
+}
+
 void memory_free() {
     if (!memory_initialized) {
         return;
     }
-    
-    unsigned int free = (MEMORY_END - next_free_addr) / 1024;
-    
+
+    unsigned int free = (total_frames - used_frames) * (PAGE_SIZE / 1024);
+
     print_dec(free);
 }
 
@@ -76,24 +565,45 @@ void memory_used() {
         return;
     }
 
-    unsigned int used = next_free_addr - MEMORY_START;
+    unsigned int used = used_frames * PAGE_SIZE;
 
     print_dec(used);
 }
 
-// Free all allocated memory EXCEPT file system (reset allocator)
+// Release the empty slabs still cached by each size class, and the
+// cached large runs
 void free_all() {
     if (!memory_initialized) {
         return;
     }
-    
-    // If file system is allocated, reset to just after it
-    if (fs_allocation_size > 0) {
-        next_free_addr = fs_allocation_start + fs_allocation_size;
-        // Align to 4 bytes
-        next_free_addr = (next_free_addr + 3) & ~3;
-    } else {
-        // No file system, reset to start
-        next_free_addr = MEMORY_START;
+
+    unsigned int flags = spin_lock_irqsave(&memory_lock);
+
+    for (int count = 1; count <= RUN_CACHE_PAGES; count++) {
+        while (free_runs[count]) {
+            void* run = free_runs[count];
+            free_runs[count] = *(void**)run;
+            run_release(run, count);
+        }
+    }
+    while (long_runs) {
+        struct free_run* entry = long_runs;
+        long_runs = entry->next;
+        run_release(entry, entry->pages);
     }
+
+    for (int i = 0; i < SLAB_CLASSES; i++) {
+        struct slab* slab = slab_caches[i].partial;
+        while (slab) {
+            struct slab* next = slab->next;
+            if (slab->inuse == 0) {
+                partial_remove(&slab_caches[i], slab);
+                slab->magic = 0;
+                page_free(slab, 1);
+            }
+            slab = next;
+        }
+    }
+
+    spin_unlock_irqrestore(&memory_lock, flags);
 }
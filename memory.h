@@ -3,13 +3,28 @@
 #ifndef MEMORY_H
 #define MEMORY_H
 
+#include "boot.h"
+
+#define PAGE_SIZE 4096
+
 // Functions
-void memory_init();
+void memory_init(const struct e820_entry* map, unsigned int count);
 void* malloc(unsigned int size);
+void kfree(void* ptr);
 void memory_stats();
 void free_all();
+void memory_total();
 void memory_free();
 void memory_used();
-void memory_register_fs(void* addr, unsigned int size);
+
+// Physical frame allocator
+void* frame_alloc();
+void* frame_alloc_contig(unsigned int count);
+void frame_free(void* frame);
+int frame_get(void* frame);
+void frame_put(void* frame);
+int frame_shared(void* frame);
+unsigned int frame_used_count();
+unsigned int memory_top();
 
 #endif
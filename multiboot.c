@@ -0,0 +1,263 @@
+// multiboot.c
+
+#include "multiboot.h"
+#include "fs.h"
+#include "pkg.h"
+#include "paging.h"
+#include "klib.h"
+
+// External functions from kernel
+extern void print(const char* str);
+
+// Multiboot 1 information, up to the memory map
+struct mb1_info {
+    unsigned int flags;         // MB1_INFO_*: which fields are valid
+    unsigned int mem_lower;     // KB below 1MB
+    unsigned int mem_upper;     // KB from 1MB to the first hole
+    unsigned int boot_device;
+    unsigned int cmdline;
+    unsigned int mods_count;
+    unsigned int mods_addr;
+    unsigned int syms[4];
+    unsigned int mmap_length;
+    unsigned int mmap_addr;
+} __attribute__((packed));
+
+#define MB1_INFO_MEMORY     0x01
+#define MB1_INFO_CMDLINE    0x04
+#define MB1_INFO_MODS       0x08
+#define MB1_INFO_MMAP       0x40
+
+struct mb1_module {
+    unsigned int start;
+    unsigned int end;           // First byte past the module
+    unsigned int string;
+    unsigned int reserved;
+} __attribute__((packed));
+
+// Memory map entry; size does not count the size field itself. Types
+// are the E820 ones.
+struct mb1_mmap {
+    unsigned int size;
+    unsigned long long base;
+    unsigned long long length;
+    unsigned int type;
+} __attribute__((packed));
+
+// Multiboot 2 information: total size and a reserved word, then tags,
+// each starting 8-byte aligned, up to an end tag
+struct mb2_tag {
+    unsigned int type;
+    unsigned int size;          // Including this header
+} __attribute__((packed));
+
+#define MB2_TAG_END         0
+#define MB2_TAG_CMDLINE     1
+#define MB2_TAG_MODULE      3
+#define MB2_TAG_MEMINFO     4
+#define MB2_TAG_MMAP        6
+
+struct mb2_module {
+    struct mb2_tag tag;
+    unsigned int start;
+    unsigned int end;
+    char string[];
+} __attribute__((packed));
+
+struct mb2_meminfo {
+    struct mb2_tag tag;
+    unsigned int mem_lower;
+    unsigned int mem_upper;
+} __attribute__((packed));
+
+// Entries have the layout of struct e820_entry, entry_size apart
+struct mb2_mmap {
+    struct mb2_tag tag;
+    unsigned int entry_size;
+    unsigned int entry_version;
+} __attribute__((packed));
+
+// The loader may have put its structures in memory the allocator will
+// hand out, so everything needed later is copied here first
+struct module {
+    unsigned int start;
+    unsigned int end;
+    char name[MAX_FILENAME_LENGTH];
+};
+
+static struct boot_info info;
+static char cmdline[MULTIBOOT_CMDLINE];
+static struct module modules[MULTIBOOT_MODULES];
+static unsigned int module_count;
+static unsigned int mem_lower, mem_upper;   // KB, if no memory map
+
+static void add_memory(unsigned long long base, unsigned long long length, unsigned int type) {
+    if (info.mmap_count < E820_MAX && length > 0) {
+        info.mmap[info.mmap_count].base = base;
+        info.mmap[info.mmap_count].length = length;
+        info.mmap[info.mmap_count].type = type;
+        info.mmap[info.mmap_count].acpi = 0;
+        info.mmap_count++;
+    }
+}
+
+// Take [start, end) out of the usable memory, splitting entries around it.
+// The part above is lost if the map is full.
+static void reserve(unsigned long long start, unsigned long long end) {
+    for (unsigned int i = 0; i < info.mmap_count; i++) {
+        struct e820_entry* entry = &info.mmap[i];
+        unsigned long long entry_end = entry->base + entry->length;
+        if (entry->type != E820_USABLE || start >= entry_end || end <= entry->base) {
+            continue;
+        }
+
+        if (end < entry_end) {
+            add_memory(end, entry_end - end, E820_USABLE);
+        }
+        if (start > entry->base) {
+            entry->length = start - entry->base;
+        } else {
+            entry->type = E820_RESERVED;
+        }
+    }
+}
+
+// Modules are named after the last path component of their string, the
+// file name QEMU and GRUB were given; arguments after it are ignored
+static void add_module(unsigned int start, unsigned int end, const char* string) {
+    if (module_count >= MULTIBOOT_MODULES || end < start) {
+        return;
+    }
+
+    struct module* module = &modules[module_count++];
+    module->start = start;
+    module->end = end;
+    module->name[0] = '\0';
+    if (!string) {
+        return;
+    }
+
+    const char* name = string;
+    for (const char* p = string; *p && *p != ' '; p++) {
+        if (*p == '/') {
+            name = p + 1;
+        }
+    }
+    unsigned int length = 0;
+    while (name[length] && name[length] != ' ' && length < MAX_FILENAME_LENGTH - 1) {
+        module->name[length] = name[length];
+        length++;
+    }
+    module->name[length] = '\0';
+}
+
+static void parse_mb1(const struct mb1_info* mb) {
+    if ((mb->flags & MB1_INFO_CMDLINE) && mb->cmdline) {
+        strlcpy(cmdline, (const char*)mb->cmdline, MULTIBOOT_CMDLINE);
+    }
+    if (mb->flags & MB1_INFO_MEMORY) {
+        mem_lower = mb->mem_lower;
+        mem_upper = mb->mem_upper;
+    }
+    if (mb->flags & MB1_INFO_MMAP) {
+        unsigned int addr = mb->mmap_addr;
+        unsigned int end = mb->mmap_addr + mb->mmap_length;
+        while (addr + sizeof(struct mb1_mmap) <= end) {
+            const struct mb1_mmap* entry = (const struct mb1_mmap*)addr;
+            add_memory(entry->base, entry->length, entry->type);
+            addr += entry->size + sizeof(entry->size);
+        }
+    }
+    if (mb->flags & MB1_INFO_MODS) {
+        const struct mb1_module* mods = (const struct mb1_module*)mb->mods_addr;
+        for (unsigned int i = 0; i < mb->mods_count; i++) {
+            add_module(mods[i].start, mods[i].end, (const char*)mods[i].string);
+        }
+    }
+}
+
+static void parse_mb2(const unsigned char* mb) {
+    unsigned int total = *(const unsigned int*)mb;
+    unsigned int offset = 8;
+
+    while (offset + sizeof(struct mb2_tag) <= total) {
+        const struct mb2_tag* tag = (const struct mb2_tag*)(mb + offset);
+        if (tag->type == MB2_TAG_END || tag->size < sizeof(struct mb2_tag)) {
+            break;
+        }
+
+        if (tag->type == MB2_TAG_CMDLINE) {
+            strlcpy(cmdline, (const char*)(tag + 1), MULTIBOOT_CMDLINE);
+        } else if (tag->type == MB2_TAG_MODULE) {
+            const struct mb2_module* mod = (const struct mb2_module*)tag;
+            add_module(mod->start, mod->end, mod->string);
+        } else if (tag->type == MB2_TAG_MEMINFO) {
+            const struct mb2_meminfo* meminfo = (const struct mb2_meminfo*)tag;
+            mem_lower = meminfo->mem_lower;
+            mem_upper = meminfo->mem_upper;
+        } else if (tag->type == MB2_TAG_MMAP) {
+            const struct mb2_mmap* mmap = (const struct mb2_mmap*)tag;
+            unsigned int at = sizeof(struct mb2_mmap);
+            while (mmap->entry_size >= 20 && at + mmap->entry_size <= tag->size) {
+                const struct e820_entry* entry = (const struct e820_entry*)((const unsigned char*)tag + at);
+                add_memory(entry->base, entry->length, entry->type);
+                at += mmap->entry_size;
+            }
+        }
+        offset += (tag->size + 7) & ~7;
+    }
+}
+
+// Translate what a Multiboot loader passed into a boot_info, with the
+// boot modules taken out of usable memory. Returns info itself when
+// stage2.asm booted us. Call before anything allocates memory.
+struct boot_info* multiboot_parse(unsigned int magic, void* boot_info) {
+    if (magic == MULTIBOOT_MAGIC) {
+        parse_mb1((const struct mb1_info*)boot_info);
+    } else if (magic == MULTIBOOT2_MAGIC) {
+        parse_mb2((const unsigned char*)boot_info);
+    } else {
+        return (struct boot_info*)boot_info;
+    }
+
+    if (info.mmap_count == 0) {
+        add_memory(0, mem_lower * 1024ULL, E820_USABLE);
+        add_memory(0x100000, mem_upper * 1024ULL, E820_USABLE);
+    }
+    for (unsigned int i = 0; i < module_count; i++) {
+        reserve(modules[i].start, modules[i].end);
+    }
+    info.load_method = BOOT_LOAD_MULTIBOOT;
+    return &info;
+}
+
+// Kernel command line from the loader, empty if none
+const char* multiboot_cmdline() {
+    return cmdline;
+}
+
+// Add the boot modules to the file system: program packages (pkg.h) file
+// by file, anything else as one read-only file. Their contents stay in
+// place, which multiboot_parse() kept out of the allocator's hands.
+void multiboot_load_modules() {
+    for (unsigned int i = 0; i < module_count; i++) {
+        struct module* module = &modules[i];
+        const struct pkg_header* header = (const struct pkg_header*)module->start;
+        unsigned int size = module->end - module->start;
+        if (module->end > KERNEL_SPACE_END) {
+            continue;  // Not identity-mapped once paging is on
+        }
+
+        if (size >= sizeof(struct pkg_header) && header->magic == PKG_MAGIC) {
+            fs_load_package(header, size);
+        } else if (fs_add_image(module->name, header, size) == 0) {
+            print("Boot module: ");
+            print(module->name);
+            print("\n");
+        } else {
+            print("Boot module not added: ");
+            print(module->name);
+            print("\n");
+        }
+    }
+}
@@ -0,0 +1,22 @@
+// multiboot.h
+
+#ifndef MULTIBOOT_H
+#define MULTIBOOT_H
+
+#include "boot.h"
+
+// A Multiboot loader (QEMU -kernel, GRUB) enters _start with one of these
+// in EAX and its information structure in EBX, instead of stage2.asm's
+// boot_info. The headers it looks for are in kernel_entry.asm.
+#define MULTIBOOT_MAGIC     0x2BADB002
+#define MULTIBOOT2_MAGIC    0x36D76289
+
+#define MULTIBOOT_CMDLINE   128     // Longest kernel command line kept
+#define MULTIBOOT_MODULES   16
+
+// Functions
+struct boot_info* multiboot_parse(unsigned int magic, void* info);
+const char* multiboot_cmdline();
+void multiboot_load_modules();
+
+#endif
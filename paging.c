@@ -0,0 +1,361 @@
+// paging.c
+
+#include "paging.h"
+#include "memory.h"
+#include "process.h"
+#include "cpu.h"
+#include "klib.h"
+
+// External functions from kernel
+extern void print(const char* str);
+extern void print_dec(unsigned int n);
+
+// Kernel page directory: identity maps physical memory with 4MB pages
+static unsigned int* kernel_directory = 0;
+
+// Clear a freshly allocated frame
+static void zero_frame(void* frame) {
+    memset(frame, 0, PAGE_SIZE);
+}
+
+// Build the kernel page directory and turn paging on
+void paging_init() {
+    unsigned int eax, ebx, ecx, edx;
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+
+    if (!(edx & CPUID_PSE)) {
+        print("Paging: CPU lacks 4MB pages, paging disabled\n");
+        return;
+    }
+
+    kernel_directory = (unsigned int*)frame_alloc();
+    if (!kernel_directory) {
+        print("Paging: no memory for page directory\n");
+        return;
+    }
+    zero_frame(kernel_directory);
+
+    // Kernel mappings are global so CR3 switches keep them in the TLB
+    unsigned int flags = PAGE_PRESENT | PAGE_WRITE | PAGE_4MB;
+    if (edx & CPUID_PGE) {
+        flags |= PAGE_GLOBAL;
+    }
+
+    // Identity map everything up to the top of managed RAM
+    unsigned int top = memory_top();
+    unsigned int pdes = (top + LARGE_PAGE_SIZE - 1) / LARGE_PAGE_SIZE;
+    if (pdes == 0) {
+        pdes = 1;  // Always cover the kernel and VGA memory
+    }
+    for (unsigned int i = 0; i < pdes && i < KERNEL_PDE_COUNT; i++) {
+        kernel_directory[i] = (i * LARGE_PAGE_SIZE) | flags;
+    }
+
+    unsigned int cr4 = read_cr4() | CR4_PSE;
+    if (edx & CPUID_PGE) {
+        cr4 |= CR4_PGE;
+    }
+    write_cr4(cr4);
+    write_cr3((unsigned int)kernel_directory);
+
+    // With WP the kernel's own writes to shared user pages fault too,
+    // so system calls copy-on-write like ring 3 does
+    write_cr0(read_cr0() | CR0_PG | CR0_WP);
+
+    print("Paging enabled: ");
+    print_dec(pdes * 4);
+    print(" MB identity mapped with 4MB pages\n");
+}
+
+// Identity-map the 4MB region holding a device's registers, uncached,
+// in the kernel directory. Directories created afterwards share it.
+// Returns 0 on success.
+int paging_map_mmio(unsigned int paddr) {
+    if (!kernel_directory) {
+        return -1;
+    }
+    
+    unsigned int pde = paddr / LARGE_PAGE_SIZE;
+    if (pde < KERNEL_PDE_COUNT) {
+        return 0;  // Already covered by the kernel identity map
+    }
+    if (paddr >= KERNEL_SPACE_END && paddr < USER_HEAP_END) {
+        return -1;  // Would collide with user code, stacks or heaps
+    }
+    if (pde == VSYSCALL_PDE) {
+        return -1;
+    }
+    
+    kernel_directory[pde] = (pde * LARGE_PAGE_SIZE) | PAGE_PRESENT | PAGE_WRITE |
+                            PAGE_4MB | PAGE_PCD | PAGE_PWT;
+    invlpg(pde * LARGE_PAGE_SIZE);
+    return 0;
+}
+
+// The kernel page directory, used by CPUs before they run a process
+unsigned int paging_kernel_directory() {
+    return (unsigned int)kernel_directory;
+}
+
+// Create a page directory sharing the kernel mappings
+unsigned int paging_create_directory() {
+    if (!kernel_directory) {
+        return 0;
+    }
+
+    unsigned int* directory = (unsigned int*)frame_alloc();
+    if (!directory) {
+        return 0;
+    }
+
+    // Kernel identity map plus any device windows and the vsyscall page
+    for (int i = 0; i < 1024; i++) {
+        directory[i] = i < KERNEL_PDE_COUNT || i == VSYSCALL_PDE ||
+                       (kernel_directory[i] & PAGE_4MB) ? kernel_directory[i] : 0;
+    }
+    return (unsigned int)directory;
+}
+
+// Whether a PDE points at a page table of this process only
+static int private_table(const unsigned int* pd, int i) {
+    return i >= KERNEL_PDE_COUNT && i != VSYSCALL_PDE &&
+           (pd[i] & PAGE_PRESENT) && !(pd[i] & PAGE_4MB);
+}
+
+// Free a page directory together with its user page tables and pages.
+// Pages still shared with another address space only lose a reference.
+void paging_destroy_directory(unsigned int directory) {
+    if (!directory) {
+        return;
+    }
+
+    unsigned int* pd = (unsigned int*)directory;
+    for (int i = KERNEL_PDE_COUNT; i < 1024; i++) {
+        if (!private_table(pd, i)) {
+            continue;
+        }
+        unsigned int* table = (unsigned int*)(pd[i] & ~0xFFF);
+        for (int j = 0; j < 1024; j++) {
+            if (table[j] & PAGE_PRESENT) {
+                frame_put((void*)(table[j] & ~0xFFF));
+            }
+        }
+        frame_free(table);
+    }
+    frame_free(pd);
+}
+
+// PTE of a present page in a process's own page tables, 0 if none
+static unsigned int* user_pte(unsigned int directory, unsigned int vaddr) {
+    unsigned int* pd = (unsigned int*)directory;
+    if (!private_table(pd, vaddr >> 22)) {
+        return 0;
+    }
+    unsigned int* table = (unsigned int*)(pd[vaddr >> 22] & ~0xFFF);
+    unsigned int* pte = &table[(vaddr >> 12) & 0x3FF];
+    return *pte & PAGE_PRESENT ? pte : 0;
+}
+
+// Let another address space map the page of a PTE too: take a reference
+// on the frame and make a writable page copy-on-write. Returns the PTE
+// for the other side, 0 if the frame cannot take more references.
+static unsigned int share_pte(unsigned int* pte) {
+    if (frame_get((void*)(*pte & ~0xFFF)) != 0) {
+        return 0;
+    }
+    if (*pte & PAGE_WRITE) {
+        *pte = (*pte & ~PAGE_WRITE) | PAGE_COW;
+    }
+    return *pte;
+}
+
+// Copy an address space for fork(). Page tables are copied, pages are
+// shared: writable ones become read-only and PAGE_COW in both, and are
+// copied by the first write fault. Returns 0 if out of memory.
+unsigned int paging_clone_directory(unsigned int directory) {
+    unsigned int* src = (unsigned int*)directory;
+    unsigned int* dst = (unsigned int*)paging_create_directory();
+    if (!dst) {
+        return 0;
+    }
+
+    for (int i = KERNEL_PDE_COUNT; i < 1024; i++) {
+        if (!private_table(src, i)) {
+            continue;
+        }
+        unsigned int* table = (unsigned int*)frame_alloc();
+        if (!table) {
+            paging_destroy_directory((unsigned int)dst);
+            return 0;
+        }
+        zero_frame(table);
+        dst[i] = (unsigned int)table | (src[i] & 0xFFF);
+
+        unsigned int* src_table = (unsigned int*)(src[i] & ~0xFFF);
+        for (int j = 0; j < 1024; j++) {
+            if (!(src_table[j] & PAGE_PRESENT)) {
+                continue;
+            }
+            table[j] = share_pte(&src_table[j]);
+            if (!table[j]) {
+                paging_destroy_directory((unsigned int)dst);
+                return 0;
+            }
+        }
+    }
+
+    // The source lost write access to its pages
+    if (read_cr3() == directory) {
+        write_cr3(directory);
+    }
+    return (unsigned int)dst;
+}
+
+// Load a page directory if it is not already active
+void paging_switch(unsigned int directory) {
+    if (directory && read_cr3() != directory) {
+        write_cr3(directory);
+    }
+}
+
+// Map one 4KB page, allocating its page table on demand
+int paging_map_page(unsigned int directory, unsigned int vaddr, unsigned int paddr, unsigned int flags) {
+    unsigned int* pd = (unsigned int*)directory;
+    unsigned int pde = vaddr >> 22;
+
+    if (!(pd[pde] & PAGE_PRESENT)) {
+        void* table = frame_alloc();
+        if (!table) {
+            return -1;
+        }
+        zero_frame(table);
+        pd[pde] = (unsigned int)table | PAGE_PRESENT | PAGE_WRITE | PAGE_USER;
+    }
+
+    unsigned int* table = (unsigned int*)(pd[pde] & ~0xFFF);
+    table[(vaddr >> 12) & 0x3FF] = (paddr & ~0xFFF) | flags | PAGE_PRESENT;
+
+    if (read_cr3() == directory) {
+        invlpg(vaddr);
+    }
+    return 0;
+}
+
+// Remove a 4KB mapping, returning the frame it pointed to (0 if none)
+unsigned int paging_unmap_page(unsigned int directory, unsigned int vaddr) {
+    unsigned int* pd = (unsigned int*)directory;
+    unsigned int pde = vaddr >> 22;
+
+    if (!(pd[pde] & PAGE_PRESENT) || (pd[pde] & PAGE_4MB)) {
+        return 0;
+    }
+
+    unsigned int* table = (unsigned int*)(pd[pde] & ~0xFFF);
+    unsigned int pte = table[(vaddr >> 12) & 0x3FF];
+    if (!(pte & PAGE_PRESENT)) {
+        return 0;
+    }
+
+    table[(vaddr >> 12) & 0x3FF] = 0;
+    if (read_cr3() == directory) {
+        invlpg(vaddr);
+    }
+    return pte & ~0xFFF;
+}
+
+// Frame a 4KB page is mapped to (0 if none)
+unsigned int paging_get_page(unsigned int directory, unsigned int vaddr) {
+    unsigned int* pd = (unsigned int*)directory;
+    unsigned int pde = vaddr >> 22;
+
+    if (!(pd[pde] & PAGE_PRESENT) || (pd[pde] & PAGE_4MB)) {
+        return 0;
+    }
+
+    unsigned int* table = (unsigned int*)(pd[pde] & ~0xFFF);
+    unsigned int pte = table[(vaddr >> 12) & 0x3FF];
+    return pte & PAGE_PRESENT ? pte & ~0xFFF : 0;
+}
+
+// Hand a user page over to another address space (see ipc.c). Moving
+// unmaps it here, sharing leaves it mapped copy-on-write on both sides.
+// Returns the PTE to map on the other side, 0 if there is no page or it
+// cannot be shared.
+unsigned int paging_give_page(unsigned int directory, unsigned int vaddr, int share) {
+    unsigned int* pte = user_pte(directory, vaddr);
+    if (!pte) {
+        return 0;
+    }
+
+    unsigned int given = *pte;
+    if (share) {
+        given = share_pte(pte);
+    } else {
+        *pte = 0;
+    }
+    if (read_cr3() == directory) {
+        invlpg(vaddr);
+    }
+    return given;
+}
+
+// Write fault on a copy-on-write page: give this address space its own
+// copy, or just write access if nobody else maps the frame any more
+static int copy_on_write(unsigned int directory, unsigned int addr) {
+    unsigned int* pte = user_pte(directory, addr);
+    if (!pte || !(*pte & PAGE_COW)) {
+        return 0;
+    }
+
+    void* frame = (void*)(*pte & ~0xFFF);
+    unsigned int flags = (*pte & 0xFFF & ~PAGE_COW) | PAGE_WRITE;
+    if (frame_shared(frame)) {
+        void* copy = frame_alloc();
+        if (!copy) {
+            print("Page fault: out of memory\n");
+            return 0;
+        }
+        memcpy(copy, frame, PAGE_SIZE);
+        *pte = (unsigned int)copy | flags;
+        frame_put(frame);
+    } else {
+        *pte = (unsigned int)frame | flags;
+    }
+    invlpg(addr);
+    return 1;
+}
+
+// Page fault handler: back untouched heap and user stack pages with
+// zeroed frames and resolve copy-on-write faults. Returns 1 if the
+// fault was resolved.
+int paging_handle_fault(unsigned int err_code) {
+    unsigned int addr = read_cr2();
+
+    if (!current_process || !current_process->cr3) {
+        return 0;
+    }
+    if (err_code & PF_PRESENT) {
+        // Protection violation: only writes to copy-on-write pages are fine
+        return (err_code & PF_WRITE) && copy_on_write(current_process->cr3, addr);
+    }
+    int in_heap = addr >= USER_HEAP_BASE && addr < current_process->heap_end;
+    int in_stack = addr >= USER_STACK_TOP - USER_STACK_SIZE && addr < USER_STACK_TOP;
+    if (!in_heap && !in_stack) {
+        return 0;
+    }
+
+    void* frame = frame_alloc();
+    if (!frame) {
+        print("Page fault: out of memory\n");
+        return 0;
+    }
+    zero_frame(frame);
+
+    unsigned int page = addr & ~(PAGE_SIZE - 1);
+    if (paging_map_page(current_process->cr3, page, (unsigned int)frame,
+                        PAGE_WRITE | PAGE_USER) != 0) {
+        frame_free(frame);
+        return 0;
+    }
+    return 1;
+}
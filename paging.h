@@ -0,0 +1,55 @@
+// paging.h
+
+#ifndef PAGING_H
+#define PAGING_H
+
+// Page directory / table entry flags
+#define PAGE_PRESENT    0x001
+#define PAGE_WRITE      0x002
+#define PAGE_USER       0x004
+#define PAGE_PWT        0x008
+#define PAGE_PCD        0x010
+#define PAGE_4MB        0x080   // PDE maps a 4MB page (PSE)
+#define PAGE_GLOBAL     0x100   // Survives CR3 reloads (PGE)
+#define PAGE_COW        0x200   // Available bit: writable once copied
+
+// Page fault error code bits
+#define PF_PRESENT      0x01    // Protection violation, not a missing page
+#define PF_WRITE        0x02
+#define PF_USER         0x04
+
+#define LARGE_PAGE_SIZE 0x400000
+
+// Address space layout. The kernel identity-maps physical memory below
+// KERNEL_SPACE_END in every page directory; the rest belongs to the process.
+#define KERNEL_SPACE_END    0x40000000
+#define KERNEL_PDE_COUNT    (KERNEL_SPACE_END / LARGE_PAGE_SIZE)
+#define USER_CODE_BASE      KERNEL_SPACE_END    // Ring 3 program image
+#define USER_STACK_TOP      0x80000000  // Demand-zero ring 3 stack, grows down
+#define USER_STACK_SIZE     0x100000
+#define USER_HEAP_BASE      0x80000000  // Demand-zero heap, grows up
+#define USER_HEAP_END       0xF0000000
+
+// System call entry code, one read-only user page shared by every page
+// directory through the kernel directory's page table
+#define VSYSCALL_ADDR       USER_HEAP_END
+#define VSYSCALL_PDE        (VSYSCALL_ADDR / LARGE_PAGE_SIZE)
+
+// Device registers above RAM (local APIC, IOAPIC) are identity-mapped
+// uncached with 4MB pages in every page directory, supervisor only
+
+// Functions
+void paging_init();
+unsigned int paging_create_directory();
+unsigned int paging_clone_directory(unsigned int directory);
+void paging_destroy_directory(unsigned int directory);
+void paging_switch(unsigned int directory);
+int paging_map_page(unsigned int directory, unsigned int vaddr, unsigned int paddr, unsigned int flags);
+unsigned int paging_unmap_page(unsigned int directory, unsigned int vaddr);
+unsigned int paging_get_page(unsigned int directory, unsigned int vaddr);
+unsigned int paging_give_page(unsigned int directory, unsigned int vaddr, int share);
+int paging_handle_fault(unsigned int err_code);
+int paging_map_mmio(unsigned int paddr);
+unsigned int paging_kernel_directory();
+
+#endif
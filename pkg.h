@@ -0,0 +1,25 @@
+// pkg.h
+
+#ifndef PKG_H
+#define PKG_H
+
+// Program package: files built on the host (see mkpkg.c), written to the
+// disk image after the kernel and loaded by stage2.asm at PROGRAMS_ADDR.
+// fs_load_package() adds them to the file system as read-only files.
+//
+// Layout: header, count entries, then the file contents
+#define PKG_MAGIC       0x31474B50  // "PKG1"
+#define PKG_NAME_LENGTH 12          // MAX_FILENAME_LENGTH, with the terminator
+
+struct pkg_header {
+    unsigned int magic;
+    unsigned int count;
+};
+
+struct pkg_entry {
+    char name[PKG_NAME_LENGTH];
+    unsigned int offset;    // From the start of the package
+    unsigned int size;
+};
+
+#endif
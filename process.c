@@ -2,95 +2,691 @@
 
 #include "process.h"
 #include "memory.h"
+#include "paging.h"
+#include "idt.h"
+#include "cpu.h"
+#include "sched.h"
+#include "timer.h"
+#include "softirq.h"
+#include "klib.h"
+#include "smp.h"
+#include "spinlock.h"
+#include "gdt.h"
+#include "ipc.h"
 
 // External functions from kernel
 extern void print(const char* str);
 extern void print_dec(unsigned int n);
+extern void print_padded(unsigned int n, unsigned int width);
+extern unsigned int cycles_to_ms(unsigned long long cycles, unsigned int khz);
 extern void putchar(char c);
 
-// Process table
-static struct pcb process_table[MAX_PROCESSES];
-static int next_pid = 1;
+// PIDs are handed out from a bitmap and looked up through a hash table
+#define PID_MAX         32768
+#define PID_HASH_SIZE   256
 
-// Current running process
-struct pcb* current_process = 0;
+static unsigned int pid_bitmap[PID_MAX / 32];
+static unsigned int last_pid = 0;
+static struct pcb* pid_hash[PID_HASH_SIZE];
 
-// Initialize process management
-void process_init() {
-    print("Process manager: Starting init (from process.c)\n");
-    print("Process manager: Initializing...\n");
-    
-    // Clear process table
-    for (int i = 0; i < MAX_PROCESSES; i++) {
-        process_table[i].pid = 0;
-        process_table[i].state = PROCESS_ZOMBIE;
-        process_table[i].esp = 0;
-        process_table[i].ebp = 0;
-        process_table[i].eip = 0;
-        process_table[i].cr3 = 0;
-        process_table[i].stack_base = 0;
-        // Clear name
-        for (int j = 0; j < 32; j++) {
-            process_table[i].name[j] = '\0';
-        }
+// Every live process, newest first
+static struct pcb* process_list_head = 0;
+static unsigned int process_count = 0;
+
+// Exited processes waiting to be freed
+static struct pcb* zombies = 0;
+
+// Walks of the process list in progress; zombies are not freed meanwhile
+static int list_walkers = 0;
+
+// Protects the PID bitmap, hash table, process list and zombies
+static struct spinlock process_lock = SPINLOCK_INIT;
+
+// Processes shown by 'top', and the TSC at its last sample
+#define TOP_ROWS 16
+static unsigned long long top_last_tsc = 0;
+
+// Snapshot of one process for 'top'
+struct top_row {
+    unsigned int pid;
+    unsigned int state;
+    unsigned long long cycles;      // Run time since the last sample
+    unsigned long long run_cycles;
+    unsigned long long irq_cycles;
+    unsigned int switches;
+    char name[32];
+};
+
+// Copy a process name
+static void set_name(struct pcb* p, const char* name) {
+    strlcpy(p->name, name, sizeof(p->name));
+}
+
+// Print a scheduler state padded to 8 characters
+static void print_state(unsigned int state) {
+    switch (state) {
+        case PROCESS_READY:
+            print("READY   ");
+            break;
+        case PROCESS_RUNNING:
+            print("RUNNING ");
+            break;
+        case PROCESS_BLOCKED:
+            print("BLOCKED ");
+            break;
+        default:
+            print("UNKNOWN ");
     }
+}
+
+static struct pcb* spawn(const char* name, void (*entry_point)());
+
+// Allocate the lowest free PID above the last one handed out
+static int pid_alloc() {
+    unsigned int pid = last_pid + 1;
     
-    // Create idle process (PID 0) - this is our kernel/shell
-    process_table[0].pid = 0;
-    process_table[0].state = PROCESS_RUNNING;
-    process_table[0].esp = 0;
-    process_table[0].ebp = 0;
-    process_table[0].eip = 0;
+    for (unsigned int scanned = 0; scanned <= PID_MAX; scanned += 32) {
+        if (pid >= PID_MAX) {
+            pid = 1;
+        }
+        
+        // Free PIDs in this word at or above pid
+        unsigned int free = ~pid_bitmap[pid / 32] & (0xFFFFFFFF << (pid % 32));
+        if (free) {
+            unsigned int bit;
+            asm("bsf %1, %0" : "=r"(bit) : "rm"(free));
+            pid = (pid & ~31) + bit;
+            pid_bitmap[pid / 32] |= 1 << (pid % 32);
+            last_pid = pid;
+            return pid;
+        }
+        pid = (pid & ~31) + 32;
+    }
+    return -1;  // All PIDs in use
+}
+
+static void pid_free(unsigned int pid) {
+    pid_bitmap[pid / 32] &= ~(1 << (pid % 32));
+}
+
+// Add a new process to the hash table and process list
+static void process_link(struct pcb* p) {
+    struct pcb** bucket = &pid_hash[p->pid % PID_HASH_SIZE];
+    p->hash_next = *bucket;
+    *bucket = p;
     
-    // Copy "kernel" to name
-    const char* kernel_name = "kernel";
-    for (int i = 0; i < 7; i++) {
-        process_table[0].name[i] = kernel_name[i];
+    p->list_prev = 0;
+    p->list_next = process_list_head;
+    if (process_list_head) {
+        process_list_head->list_prev = p;
+    }
+    process_list_head = p;
+    process_count++;
+}
+
+static void process_unlink(struct pcb* p) {
+    struct pcb** link = &pid_hash[p->pid % PID_HASH_SIZE];
+    while (*link != p) {
+        link = &(*link)->hash_next;
     }
+    *link = p->hash_next;
     
-    current_process = &process_table[0];
+    if (p->list_prev) {
+        p->list_prev->list_next = p->list_next;
+    } else {
+        process_list_head = p->list_next;
+    }
+    if (p->list_next) {
+        p->list_next->list_prev = p->list_prev;
+    }
+    process_count--;
+}
+
+// Find a process by PID
+struct pcb* process_find(unsigned int pid) {
+    struct pcb* p = pid_hash[pid % PID_HASH_SIZE];
+    while (p && p->pid != pid) {
+        p = p->hash_next;
+    }
+    return p;
+}
+
+// Allocate and clear a PCB
+static struct pcb* pcb_alloc() {
+    struct pcb* p = (struct pcb*)malloc(sizeof(struct pcb));
+    if (!p) {
+        return 0;
+    }
     
-    print("Process manager: Initialized\n");
+    memset(p, 0, sizeof(struct pcb));
+    p->heap_end = USER_HEAP_BASE;
+    return p;
 }
 
-// Create a new process (simplified - no actual execution yet)
-int process_create(const char* name, void (*entry_point)()) {
-    // Find free slot
-    int slot = -1;
-    for (int i = 1; i < MAX_PROCESSES; i++) {
-        if (process_table[i].state == PROCESS_ZOMBIE) {
-            slot = i;
-            break;
+// Free exited processes. Their stack and address space cannot be freed
+// while they are still running on them, so this is done later from
+// another process. Called with process_lock held.
+static void process_reap() {
+    if (list_walkers > 0) {
+        return;
+    }
+    
+    struct pcb** link = &zombies;
+    while (*link) {
+        struct pcb* p = *link;
+        if (p->on_cpu) {
+            link = &p->run_next;  // Another CPU is still switching away from it
+            continue;
+        }
+        *link = p->run_next;
+        
+        process_unlink(p);
+        pid_free(p->pid);
+        fpu_release(p);
+        if (p->stack_base) {
+            kfree((void*)p->stack_base);
         }
+        if (p->cr3) {
+            paging_destroy_directory(p->cr3);
+        }
+        kfree(p);
+    }
+}
+
+// Idle loop of every CPU, runs whenever no other process is ready
+void process_idle() {
+    while (1) {
+        unsigned int flags = spin_lock_irqsave(&process_lock);
+        process_reap();
+        spin_unlock_irqrestore(&process_lock, flags);
+        
+        softirq_run();
+        timer_idle();
+    }
+}
+
+// Initialize process management
+void process_init() {
+    for (int i = 0; i < PID_MAX / 32; i++) {
+        pid_bitmap[i] = 0;
+    }
+    for (int i = 0; i < PID_HASH_SIZE; i++) {
+        pid_hash[i] = 0;
     }
     
-    if (slot == -1) {
-        print("Process manager: No free slots\n");
-        return -1;
+    // Create kernel process (PID 0) - this is our kernel/shell
+    struct pcb* kernel = pcb_alloc();
+    kernel->pid = 0;
+    kernel->state = PROCESS_RUNNING;
+    kernel->on_cpu = 1;
+    kernel->cr3 = paging_create_directory();
+    set_name(kernel, "kernel");
+    pid_bitmap[0] |= 1;
+    process_link(kernel);
+    
+    this_cpu()->current = kernel;
+    paging_switch(kernel->cr3);
+    
+    // The idle process is never queued, the scheduler falls back to it
+    unsigned int flags = spin_lock_irqsave(&process_lock);
+    struct pcb* idle = spawn("idle", process_idle);
+    spin_unlock_irqrestore(&process_lock, flags);
+    sched_init_cpu(idle);
+    
+    print("Process manager initialized\n");
+}
+
+// Build the initial frame a new process is resumed from. It looks like
+// the process was interrupted right at its entry point; if the entry
+// point returns, it returns into process_exit().
+static unsigned int build_initial_frame(unsigned int stack_top, void (*entry_point)()) {
+    unsigned int* return_addr = (unsigned int*)(stack_top - 4);
+    *return_addr = (unsigned int)process_exit;
+    
+    // A ring 0 interrupt frame has no useresp/ss
+    struct registers* frame = (struct registers*)((unsigned int)return_addr -
+                              (sizeof(struct registers) - 2 * sizeof(unsigned int)));
+    frame->gs = 0;
+    frame->ds = 0x10;
+    frame->edi = 0;
+    frame->esi = 0;
+    frame->ebp = 0;
+    frame->esp = 0;
+    frame->ebx = 0;
+    frame->edx = 0;
+    frame->ecx = 0;
+    frame->eax = 0;
+    frame->int_no = 0;
+    frame->err_code = 0;
+    frame->eip = (unsigned int)entry_point;
+    frame->cs = 0x08;
+    frame->eflags = EFLAGS_IF;
+    
+    return (unsigned int)frame;
+}
+
+// Build the frame a user process starts from: an iret into ring 3 at
+// entry, on the demand-zero user stack. It fills the top of the kernel
+// stack, which is empty whenever the process runs in ring 3.
+static unsigned int build_user_frame(unsigned int stack_top, unsigned int entry) {
+    struct registers* frame = (struct registers*)(stack_top - sizeof(struct registers));
+    memset(frame, 0, sizeof(struct registers));
+    frame->gs = USER_DS;
+    frame->ds = USER_DS;
+    frame->eip = entry;
+    frame->cs = USER_CS;
+    frame->eflags = EFLAGS_IF;
+    frame->useresp = USER_STACK_TOP;
+    frame->ss = USER_DS;
+    
+    return (unsigned int)frame;
+}
+
+// Set up a PCB, stack and address space. Returns 0 on failure.
+// Called with process_lock held.
+static struct pcb* spawn(const char* name, void (*entry_point)()) {
+    process_reap();
+    
+    int pid = pid_alloc();
+    if (pid < 0) {
+        print("No free PIDs\n");
+        return 0;
+    }
+    
+    // Every process gets its own kernel stack and address space
+    struct pcb* p = pcb_alloc();
+    void* stack = malloc(KERNEL_STACK_SIZE);
+    if (!p || !stack) {
+        kfree(p);
+        kfree(stack);
+        pid_free(pid);
+        print("Out of memory for process\n");
+        return 0;
     }
     
     // Initialize PCB
-    process_table[slot].pid = next_pid++;
-    process_table[slot].state = PROCESS_READY;
-    process_table[slot].eip = (unsigned int)entry_point;
+    p->pid = pid;
+    p->eip = (unsigned int)entry_point;
+    p->cr3 = paging_create_directory();
+    p->stack_base = (unsigned int)stack;
+    p->esp = build_initial_frame(p->stack_base + KERNEL_STACK_SIZE, entry_point);
+    set_name(p, name);
+    p->state = PROCESS_READY;
+    process_link(p);
     
-    // Copy name
-    int i;
-    for (i = 0; i < 31 && name[i]; i++) {
-        process_table[slot].name[i] = name[i];
-    }
-    process_table[slot].name[i] = '\0';
+    return p;
+}
+
+// Queue the exited process for process_reap(). Called with
+// process_lock held.
+static void make_zombie(struct pcb* p) {
+    p->state = PROCESS_ZOMBIE;
+    p->run_next = zombies;
+    zombies = p;
+}
+
+// Queue a newly spawned process and report it. Returns its PID.
+static int start(struct pcb* p, const char* name) {
+    // p may run, exit and be freed on another CPU once queued
+    int pid = p->pid;
+    sched_enqueue(p);
     
     print("Process created: ");
     print(name);
     print(" (PID ");
-    print_dec(process_table[slot].pid);
+    print_dec(pid);
     print(")\n");
     
-    return process_table[slot].pid;
+    return pid;
+}
+
+// Create a new kernel thread starting at entry_point
+int process_create(const char* name, void (*entry_point)()) {
+    unsigned int flags = spin_lock_irqsave(&process_lock);
+    struct pcb* p = spawn(name, entry_point);
+    spin_unlock_irqrestore(&process_lock, flags);
+    
+    if (!p) {
+        return -1;
+    }
+    return start(p, name);
+}
+
+// Copy a program image to fresh pages at vaddr in a page directory.
+// Returns 0 on success; pages mapped so far go with the directory.
+static int map_user_image(unsigned int directory, unsigned int vaddr,
+                          const void* image, unsigned int size) {
+    for (unsigned int offset = 0; offset < size; offset += PAGE_SIZE) {
+        void* frame = frame_alloc();
+        if (!frame) {
+            return -1;
+        }
+        unsigned int chunk = size - offset < PAGE_SIZE ? size - offset : PAGE_SIZE;
+        memcpy(frame, (const char*)image + offset, chunk);
+        memset((char*)frame + chunk, 0, PAGE_SIZE - chunk);
+        
+        if (paging_map_page(directory, vaddr + offset, (unsigned int)frame,
+                            PAGE_WRITE | PAGE_USER) != 0) {
+            frame_free(frame);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Set up a ring 3 process with an empty address space. The caller maps
+// its program, then starts it with process_start_user() or drops it
+// with process_discard(); until then nothing else touches it.
+struct pcb* process_new_user(const char* name) {
+    unsigned int flags = spin_lock_irqsave(&process_lock);
+    struct pcb* p = spawn(name, 0);
+    spin_unlock_irqrestore(&process_lock, flags);
+    
+    if (p && !p->cr3) {
+        print("No paging, no ring 3 processes\n");
+        process_discard(p);
+        return 0;
+    }
+    return p;
+}
+
+// Queue a process from process_new_user(), entering ring 3 at entry.
+// Returns its PID.
+int process_start_user(struct pcb* p, unsigned int entry) {
+    p->user = 1;
+    p->eip = entry;
+    p->esp = build_user_frame(p->stack_base + KERNEL_STACK_SIZE, entry);
+    return start(p, p->name);
+}
+
+// Free a process from process_new_user() that never ran
+void process_discard(struct pcb* p) {
+    unsigned int flags = spin_lock_irqsave(&process_lock);
+    make_zombie(p);
+    spin_unlock_irqrestore(&process_lock, flags);
+}
+
+// Create a ring 3 process running a copy of image, loaded at
+// USER_CODE_BASE and entered at its first byte
+int process_create_user(const char* name, const void* image, unsigned int size) {
+    struct pcb* p = process_new_user(name);
+    if (!p) {
+        return -1;
+    }
+    
+    if (map_user_image(p->cr3, USER_CODE_BASE, image, size) != 0) {
+        print("Out of memory for process\n");
+        process_discard(p);
+        return -1;
+    }
+    return process_start_user(p, USER_CODE_BASE);
+}
+
+// Duplicate the current user process, which is in a system call with
+// frame regs. The child shares its pages copy-on-write and returns 0
+// from the same call. Returns the child's PID, or -1.
+int process_fork(struct registers* regs) {
+    struct pcb* parent = current_process;
+    if (!parent->user) {
+        return -1;
+    }
+    
+    unsigned int flags = spin_lock_irqsave(&process_lock);
+    struct pcb* child = spawn(parent->name, 0);
+    spin_unlock_irqrestore(&process_lock, flags);
+    if (!child) {
+        return -1;
+    }
+    
+    unsigned int directory = paging_clone_directory(parent->cr3);
+    if (!directory) {
+        print("Out of memory for fork\n");
+        process_discard(child);
+        return -1;
+    }
+    paging_destroy_directory(child->cr3);
+    child->cr3 = directory;
+    child->heap_end = parent->heap_end;
+    child->user = 1;
+    fpu_fork(child);
+    
+    // Resumes where the parent entered the kernel, at the same stack depth
+    struct registers* frame = (struct registers*)(child->stack_base + KERNEL_STACK_SIZE -
+                                                  sizeof(struct registers));
+    *frame = *regs;
+    frame->eax = 0;
+    child->eip = regs->eip;
+    child->esp = (unsigned int)frame;
+    
+    // Not reported like other new processes: fork is meant to be cheap
+    int pid = child->pid;
+    sched_enqueue(child);
+    return pid;
 }
 
-// List all processes
+// Whether a process exists and has not exited
+int process_alive(unsigned int pid) {
+    unsigned int flags = spin_lock_irqsave(&process_lock);
+    struct pcb* p = process_find(pid);
+    int alive = p && p->state != PROCESS_ZOMBIE;
+    spin_unlock_irqrestore(&process_lock, flags);
+    return alive;
+}
+
+// Grow or shrink the current process heap. Growing only moves the
+// break; pages are allocated by the page fault handler on first touch.
+void* process_sbrk(int increment) {
+    if (!current_process->cr3) {
+        return (void*)-1;  // No paging
+    }
+    
+    unsigned int old_end = current_process->heap_end;
+    unsigned int new_end = old_end + increment;
+    
+    if (increment < 0) {
+        if (new_end < USER_HEAP_BASE || new_end > old_end) {
+            return (void*)-1;
+        }
+        // Release whole pages above the new break
+        unsigned int page = (new_end + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+        for (; page < old_end; page += PAGE_SIZE) {
+            unsigned int frame = paging_unmap_page(current_process->cr3, page);
+            if (frame) {
+                frame_put((void*)frame);
+            }
+        }
+    } else if (new_end < old_end || new_end > USER_HEAP_END) {
+        return (void*)-1;  // Wrapped around or out of heap space
+    }
+    
+    current_process->heap_end = new_end;
+    return (void*)old_end;
+}
+
+// Give up the CPU voluntarily
+void process_yield() {
+    asm volatile("int %0" : : "i"(YIELD_VECTOR) : "memory");
+}
+
+// Turn the thread running on this CPU into a process. Used for the boot
+// thread of each application processor, which becomes its idle process.
+// Called with interrupts disabled.
+struct pcb* process_adopt(const char* name) {
+    struct pcb* p = pcb_alloc();
+    if (!p) {
+        print("Out of memory for process\n");
+        while (1) {
+            asm volatile("hlt");
+        }
+    }
+    
+    p->state = PROCESS_RUNNING;
+    p->on_cpu = 1;
+    p->cr3 = paging_kernel_directory();
+    set_name(p, name);
+    
+    spin_lock(&process_lock);
+    p->pid = pid_alloc();
+    process_link(p);
+    spin_unlock(&process_lock);
+    
+    this_cpu()->current = p;
+    return p;
+}
+
+// Terminate the current process. It is freed later by process_reap().
+void process_exit() {
+    asm volatile("cli");
+    struct pcb* p = current_process;
+    ipc_exit(p->pid);
+    
+    spin_lock(&process_lock);
+    make_zombie(p);
+    spin_unlock(&process_lock);
+    
+    // Never returns: the scheduler will not pick a zombie again
+    while (1) {
+        process_yield();
+    }
+}
+
+// List processes. The list is walked with interrupts enabled; new
+// processes are added at the head and nothing is freed until we finish.
 void process_list() {
-    print("TEST: process_list function called!\n");
+    unsigned int flags = spin_lock_irqsave(&process_lock);
+    list_walkers++;
+    struct pcb* p = process_list_head;
+    unsigned int total = process_count;
+    spin_unlock_irqrestore(&process_lock, flags);
+    
+    print("  PID  STATE    PRI  CPU  NAME\n");
+    print("-----  -------  ---  ---  ----------------\n");
+    
+    for (; p; p = p->list_next) {
+        if (p->state == PROCESS_ZOMBIE) {
+            continue;
+        }
+        
+        // Print PID, right aligned
+        print_padded(p->pid, 5);
+        print("  ");
+        
+        // Print state
+        print_state(p->state);
+        
+        // Print MLFQ level
+        print(" ");
+        print_dec(p->priority);
+        print("   ");
+        
+        // Print the CPU it runs or is queued on
+        print_padded(p->cpu, 3);
+        print(" ");
+        
+        // Print name
+        print(" ");
+        print(p->name);
+        print("\n");
+    }
+    
+    flags = spin_lock_irqsave(&process_lock);
+    list_walkers--;
+    spin_unlock_irqrestore(&process_lock, flags);
+    
+    print_dec(total);
+    print(" processes\n");
+}
+
+// Print one screen of 'top': processes sorted by their share of the CPU
+// since the previous call (or since boot, on the first call)
+void process_top() {
+    unsigned int flags = irq_save();
+    sched_account();
+    spin_lock(&process_lock);
+    unsigned long long now = rdtsc();
+    unsigned long long elapsed = now - top_last_tsc;
+    top_last_tsc = now;
+    
+    struct top_row* rows = (struct top_row*)malloc(process_count * sizeof(struct top_row));
+    if (!rows) {
+        spin_unlock_irqrestore(&process_lock, flags);
+        print("Out of memory\n");
+        return;
+    }
+    
+    // Snapshot the counters with interrupts off, print afterwards
+    unsigned int count = 0;
+    unsigned int switches = 0;
+    for (struct pcb* p = process_list_head; p; p = p->list_next) {
+        if (p->state == PROCESS_ZOMBIE) {
+            continue;
+        }
+        struct top_row* row = &rows[count++];
+        row->pid = p->pid;
+        row->state = p->state;
+        row->cycles = p->run_cycles - p->top_cycles;
+        row->run_cycles = p->run_cycles;
+        row->irq_cycles = p->irq_cycles;
+        row->switches = p->switches;
+        memcpy(row->name, p->name, sizeof(row->name));
+        p->top_cycles = p->run_cycles;
+        switches += p->switches;
+    }
+    spin_unlock_irqrestore(&process_lock, flags);
+    
+    // Busiest first
+    for (unsigned int i = 1; i < count; i++) {
+        struct top_row row = rows[i];
+        unsigned int j = i;
+        for (; j > 0 && rows[j - 1].cycles < row.cycles; j--) {
+            rows[j] = rows[j - 1];
+        }
+        rows[j] = row;
+    }
+    
+    // Shares are computed with a 32-bit divisor
+    unsigned int shift = 0;
+    while (elapsed >> 32) {
+        elapsed >>= 1;
+        shift++;
+    }
+    if (elapsed == 0) {
+        elapsed = 1;
+    }
+    unsigned int khz = timer_tsc_khz();
+    
+    print("Processes: ");
+    print_dec(count);
+    print(", context switches: ");
+    print_dec(switches);
+    print(", TSC: ");
+    print_dec(khz / 1000);
+    print(" MHz\n\n");
+    
+    print("  PID  STATE      %CPU  SWITCHES   TIME ms    IRQ ms  NAME\n");
+    print("-----  -------  ------  --------  --------  --------  ----------------\n");
+    
+    for (unsigned int i = 0; i < count && i < TOP_ROWS; i++) {
+        struct top_row* row = &rows[i];
+        unsigned int permille = div64((row->cycles >> shift) * 1000, elapsed);
+        
+        print_padded(row->pid, 5);
+        print("  ");
+        print_state(row->state);
+        print(" ");
+        print_padded(permille / 10, 4);
+        print(".");
+        print_dec(permille % 10);
+        print("  ");
+        print_padded(row->switches, 8);
+        print("  ");
+        print_padded(cycles_to_ms(row->run_cycles, khz), 8);
+        print("  ");
+        print_padded(cycles_to_ms(row->irq_cycles, khz), 8);
+        print("  ");
+        print(row->name);
+        print("\n");
+    }
+    
+    kfree(rows);
 }
@@ -3,35 +3,68 @@
 #ifndef PROCESS_H
 #define PROCESS_H
 
+#include "smp.h"
+#include "fpu.h"
+
+struct registers;
+
 // Process states
 #define PROCESS_READY    0
 #define PROCESS_RUNNING  1
 #define PROCESS_BLOCKED  2
 #define PROCESS_ZOMBIE   3
 
-// Maximum processes
-#define MAX_PROCESSES    8
+// Kernel stack per process
+#define KERNEL_STACK_SIZE 8192
 
 // Process Control Block
 struct pcb {
     unsigned int pid;           // Process ID
     unsigned int state;         // Process state
-    unsigned int esp;           // Stack pointer
+    unsigned int esp;           // Saved interrupt frame on the kernel stack
     unsigned int ebp;           // Base pointer
     unsigned int eip;           // Instruction pointer
-    unsigned int cr3;           // Page directory (not used yet)
+    unsigned int cr3;           // Page directory
     char name[32];             // Process name
-    unsigned int stack_base;    // Stack base address
+    unsigned int stack_base;    // Kernel stack (0 for the boot stack)
+    unsigned int heap_end;      // End of the demand-zero heap
+    unsigned int priority;      // Scheduler level, 0 is highest
+    unsigned int slice_left;    // Ticks left in the current time slice
+    struct pcb* run_next;       // Next process in the same run queue
+    struct pcb* hash_next;      // Next process in the same PID hash bucket
+    struct pcb* list_next;      // All-process list links
+    struct pcb* list_prev;
+    unsigned long long run_cycles;  // TSC cycles spent running
+    unsigned long long irq_cycles;  // Part of run_cycles spent in IRQ handlers
+    unsigned long long top_cycles;  // run_cycles at the last 'top' sample
+    unsigned int switches;      // Times switched to
+    unsigned int cpu;           // CPU whose run queue it belongs to
+    volatile int on_cpu;        // Running, or its stack still in use by a switch
+    int fpu_used;               // Has FPU state of its own in fpu
+    unsigned int fpu_cpu;       // CPU that last loaded its FPU state
+    int user;                   // Runs in ring 3
+    struct fpu_state fpu;       // Saved by fpu_switch_out(), 16-byte aligned
 };
 
 // Process management functions
 void process_init();
 int process_create(const char* name, void (*entry_point)());
+struct pcb* process_new_user(const char* name);
+int process_start_user(struct pcb* p, unsigned int entry);
+void process_discard(struct pcb* p);
+int process_create_user(const char* name, const void* image, unsigned int size);
+int process_alive(unsigned int pid);
+int process_fork(struct registers* regs);
 void process_yield();
 void process_exit();
 void process_list();
+void* process_sbrk(int increment);
+struct pcb* process_find(unsigned int pid);
+void process_top();
+void process_idle();
+struct pcb* process_adopt(const char* name);
 
-// Global current process
-extern struct pcb* current_process;
+// Process running on this CPU
+#define current_process this_cpu_current()
 
 #endif
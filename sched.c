@@ -0,0 +1,355 @@
+// sched.c
+
+#include "sched.h"
+#include "timer.h"
+#include "paging.h"
+#include "idt.h"
+#include "cpu.h"
+#include "smp.h"
+#include "lapic.h"
+#include "spinlock.h"
+#include "fpu.h"
+#include "gdt.h"
+
+// Time slice ticks for level 0; level n gets (n + 1) times as much
+#define SLICE_TICKS     ((TIME_SLICE_MS * TIMER_HZ + 999) / 1000)
+#define BOOST_TICKS     ((SCHED_BOOST_MS * TIMER_HZ) / 1000)
+
+// One FIFO run queue per priority level
+struct run_queue {
+    struct pcb* head;
+    struct pcb* tail;
+};
+
+// Scheduler state of one CPU. The lock protects the run queues and
+// nr_ready; the rest is only touched by the owning CPU.
+struct cpu_sched {
+    struct spinlock lock;
+    struct run_queue run_queues[SCHED_LEVELS];
+    unsigned int ready_bitmap;      // Bit n set while run_queues[n] is non-empty
+    unsigned int nr_ready;
+    struct pcb* idle;               // Runs when nothing else is ready; never queued
+    volatile int need_resched;
+    unsigned int boost_left;
+    unsigned long long switch_tsc;  // TSC at the last switch or accounting flush
+} __attribute__((aligned(64)));
+
+static struct cpu_sched sched_cpus[MAX_CPUS];
+
+static inline struct cpu_sched* this_sched() {
+    return &sched_cpus[this_cpu()->id];
+}
+
+static unsigned int slice_for(unsigned int level) {
+    return SLICE_TICKS * (level + 1);
+}
+
+// Lowest set bit of the bitmap is the highest ready priority
+static inline unsigned int highest_ready_level(struct cpu_sched* rq) {
+    unsigned int level;
+    asm("bsf %1, %0" : "=r"(level) : "rm"(rq->ready_bitmap));
+    return level;
+}
+
+static void queue_push(struct cpu_sched* rq, struct pcb* p) {
+    struct run_queue* q = &rq->run_queues[p->priority];
+    p->run_next = 0;
+    if (q->tail) {
+        q->tail->run_next = p;
+    } else {
+        q->head = p;
+    }
+    q->tail = p;
+    rq->ready_bitmap |= 1 << p->priority;
+    rq->nr_ready++;
+}
+
+static struct pcb* queue_pop(struct cpu_sched* rq, unsigned int level) {
+    struct run_queue* q = &rq->run_queues[level];
+    struct pcb* p = q->head;
+    q->head = p->run_next;
+    if (!q->head) {
+        q->tail = 0;
+        rq->ready_bitmap &= ~(1 << level);
+    }
+    rq->nr_ready--;
+    p->run_next = 0;
+    return p;
+}
+
+// Set up this CPU's run queues; idle runs whenever they are empty
+void sched_init_cpu(struct pcb* idle) {
+    struct cpu_sched* rq = this_sched();
+    for (int i = 0; i < SCHED_LEVELS; i++) {
+        rq->run_queues[i].head = 0;
+        rq->run_queues[i].tail = 0;
+    }
+    spin_init(&rq->lock);
+    rq->ready_bitmap = 0;
+    rq->nr_ready = 0;
+    rq->idle = idle;
+    rq->need_resched = 0;
+    rq->boost_left = BOOST_TICKS;
+    
+    // The boot thread of this CPU is already running
+    struct pcb* current = this_cpu()->current;
+    current->priority = 0;
+    current->slice_left = slice_for(0);
+    current->cpu = this_cpu()->id;
+    rq->switch_tsc = rdtsc();
+}
+
+// Does CPU id run anything but its idle process?
+int sched_cpu_busy(unsigned int id) {
+    return cpus[id].current != sched_cpus[id].idle;
+}
+
+// Queue p on CPU id and get that CPU to look at it if p should run
+// before what it is doing now. Takes the CPU's run queue lock.
+static void make_ready(struct pcb* p, unsigned int id) {
+    struct cpu_sched* rq = &sched_cpus[id];
+    
+    spin_lock(&rq->lock);
+    p->cpu = id;
+    p->state = PROCESS_READY;
+    queue_push(rq, p);
+    
+    struct pcb* running = cpus[id].current;
+    int preempt = running == rq->idle || p->priority < running->priority;
+    if (preempt) {
+        rq->need_resched = 1;
+    }
+    spin_unlock(&rq->lock);
+    
+    if (preempt && id != this_cpu()->id) {
+        lapic_send_ipi(cpus[id].apic_id, IPI_RESCHED_VECTOR);
+    }
+}
+
+// Make a new process runnable at the top level, on the least loaded CPU
+void sched_enqueue(struct pcb* p) {
+    unsigned int flags = irq_save();
+    
+    unsigned int best = this_cpu()->id;
+    unsigned int best_load = ~0u;
+    for (unsigned int i = 0; i < cpu_count; i++) {
+        unsigned int load = sched_cpus[i].nr_ready + sched_cpu_busy(i);
+        if (load < best_load) {
+            best = i;
+            best_load = load;
+        }
+    }
+    
+    p->priority = 0;
+    p->slice_left = slice_for(0);
+    make_ready(p, best);
+    
+    irq_restore(flags);
+}
+
+// Block the current process until sched_wakeup(). Must be called with
+// interrupts disabled and lock held, after registering on whatever will
+// wake it under that lock; the lock is dropped while blocked.
+void sched_block(struct spinlock* lock) {
+    current_process->state = PROCESS_BLOCKED;
+    spin_unlock(lock);
+    process_yield();
+    spin_lock(lock);
+}
+
+// Make a blocked process ready again on the CPU it last ran on. A process
+// that blocked is waiting on I/O, so it moves up one level and preempts
+// lower priority work. Called with interrupts disabled.
+void sched_wakeup(struct pcb* p) {
+    if (p->state != PROCESS_BLOCKED) {
+        return;
+    }
+    
+    if (p->priority > 0) {
+        p->priority--;
+    }
+    p->slice_left = slice_for(p->priority);
+    make_ready(p, p->cpu);
+}
+
+// Is any process waiting for this CPU?
+int sched_has_ready() {
+    return this_sched()->ready_bitmap != 0;
+}
+
+// Should the interrupted process be preempted on IRQ exit?
+int sched_need_resched() {
+    return this_sched()->need_resched;
+}
+
+// Ask this CPU to reschedule on IRQ exit
+void sched_set_need_resched() {
+    this_sched()->need_resched = 1;
+}
+
+// Charge the running process for its time up to now, so its counters
+// can be sampled. Called with interrupts disabled.
+void sched_account() {
+    struct cpu_sched* rq = this_sched();
+    unsigned long long now = rdtsc();
+    current_process->run_cycles += now - rq->switch_tsc;
+    rq->switch_tsc = now;
+}
+
+// Move every ready process on this CPU back to the top level
+static void priority_boost(struct cpu_sched* rq) {
+    spin_lock(&rq->lock);
+    for (int level = 1; level < SCHED_LEVELS; level++) {
+        while (rq->ready_bitmap & (1 << level)) {
+            struct pcb* p = queue_pop(rq, level);
+            p->priority = 0;
+            queue_push(rq, p);
+        }
+    }
+    spin_unlock(&rq->lock);
+    
+    if (current_process != rq->idle) {
+        current_process->priority = 0;
+    }
+}
+
+// Called on every timer tick, on each CPU. A process that uses up its
+// slice is CPU-bound and drops one level. The switch itself happens on
+// IRQ exit, after the bottom halves.
+void sched_tick() {
+    struct cpu_sched* rq = this_sched();
+    struct pcb* current = current_process;
+    
+    if (--rq->boost_left == 0) {
+        rq->boost_left = BOOST_TICKS;
+        priority_boost(rq);
+    }
+    
+    if (current == rq->idle) {
+        if (rq->ready_bitmap) {
+            rq->need_resched = 1;
+        }
+        return;
+    }
+    
+    if (current->slice_left > 0) {
+        current->slice_left--;
+    }
+    if (current->slice_left == 0) {
+        if (current->priority < SCHED_LEVELS - 1) {
+            current->priority++;
+        }
+        current->slice_left = slice_for(current->priority);
+        rq->need_resched = 1;
+    }
+}
+
+// Take the highest priority ready process from a CPU that is busy
+// running something else. The victim's lock is only tried, so two CPUs
+// stealing from each other cannot deadlock.
+static struct pcb* steal_work(unsigned int self) {
+    for (unsigned int n = 1; n < cpu_count; n++) {
+        unsigned int id = (self + n) % cpu_count;
+        struct cpu_sched* victim = &sched_cpus[id];
+        
+        if (!victim->ready_bitmap || !sched_cpu_busy(id)) {
+            continue;  // Nothing queued, or the CPU is about to pick it up
+        }
+        if (!spin_trylock(&victim->lock)) {
+            continue;
+        }
+        
+        struct pcb* p = 0;
+        if (victim->ready_bitmap) {
+            p = queue_pop(victim, highest_ready_level(victim));
+            p->cpu = self;
+        }
+        spin_unlock(&victim->lock);
+        
+        if (p) {
+            return p;
+        }
+    }
+    return 0;
+}
+
+// Pick the highest priority ready process. Called from interrupt context
+// with the current process's saved frame; returns the frame to resume.
+struct registers* schedule(struct registers* regs) {
+    struct cpu* cpu = this_cpu();
+    struct cpu_sched* rq = &sched_cpus[cpu->id];
+    struct pcb* prev = cpu->current;
+    
+    prev->esp = (unsigned int)regs;
+    
+    // CPU accounting costs one rdtsc and a 64-bit add per switch
+    unsigned long long now = rdtsc();
+    prev->run_cycles += now - rq->switch_tsc;
+    rq->switch_tsc = now;
+    
+    spin_lock(&rq->lock);
+    rq->need_resched = 0;
+    
+    // A preempted or yielding process goes to the back of its level
+    if (prev->state == PROCESS_RUNNING && prev != rq->idle) {
+        prev->state = PROCESS_READY;
+        queue_push(rq, prev);
+    }
+    
+    struct pcb* next = 0;
+    if (rq->ready_bitmap) {
+        next = queue_pop(rq, highest_ready_level(rq));
+    }
+    spin_unlock(&rq->lock);
+    
+    // Out of local work: help a busy CPU
+    if (!next && cpu_count > 1) {
+        next = steal_work(cpu->id);
+    }
+    if (!next) {
+        next = rq->idle;
+    }
+    
+    if (prev == rq->idle && next != rq->idle) {
+        // Work arrived while idle: bring back the periodic tick. The
+        // boot CPU keeps time for all, so wake it if it went tickless.
+        timer_idle_exit();
+        if (cpu->id != 0 && timer_tickless()) {
+            lapic_send_ipi(cpus[0].apic_id, IPI_RESCHED_VECTOR);
+        }
+    }
+    
+    next->state = PROCESS_RUNNING;
+    if (next != prev) {
+        // A process switched away from on another CPU may still be on
+        // its stack there; wait for that switch to complete
+        while (next->on_cpu) {
+            cpu_relax();
+        }
+        next->on_cpu = 1;
+        next->switches++;
+        
+        // prev cannot run elsewhere before the switch completes, so its
+        // FPU state is saved in time
+        fpu_switch_out(prev);
+        
+        cpu->switched_from = prev;
+        cpu->current = next;
+        paging_switch(next->cr3);
+        if (next->user) {
+            gdt_set_kernel_stack(cpu->id, next->stack_base + KERNEL_STACK_SIZE);
+        }
+    }
+    
+    return (struct registers*)next->esp;
+}
+
+// Called by the interrupt stub once it has moved onto the next process's
+// stack: the previous process may now run on another CPU
+void sched_switch_done() {
+    struct cpu* cpu = this_cpu();
+    if (cpu->switched_from) {
+        cpu->switched_from->on_cpu = 0;
+        cpu->switched_from = 0;
+    }
+}
@@ -0,0 +1,32 @@
+// sched.h
+
+#ifndef SCHED_H
+#define SCHED_H
+
+#include "process.h"
+
+// Multi-level feedback queue. Level 0 is the highest priority.
+#define SCHED_LEVELS    8
+
+// All ready processes return to level 0 this often, so CPU-bound
+// processes cannot starve forever
+#define SCHED_BOOST_MS  1000
+
+struct registers;
+struct spinlock;
+
+// Functions
+void sched_init_cpu(struct pcb* idle);
+void sched_enqueue(struct pcb* p);
+void sched_block(struct spinlock* lock);
+void sched_wakeup(struct pcb* p);
+int sched_has_ready();
+int sched_need_resched();
+void sched_set_need_resched();
+int sched_cpu_busy(unsigned int id);
+void sched_account();
+void sched_tick();
+struct registers* schedule(struct registers* regs);
+void sched_switch_done();
+
+#endif
@@ -0,0 +1,178 @@
+// smp.c
+
+#include "smp.h"
+#include "acpi.h"
+#include "lapic.h"
+#include "gdt.h"
+#include "idt.h"
+#include "paging.h"
+#include "process.h"
+#include "sched.h"
+#include "timer.h"
+#include "memory.h"
+#include "cpu.h"
+#include "irq.h"
+#include "fpu.h"
+#include "klib.h"
+#include "syscall.h"
+#include "initcall.h"
+
+// External functions from kernel
+extern void print(const char* str);
+extern void print_dec(unsigned int n);
+
+// Real mode trampoline (ap_boot.asm), copied below 1MB for the SIPI
+#define AP_TRAMPOLINE   0x7000
+
+extern char ap_trampoline_start[];
+extern char ap_trampoline_end[];
+extern char ap_boot_params[];
+
+// Parameter block at the end of the trampoline
+struct ap_boot_params {
+    unsigned int cr3;
+    unsigned int cr4;
+    unsigned int stack;
+    unsigned int cpu_id;
+    unsigned int entry;
+};
+
+// Time an AP gets to report in
+#define AP_START_TIMEOUT_MS 100
+
+struct cpu cpus[MAX_CPUS];
+unsigned int cpu_count = 1;
+
+extern struct idt_ptr idtp;
+
+// First C code on an application processor, on the stack smp_init()
+// allocated for it. The boot thread becomes this CPU's idle process.
+static void ap_main(unsigned int cpu_id) {
+    gdt_load(cpu_id);
+    idt_load((unsigned int)&idtp);
+    lapic_init_ap();
+    timer_init_ap();
+    fpu_init();
+    syscall_init_cpu();
+    
+    sched_init_cpu(process_adopt("idle"));
+    this_cpu()->started = 1;
+    
+    asm volatile("sti");
+    process_idle();
+}
+
+// Tick forwarded by the boot CPU
+static struct registers* ipi_tick(struct registers* regs, void* ctx) {
+    (void)ctx;
+    sched_tick();
+    return regs;
+}
+
+// Work was queued for this CPU: reschedule on the way out of the IRQ
+static struct registers* ipi_resched(struct registers* regs, void* ctx) {
+    (void)ctx;
+    sched_set_need_resched();
+    return regs;
+}
+
+// Busy-wait, for the startup IPI delays. Assumes 1GHz if the TSC is
+// not calibrated yet.
+static void delay_us(unsigned int us) {
+    unsigned int mhz = timer_tsc_khz() / 1000;
+    unsigned long long end = rdtsc() + us * (mhz ? mhz : 1000);
+    while (rdtsc() < end) {
+        cpu_relax();
+    }
+}
+
+// INIT-SIPI-SIPI sequence for one AP. Returns 1 once it has reported in.
+static int start_ap(unsigned int cpu_id) {
+    struct cpu* cpu = &cpus[cpu_id];
+    
+    void* stack = malloc(KERNEL_STACK_SIZE);
+    if (!stack) {
+        return 0;
+    }
+    
+    struct ap_boot_params* params = (struct ap_boot_params*)
+        (AP_TRAMPOLINE + (ap_boot_params - ap_trampoline_start));
+    params->cr3 = paging_kernel_directory();
+    params->cr4 = read_cr4();
+    params->stack = (unsigned int)stack + KERNEL_STACK_SIZE;
+    params->cpu_id = cpu_id;
+    params->entry = (unsigned int)ap_main;
+    
+    lapic_send_init(cpu->apic_id);
+    ksleep(10);
+    
+    for (int i = 0; i < 2 && !cpu->started; i++) {
+        lapic_send_startup(cpu->apic_id, AP_TRAMPOLINE);
+        delay_us(200);
+    }
+    
+    unsigned int deadline = timer_ms() + AP_START_TIMEOUT_MS;
+    while (!cpu->started && (int)(deadline - timer_ms()) > 0) {
+        ksleep(1);
+    }
+    
+    // The stack of a CPU that did not report in is not freed, in case
+    // it is merely slow
+    return cpu->started;
+}
+
+// Start every enabled processor listed in the MADT. The boot CPU is
+// cpus[0]; APs are numbered in MADT order as they come up. Must run
+// with interrupts enabled, after the timer and process manager: it is a
+// deferred initcall, so the APs' startup delays do not hold up the
+// shell prompt and the scheduler picks them up as they report in.
+void smp_init() {
+    const struct madt_info* madt = acpi_madt();
+    
+    cpus[0].apic_id = lapic_present() ? lapic_id() : 0;
+    cpus[0].started = 1;
+    
+    if (!madt || !lapic_present() || madt->cpu_count < 2) {
+        print("SMP: 1 CPU\n");
+        return;
+    }
+    
+    irq_register_vector(IPI_TICK_VECTOR, ipi_tick, 0, "tick ipi");
+    irq_register_vector(IPI_RESCHED_VECTOR, ipi_resched, 0, "resched ipi");
+    
+    // Copy the trampoline below 1MB
+    memcpy((void*)AP_TRAMPOLINE, ap_trampoline_start, ap_trampoline_end - ap_trampoline_start);
+    
+    for (unsigned int i = 0; i < madt->cpu_count && cpu_count < MAX_CPUS; i++) {
+        if (madt->apic_ids[i] == cpus[0].apic_id) {
+            continue;
+        }
+        
+        unsigned int id = cpu_count;
+        cpus[id].apic_id = madt->apic_ids[i];
+        if (start_ap(id)) {
+            // Published last: from here on the scheduler may use this CPU
+            cpu_count++;
+        } else {
+            print("SMP: CPU with APIC ID ");
+            print_dec(madt->apic_ids[i]);
+            print(" did not start\n");
+        }
+    }
+    
+    print("SMP: ");
+    print_dec(cpu_count);
+    print(" CPUs online\n");
+}
+
+initcall(smp_init, INITCALL_DEFERRED);
+
+// Forward the boot CPU's timer tick to the other CPUs that are running
+// something, so they can time-slice. Idle CPUs are left halted.
+void smp_tick_others() {
+    for (unsigned int i = 1; i < cpu_count; i++) {
+        if (sched_cpu_busy(i)) {
+            lapic_send_ipi(cpus[i].apic_id, IPI_TICK_VECTOR);
+        }
+    }
+}
@@ -0,0 +1,49 @@
+// smp.h
+
+#ifndef SMP_H
+#define SMP_H
+
+// Most CPUs brought up
+#define MAX_CPUS 8
+
+struct pcb;
+
+// Per-CPU data, reached through the GS segment of each CPU
+struct cpu {
+    struct cpu* self;           // Linear address of this struct (%gs:0)
+    unsigned int id;            // Index into cpus[]
+    unsigned int apic_id;       // Local APIC ID
+    struct pcb* current;        // Process running on this CPU
+    struct pcb* switched_from;  // Still on its stack until the switch completes
+    volatile int started;       // Set by an AP once it is up
+    int tick_stopped;           // Local APIC timer stopped while idle
+    unsigned int softirq_pending;   // Bottom halves raised on this CPU
+    int in_softirq;             // Running bottom halves, IRQs enabled
+    struct pcb* fpu_owner;      // Process whose state is in the FPU registers
+    int fpu_active;             // TS clear: current process used the FPU
+};
+
+extern struct cpu cpus[MAX_CPUS];
+extern unsigned int cpu_count;
+
+// This CPU's data. Only stable while preemption is impossible
+// (interrupts disabled), since a process may migrate between CPUs.
+static inline struct cpu* this_cpu() {
+    struct cpu* cpu;
+    asm volatile("mov %%gs:0, %0" : "=r"(cpu));
+    return cpu;
+}
+
+// Process running on this CPU, read in a single instruction so it is
+// correct even if the reader is preempted and migrated right after
+static inline struct pcb* this_cpu_current() {
+    struct pcb* p;
+    asm volatile("mov %%gs:%c1, %0" : "=r"(p) : "i"(__builtin_offsetof(struct cpu, current)));
+    return p;
+}
+
+// Functions
+void smp_init();
+void smp_tick_others();
+
+#endif
@@ -0,0 +1,135 @@
+// softirq.c
+
+#include "softirq.h"
+#include "cpu.h"
+#include "smp.h"
+#include "timer.h"
+#include "klib.h"
+
+// External functions from kernel
+extern void print(const char* str);
+extern void print_dec(unsigned int n);
+extern void print_padded(unsigned int n, unsigned int width);
+extern unsigned int cycles_to_ns(unsigned long long cycles, unsigned int khz);
+
+struct softirq {
+    softirq_fn handler;
+    const char* name;
+};
+
+struct softirq_counters {
+    unsigned int count;
+    unsigned int max_cycles;
+    unsigned long long total_cycles;
+};
+
+static struct softirq softirqs[SOFTIRQ_MAX];
+static struct softirq_counters counters[MAX_CPUS][SOFTIRQ_MAX];
+
+void softirq_register(unsigned int nr, softirq_fn handler, const char* name) {
+    if (nr < SOFTIRQ_MAX) {
+        softirqs[nr].name = name;
+        softirqs[nr].handler = handler;
+    }
+}
+
+// Mark a bottom half pending on this CPU. Called by top halves, with
+// interrupts disabled; it runs before the IRQ returns.
+void softirq_raise(unsigned int nr) {
+    this_cpu()->softirq_pending |= 1 << nr;
+}
+
+int softirq_pending() {
+    return this_cpu()->softirq_pending != 0;
+}
+
+// Run the pending bottom halves with interrupts enabled. Called and
+// returns with interrupts disabled; returns the cycles spent enabled.
+// IRQs nested in here neither run bottom halves nor switch processes,
+// so the CPU cannot change underneath.
+static unsigned long long run_pending(struct cpu* cpu) {
+    cpu->in_softirq = 1;
+    unsigned long long start = rdtsc();
+    
+    for (int round = 0; cpu->softirq_pending && round < SOFTIRQ_RESTARTS; round++) {
+        unsigned int pending = cpu->softirq_pending;
+        cpu->softirq_pending = 0;
+        asm volatile("sti");
+        
+        while (pending) {
+            unsigned int nr = __builtin_ctz(pending);
+            pending &= pending - 1;
+            
+            unsigned long long t = rdtsc();
+            if (softirqs[nr].handler) {
+                softirqs[nr].handler();
+            }
+            unsigned int cycles = rdtsc() - t;
+            
+            struct softirq_counters* c = &counters[cpu->id][nr];
+            c->count++;
+            c->total_cycles += cycles;
+            if (cycles > c->max_cycles) {
+                c->max_cycles = cycles;
+            }
+        }
+        
+        asm volatile("cli");
+    }
+    
+    cpu->in_softirq = 0;
+    return rdtsc() - start;
+}
+
+// Called by irq_handler() on the way out, with interrupts disabled.
+// Returns the cycles bottom halves ran with interrupts enabled.
+unsigned long long softirq_irq_exit() {
+    struct cpu* cpu = this_cpu();
+    if (!cpu->softirq_pending || cpu->in_softirq) {
+        return 0;
+    }
+    return run_pending(cpu);
+}
+
+// Catch up on bottom halves left over from busy IRQ exits. Called by
+// the idle loop.
+void softirq_run() {
+    unsigned int flags = irq_save();
+    struct cpu* cpu = this_cpu();
+    if (cpu->softirq_pending && !cpu->in_softirq) {
+        run_pending(cpu);
+    }
+    irq_restore(flags);
+}
+
+// Print bottom half counters, summed over CPUs
+void softirq_stats() {
+    unsigned int khz = timer_tsc_khz();
+    
+    print("SOFTIRQ       COUNT    AVG ns    MAX ns\n");
+    for (unsigned int nr = 0; nr < SOFTIRQ_MAX; nr++) {
+        if (!softirqs[nr].handler) {
+            continue;
+        }
+        
+        struct softirq_counters sum = {0, 0, 0};
+        for (unsigned int cpu = 0; cpu < cpu_count; cpu++) {
+            struct softirq_counters* c = &counters[cpu][nr];
+            sum.count += c->count;
+            sum.total_cycles += c->total_cycles;
+            if (c->max_cycles > sum.max_cycles) {
+                sum.max_cycles = c->max_cycles;
+            }
+        }
+        
+        print(softirqs[nr].name);
+        for (unsigned int len = strlen(softirqs[nr].name); len < 8; len++) {
+            print(" ");
+        }
+        print_padded(sum.count, 12);
+        unsigned long long avg = sum.count ? div64(sum.total_cycles, sum.count) : 0;
+        print_padded(cycles_to_ns(avg, khz), 10);
+        print_padded(cycles_to_ns(sum.max_cycles, khz), 10);
+        print("\n");
+    }
+}
@@ -0,0 +1,26 @@
+// softirq.h
+
+#ifndef SOFTIRQ_H
+#define SOFTIRQ_H
+
+// Bottom halves, run in this order when several are pending
+#define SOFTIRQ_TIMER       0   // Expire timers
+#define SOFTIRQ_KEYBOARD    1   // Translate queued scancodes
+#define SOFTIRQ_MAX         8
+
+// Rounds of newly raised work handled per IRQ exit; the rest waits for
+// the next IRQ exit or the idle loop
+#define SOFTIRQ_RESTARTS    4
+
+// Runs with interrupts enabled and must not block
+typedef void (*softirq_fn)();
+
+// Functions
+void softirq_register(unsigned int nr, softirq_fn handler, const char* name);
+void softirq_raise(unsigned int nr);
+int softirq_pending();
+unsigned long long softirq_irq_exit();
+void softirq_run();
+void softirq_stats();
+
+#endif
@@ -0,0 +1,60 @@
+// spinlock.h
+
+#ifndef SPINLOCK_H
+#define SPINLOCK_H
+
+#include "cpu.h"
+
+// Ticket spinlock: CPUs take a ticket and are served in FIFO order,
+// so no CPU can be starved under contention
+struct spinlock {
+    volatile unsigned short owner;  // Ticket being served
+    volatile unsigned short next;   // Next ticket to hand out
+};
+
+#define SPINLOCK_INIT { 0, 0 }
+
+static inline void spin_init(struct spinlock* lock) {
+    lock->owner = 0;
+    lock->next = 0;
+}
+
+static inline void spin_lock(struct spinlock* lock) {
+    unsigned short ticket = 1;
+    asm volatile("lock xaddw %0, %1" : "+r"(ticket), "+m"(lock->next) : : "memory");
+    while (lock->owner != ticket) {
+        cpu_relax();
+    }
+}
+
+// Take the lock only if nobody holds or waits for it. Returns 1 on success.
+static inline int spin_trylock(struct spinlock* lock) {
+    unsigned short owner = lock->owner;
+    unsigned int old = ((unsigned int)owner << 16) | owner;
+    unsigned int new = ((unsigned int)(unsigned short)(owner + 1) << 16) | owner;
+    unsigned int prev;
+    asm volatile("lock cmpxchgl %2, %1"
+                 : "=a"(prev), "+m"(*(volatile unsigned int*)lock)
+                 : "r"(new), "0"(old)
+                 : "memory");
+    return prev == old;
+}
+
+static inline void spin_unlock(struct spinlock* lock) {
+    asm volatile("" : : : "memory");
+    lock->owner++;
+}
+
+// Lock and disable interrupts on this CPU, returning the previous EFLAGS
+static inline unsigned int spin_lock_irqsave(struct spinlock* lock) {
+    unsigned int flags = irq_save();
+    spin_lock(lock);
+    return flags;
+}
+
+static inline void spin_unlock_irqrestore(struct spinlock* lock, unsigned int flags) {
+    spin_unlock(lock);
+    irq_restore(flags);
+}
+
+#endif
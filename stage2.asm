@@ -0,0 +1,622 @@
+; stage2.asm
+; Stage 2, loaded by boot.asm to STAGE2_ADDR with the boot drive in DL.
+; Reads the kernel image, whose size comes from its header, into a
+; bounce buffer below 1MB and copies it up to KERNEL_ADDR in unreal mode.
+; An LZ4-packed image (user/mklz4.c) is copied above the kernel's .bss
+; instead and unpacked from there.
+; Disk reads use the INT 13h extensions (LBA) when the BIOS has them and
+; fall back to CHS reads of a whole track at a time. Then the program
+; package, the E820 memory map, and on to the kernel in protected mode.
+[BITS 16]
+[ORG 0x1000]        ; STAGE2_ADDR
+
+; Disk layout and addresses, see boot.h
+STAGE2_SECTORS   equ 4
+KERNEL_LBA       equ 1 + STAGE2_SECTORS
+KERNEL_ADDR      equ 0x100000
+KERNEL_MAGIC     equ 0x4C4E524B ; "KRNL"
+KERNEL_HEADER    equ 4          ; Header offset in the image (kernel_entry.asm)
+LZ4_MAGIC        equ 0x345A4C4B ; "KLZ4", struct kernel_lz4_header
+LZ4_HEADER_SIZE  equ 16
+PROGRAMS_SECTORS equ 64
+PROGRAMS_ADDR    equ 0x40000
+
+; Reads land here, 64KB aligned so no read crosses a DMA boundary
+BOUNCE_SEG       equ 0x1000
+BOUNCE_ADDR      equ 0x10000
+BOUNCE_SECTORS   equ 127        ; Largest read every BIOS accepts
+READ_RETRIES     equ 3
+
+; struct boot_info (see boot.h)
+BOOT_INFO        equ 0x8000
+E820_MAX         equ 32
+INFO_DRIVE       equ BOOT_INFO + 4 + E820_MAX * 24
+INFO_METHOD      equ INFO_DRIVE + 4
+INFO_SECTORS     equ INFO_DRIVE + 8
+INFO_START_TSC   equ INFO_DRIVE + 12
+INFO_END_TSC     equ INFO_DRIVE + 20
+INFO_PACKED      equ INFO_DRIVE + 28
+INFO_UNPACK      equ INFO_DRIVE + 32
+INFO_STAGE1_TSC  equ INFO_DRIVE + 36
+INFO_PMODE_TSC   equ INFO_DRIVE + 44
+
+LOAD_CHS         equ 0          ; BOOT_LOAD_CHS
+LOAD_EDD         equ 1          ; BOOT_LOAD_EDD
+
+stage2:
+    ; boot.asm left DS = ES = SS = 0 and the stack below 0x7C00
+    mov [drive], dl
+    mov si, stage2_msg
+    call print_string_16
+
+    rdtsc
+    mov [INFO_START_TSC], eax
+    mov [INFO_START_TSC + 4], edx
+
+    call enable_a20
+    call detect_disk
+
+    ; The first sector holds the header: how much to load, and where
+    ; the .bss that follows the image ends
+    mov eax, KERNEL_LBA
+    mov cx, 1
+    call read_sectors
+    jc disk_error
+    mov ax, BOUNCE_SEG
+    mov fs, ax
+    cmp dword [fs:0], LZ4_MAGIC
+    je .packed
+    cmp dword [fs:KERNEL_HEADER], KERNEL_MAGIC
+    jne bad_kernel
+    mov eax, [fs:KERNEL_HEADER + 4]
+    mov [image_end], eax
+    mov eax, [fs:KERNEL_HEADER + 8]
+    mov [bss_end], eax
+    mov eax, [image_end]
+    sub eax, KERNEL_ADDR - 511
+    mov dword [dest], KERNEL_ADDR
+    jmp .read
+
+    ; Packed: the header, then the LZ4 block. Read to the first page
+    ; past the .bss, out of the way of the unpacked image.
+.packed:
+    mov eax, [fs:8]
+    mov [image_end], eax
+    mov eax, [fs:12]
+    mov [bss_end], eax
+    add eax, 0xFFF
+    and eax, ~0xFFF
+    mov [dest], eax
+    mov [packed], eax
+    mov eax, [fs:4]
+    mov [packed_size], eax
+    add eax, LZ4_HEADER_SIZE + 511
+
+.read:
+    shr eax, 9
+    mov [kernel_sectors], eax
+    mov dword [lba], KERNEL_LBA
+    mov ecx, eax
+    call load
+    jc disk_error
+
+    mov dword [INFO_PACKED], 0
+    mov dword [INFO_UNPACK], 0
+    mov esi, [packed]
+    test esi, esi
+    jz .clear_bss
+    rdtsc
+    push eax
+    add esi, LZ4_HEADER_SIZE
+    mov ebp, esi
+    add ebp, [packed_size]
+    mov edi, KERNEL_ADDR
+    call lz4_unpack
+    cmp edi, [image_end]
+    jne bad_kernel          ; Corrupt data, or not this kernel's image
+    rdtsc
+    pop ecx
+    sub eax, ecx
+    mov [INFO_UNPACK], eax
+    mov dword [INFO_PACKED], 1
+
+    ; Clear the .bss, which is not part of the image. Interrupts stay off
+    ; for the same reason as in lz4_unpack.
+.clear_bss:
+    call enter_unreal
+    mov edi, [image_end]
+    mov ecx, [bss_end]
+    sub ecx, edi
+    xor al, al
+    cld
+    cli
+    a32 rep stosb
+    sti
+
+    ; The program package follows the kernel. Read errors are ignored:
+    ; the kernel then finds no package magic.
+    mov edi, PROGRAMS_ADDR
+    mov dword [edi], 0
+    mov eax, [kernel_sectors]
+    add eax, KERNEL_LBA
+    mov [lba], eax
+    mov dword [dest], PROGRAMS_ADDR
+    mov ecx, PROGRAMS_SECTORS
+    call load
+
+    rdtsc
+    mov [INFO_END_TSC], eax
+    mov [INFO_END_TSC + 4], edx
+
+    ; Ask the BIOS for the memory map (real mode only)
+    call detect_memory_16
+
+    movzx eax, byte [drive]
+    mov [INFO_DRIVE], eax
+    movzx eax, byte [method]
+    mov [INFO_METHOD], eax
+    mov eax, [kernel_sectors]
+    mov [INFO_SECTORS], eax
+
+    mov si, kernel_loaded_msg
+    call print_string_16
+
+    rdtsc
+    mov [INFO_PMODE_TSC], eax
+    mov [INFO_PMODE_TSC + 4], edx
+
+    ; Switch to protected mode
+    cli
+    lgdt [gdt_descriptor]
+    mov eax, cr0
+    or eax, 1       ; Set PE (Protection Enable) bit
+    mov cr0, eax
+
+    ; Far jump to flush CPU pipeline and enter 32-bit code
+    jmp CODE_SEG:init_32bit
+
+; 16-bit functions
+print_string_16:
+    pusha
+.loop:
+    lodsb
+    or al, al
+    jz .done
+    mov ah, 0x0E
+    mov bh, 0x00
+    mov bl, 0x07
+    int 0x10
+    jmp .loop
+.done:
+    popa
+    ret
+
+; Open the A20 gate, through the BIOS and then the fast A20 port
+enable_a20:
+    mov ax, 0x2401
+    int 0x15
+    in al, 0x92
+    test al, 2
+    jnz .done
+    or al, 2
+    and al, 0xFE        ; Bit 0 would reset the machine
+    out 0x92, al
+.done:
+    ret
+
+; Use the INT 13h extensions if the BIOS has them for this drive, else
+; CHS with the drive's geometry (a 1.44MB floppy's if it will not say)
+detect_disk:
+    mov byte [method], LOAD_CHS
+    mov ah, 0x41
+    mov bx, 0x55AA
+    mov dl, [drive]
+    int 0x13
+    jc .chs
+    cmp bx, 0xAA55
+    jne .chs
+    test cl, 1          ; Fixed disk access subset: AH=42h
+    jz .chs
+    mov byte [method], LOAD_EDD
+    ret
+.chs:
+    mov ah, 0x08
+    mov dl, [drive]
+    xor di, di
+    push es             ; Floppies return a parameter table in ES:DI
+    int 0x13
+    pop es
+    jc .done
+    and cx, 0x3F
+    jz .done
+    mov [spt], cx
+    movzx dx, dh
+    inc dx
+    mov [heads], dx
+.done:
+    ret
+
+reset_disk:
+    pusha
+    xor ax, ax
+    mov dl, [drive]
+    int 0x13
+    popa
+    ret
+
+; Read CX sectors (at most BOUNCE_SECTORS) from LBA EAX into the bounce
+; buffer. CF set on error, with the BIOS status in [status].
+read_sectors:
+    pushad
+    mov di, READ_RETRIES
+    cmp byte [method], LOAD_EDD
+    jne .chs
+
+    mov [dap_lba], eax
+.edd_retry:
+    mov [dap_count], cx     ; A failed read leaves what it managed here
+    mov si, dap
+    mov ah, 0x42
+    mov dl, [drive]
+    int 0x13
+    jnc .ok
+    mov [status], ah
+    call reset_disk
+    dec di
+    jnz .edd_retry
+    jmp .fail
+
+    ; One read per track: from the first sector wanted to the end of its
+    ; track, or fewer if that is all that is left
+.chs:
+    mov [chs_lba], eax
+    mov [chs_left], cl
+    xor bx, bx          ; Offset in the bounce buffer
+.track:
+    mov eax, [chs_lba]
+    xor edx, edx
+    movzx ecx, word [spt]
+    div ecx             ; EDX = sector index in the track
+    mov [chs_sector], dl
+
+    mov al, [spt]
+    sub al, dl
+    cmp al, [chs_left]
+    jbe .count
+    mov al, [chs_left]
+.count:
+    mov [chs_count], al
+
+.retry:
+    ; Cylinder bits 0-7 in CH, bits 8-9 in CL bits 6-7 above the sector
+    mov eax, [chs_lba]
+    xor edx, edx
+    movzx ecx, word [spt]
+    div ecx
+    xor edx, edx
+    movzx ecx, word [heads]
+    div ecx             ; EAX = cylinder, EDX = head
+    mov ch, al
+    shl ah, 6
+    mov cl, [chs_sector]
+    inc cl
+    or cl, ah
+    mov dh, dl
+    mov dl, [drive]
+    mov ah, 0x02
+    mov al, [chs_count]
+    push es
+    push word BOUNCE_SEG
+    pop es
+    int 0x13
+    pop es
+    jnc .next_track
+    mov [status], ah
+    call reset_disk
+    dec di
+    jnz .retry
+    jmp .fail
+
+.next_track:
+    mov di, READ_RETRIES
+    movzx eax, byte [chs_count]
+    add [chs_lba], eax
+    sub [chs_left], al
+    shl ax, 9
+    add bx, ax
+    cmp byte [chs_left], 0
+    jne .track
+
+.ok:
+    popad
+    clc
+    ret
+.fail:
+    popad
+    stc
+    ret
+
+; Copy CX sectors from the bounce buffer to linear address [dest], which
+; moves past them. Interrupts are off during the copy, as in lz4_unpack.
+copy_bounce:
+    pushad
+    call enter_unreal
+    movzx ecx, cx
+    shl ecx, 7          ; Dwords
+    mov esi, BOUNCE_ADDR
+    mov edi, [dest]
+    cld
+    cli
+    a32 rep movsd
+    sti
+    mov [dest], edi
+    popad
+    ret
+
+; Load ECX sectors from LBA [lba] to linear address [dest], in bounce
+; buffer sized reads. CF set on a read error.
+load:
+    test ecx, ecx
+    jz .done
+    push ecx
+    cmp ecx, BOUNCE_SECTORS
+    jbe .chunk
+    mov ecx, BOUNCE_SECTORS
+.chunk:
+    mov eax, [lba]
+    call read_sectors
+    jc .failed
+    call copy_bounce
+    add [lba], ecx
+    pop eax
+    sub eax, ecx
+    mov ecx, eax
+    jmp load
+.failed:
+    pop ecx
+    stc
+    ret
+.done:
+    clc
+    ret
+
+; Expand the LZ4 block from ESI up to EBP to EDI, which is left at the
+; end of the output. Each sequence is a token (literal count, match
+; length), literals, then a 16-bit distance back into the output; the
+; last has only literals. Interrupts stay off so no BIOS handler can
+; clobber the upper halves of the 32-bit registers.
+lz4_unpack:
+    call enter_unreal
+    cli
+    cld
+.sequence:
+    xor eax, eax
+    a32 lodsb
+    mov ebx, eax            ; Token
+    shr al, 4
+    call .length
+    mov ecx, eax
+    a32 rep movsb           ; Literals
+    cmp esi, ebp
+    jae .done
+
+    xor eax, eax
+    a32 lodsw
+    mov edx, eax            ; Distance
+    mov eax, ebx
+    and al, 0x0F
+    call .length
+    lea ecx, [eax + 4]      ; Matches are at least 4 bytes
+    push esi
+    mov esi, edi
+    sub esi, edx
+    a32 rep movsb           ; Byte by byte, so overlapping matches repeat
+    pop esi
+    jmp .sequence
+.done:
+    sti
+    ret
+
+; EAX = 4-bit length from the token; 15 means bytes follow that add to
+; it, up to one below 255
+.length:
+    cmp al, 15
+    jne .length_done
+.more:
+    movzx ecx, byte [esi]
+    inc esi
+    add eax, ecx
+    cmp cl, 255
+    je .more
+.length_done:
+    ret
+
+; Give DS and ES 4GB limits and return to real mode. The CPU keeps the
+; cached limits, so 32-bit addresses reach above 1MB ("unreal mode").
+; Redone before every copy, in case the BIOS reloaded the segments.
+enter_unreal:
+    pushf
+    cli
+    push ds
+    push es
+    lgdt [gdt_descriptor]
+    mov eax, cr0
+    or al, 1
+    mov cr0, eax
+    jmp $+2
+    mov bx, DATA_SEG
+    mov ds, bx
+    mov es, bx
+    and al, 0xFE
+    mov cr0, eax
+    pop es
+    pop ds
+    popf
+    ret
+
+; Collect the E820 memory map into BOOT_INFO
+; Layout: dword count, then 24-byte entries
+detect_memory_16:
+    pushad
+    mov dword [BOOT_INFO], 0
+    mov di, BOOT_INFO + 4   ; ES:DI -> first entry (ES = 0)
+    xor ebx, ebx            ; Continuation value, 0 = start
+    xor bp, bp              ; Entry count
+.next:
+    mov eax, 0xE820
+    mov ecx, 24
+    mov edx, 0x534D4150     ; 'SMAP'
+    mov dword [di + 20], 1  ; Mark valid in case the BIOS returns 20 bytes
+    int 0x15
+    jc .done                ; Unsupported, or past the last entry
+    cmp eax, 0x534D4150
+    jne .done
+    mov ecx, [di + 8]       ; Skip zero length entries
+    or ecx, [di + 12]
+    jz .skip
+    inc bp
+    add di, 24
+.skip:
+    test ebx, ebx           ; 0 means this was the last entry
+    jz .done
+    cmp bp, E820_MAX
+    jb .next
+.done:
+    mov [BOOT_INFO], bp
+    popad
+    ret
+
+bad_kernel:
+    mov si, bad_kernel_msg
+    call print_string_16
+    jmp $
+
+; Show the BIOS status of the failed read and stop
+disk_error:
+    mov si, disk_error_msg
+    call print_string_16
+    mov al, [status]
+    shr al, 4
+    call print_hex_digit
+    mov al, [status]
+    call print_hex_digit
+    jmp $
+
+; Print a single hex digit
+print_hex_digit:
+    and al, 0x0F
+    add al, '0'
+    cmp al, '9'
+    jle .print
+    add al, 7
+.print:
+    mov ah, 0x0E
+    int 0x10
+    ret
+
+; GDT (Global Descriptor Table)
+gdt_start:
+    ; Null descriptor (required)
+    dd 0x0
+    dd 0x0
+
+gdt_code:
+    ; Code segment descriptor
+    dw 0xFFFF       ; Limit (0-15)
+    dw 0x0          ; Base (0-15)
+    db 0x0          ; Base (16-23)
+    db 10011010b    ; Access byte: present, ring 0, code segment, executable, readable
+    db 11001111b    ; Flags (4 bits) + Limit (16-19): 4KB pages, 32-bit mode
+    db 0x0          ; Base (24-31)
+
+gdt_data:
+    ; Data segment descriptor
+    dw 0xFFFF       ; Limit (0-15)
+    dw 0x0          ; Base (0-15)
+    db 0x0          ; Base (16-23)
+    db 10010010b    ; Access byte: present, ring 0, data segment, writable
+    db 11001111b    ; Flags (4 bits) + Limit (16-19): 4KB pages, 32-bit mode
+    db 0x0          ; Base (24-31)
+
+gdt_end:
+
+gdt_descriptor:
+    dw gdt_end - gdt_start - 1  ; Size of GDT
+    dd gdt_start                ; Start address of GDT
+
+; Segment selectors
+CODE_SEG equ gdt_code - gdt_start
+DATA_SEG equ gdt_data - gdt_start
+
+; 32-bit code section
+[BITS 32]
+init_32bit:
+    ; Set up segments for 32-bit mode
+    mov ax, DATA_SEG
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
+    mov ss, ax
+    mov esp, 0x90000    ; Set stack pointer to a safe location
+
+    ; Print message in protected mode
+    mov esi, protected_mode_msg
+    call print_string_32
+
+    ; Jump to the kernel loaded at KERNEL_ADDR
+    ; EBX carries the boot info pointer to kernel_main
+    mov ebx, BOOT_INFO
+    jmp KERNEL_ADDR
+
+; 32-bit print function (prints at current position)
+print_string_32:
+    pusha
+    mov edi, 0xB8000 + (80 * 2 * 3)   ; Start at line 4 (after real mode messages)
+.loop:
+    lodsb               ; Load byte from [ESI] into AL
+    or al, al           ; Check for null terminator
+    jz .done
+    mov ah, 0x07        ; White on black attribute
+    stosw               ; Store character + attribute to [EDI]
+    jmp .loop
+.done:
+    popa
+    ret
+
+; Data
+drive db 0
+method db LOAD_CHS
+status db 0
+spt dw 18               ; CHS geometry, for LOAD_CHS
+heads dw 2
+lba dd 0
+dest dd 0
+kernel_sectors dd 0
+image_end dd 0
+bss_end dd 0
+packed dd 0             ; Where the packed image was read, 0 if plain
+packed_size dd 0
+chs_lba dd 0
+chs_left db 0
+chs_sector db 0
+chs_count db 0
+
+; INT 13h AH=42h disk address packet
+align 4
+dap:
+    db 16, 0
+dap_count:
+    dw 0
+    dw 0, BOUNCE_SEG    ; Buffer offset, segment
+dap_lba:
+    dd 0, 0
+
+stage2_msg db 'Stage 2 loading kernel...', 0x0D, 0x0A, 0
+kernel_loaded_msg db 'Kernel loaded from disk!', 0x0D, 0x0A, 0
+bad_kernel_msg db 'Bad kernel image!', 0
+disk_error_msg db 'Disk read error! Code: ', 0
+protected_mode_msg db 'Successfully entered 32-bit Protected Mode!', 0
+
+; Fill the STAGE2_SECTORS; fails to assemble if stage 2 outgrows them
+times STAGE2_SECTORS * 512 - ($ - $$) db 0
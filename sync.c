@@ -0,0 +1,95 @@
+// sync.c
+
+#include "sync.h"
+
+// External function from kernel
+extern void print(const char* str);
+
+void sem_init(struct semaphore* sem, int count) {
+    sem->count = count;
+    waitq_init(&sem->waiters);
+}
+
+// Take one unit, sleeping until one is available
+void sem_down(struct semaphore* sem) {
+    unsigned int flags = spin_lock_irqsave(&sem->waiters.lock);
+    
+    if (sem->count > 0) {
+        sem->count--;
+    } else {
+        // sem_up hands its unit straight to us, so there is nothing
+        // to retake after waking
+        waitq_sleep(&sem->waiters);
+    }
+    
+    spin_unlock_irqrestore(&sem->waiters.lock, flags);
+}
+
+// Take one unit if available. Returns 1 on success.
+int sem_trydown(struct semaphore* sem) {
+    unsigned int flags = spin_lock_irqsave(&sem->waiters.lock);
+    int taken = sem->count > 0;
+    if (taken) {
+        sem->count--;
+    }
+    spin_unlock_irqrestore(&sem->waiters.lock, flags);
+    return taken;
+}
+
+// Release one unit, giving it to the longest waiter if there is one
+void sem_up(struct semaphore* sem) {
+    unsigned int flags = spin_lock_irqsave(&sem->waiters.lock);
+    
+    if (!waitq_wake_one(&sem->waiters)) {
+        sem->count++;
+    }
+    
+    spin_unlock_irqrestore(&sem->waiters.lock, flags);
+}
+
+void mutex_init(struct mutex* m) {
+    m->owner = 0;
+    waitq_init(&m->waiters);
+}
+
+// Acquire the mutex, sleeping while another process holds it
+void mutex_lock(struct mutex* m) {
+    unsigned int flags = spin_lock_irqsave(&m->waiters.lock);
+    
+    if (m->owner == current_process) {
+        print("mutex_lock: already held by caller\n");
+    } else if (!m->owner) {
+        m->owner = current_process;
+    } else {
+        // mutex_unlock makes us the owner before waking us
+        waitq_sleep(&m->waiters);
+    }
+    
+    spin_unlock_irqrestore(&m->waiters.lock, flags);
+}
+
+// Acquire the mutex if it is free. Returns 1 on success.
+int mutex_trylock(struct mutex* m) {
+    unsigned int flags = spin_lock_irqsave(&m->waiters.lock);
+    int taken = !m->owner;
+    if (taken) {
+        m->owner = current_process;
+    }
+    spin_unlock_irqrestore(&m->waiters.lock, flags);
+    return taken;
+}
+
+// Release the mutex, handing it directly to the longest waiter so a
+// running process cannot barge in ahead of it
+void mutex_unlock(struct mutex* m) {
+    unsigned int flags = spin_lock_irqsave(&m->waiters.lock);
+    
+    if (m->owner != current_process) {
+        print("mutex_unlock: not the owner\n");
+    } else {
+        m->owner = m->waiters.head;
+        waitq_wake_one(&m->waiters);
+    }
+    
+    spin_unlock_irqrestore(&m->waiters.lock, flags);
+}
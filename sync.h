@@ -0,0 +1,33 @@
+// sync.h
+
+#ifndef SYNC_H
+#define SYNC_H
+
+#include "wait.h"
+
+// Counting semaphore
+struct semaphore {
+    int count;
+    struct wait_queue waiters;
+};
+
+// Sleeping mutex. Not recursive; only the owner may unlock it.
+// The wait queue lock protects the owner field.
+struct mutex {
+    struct pcb* owner;
+    struct wait_queue waiters;
+};
+
+// Semaphores (sem_up may be called from interrupt handlers)
+void sem_init(struct semaphore* sem, int count);
+void sem_down(struct semaphore* sem);
+int sem_trydown(struct semaphore* sem);
+void sem_up(struct semaphore* sem);
+
+// Mutexes (process context only)
+void mutex_init(struct mutex* m);
+void mutex_lock(struct mutex* m);
+int mutex_trylock(struct mutex* m);
+void mutex_unlock(struct mutex* m);
+
+#endif
@@ -0,0 +1,310 @@
+// syscall.c
+
+#include "syscall.h"
+#include "idt.h"
+#include "gdt.h"
+#include "paging.h"
+#include "memory.h"
+#include "process.h"
+#include "keyboard.h"
+#include "timer.h"
+#include "fs.h"
+#include "cpu.h"
+#include "smp.h"
+#include "klib.h"
+#include "ipc.h"
+
+// SYSENTER model-specific registers
+#define IA32_SYSENTER_CS    0x174
+#define IA32_SYSENTER_ESP   0x175
+#define IA32_SYSENTER_EIP   0x176
+
+// External functions from kernel
+extern void print(const char* str);
+extern void putchar(char c);
+
+// Entry points in interrupt.asm
+extern void sysenter_entry();
+
+// vsyscall page variants in vsyscall.asm
+extern char vsyscall_int80_start[];
+extern char vsyscall_int80_end[];
+extern char vsyscall_sysenter_start[];
+extern char vsyscall_sysenter_return[];
+extern char vsyscall_sysenter_end[];
+
+// Ring 3 benchmark program in userbench.asm
+extern char userbench_start[];
+extern char userbench_end[];
+
+// Where SYSEXIT resumes ring 3, read by sysenter_entry
+unsigned int sysenter_return = 0;
+
+// SYSENTER is used, the vsyscall page holds its variant
+static int sysenter_ok = 0;
+
+// Whether [addr, addr + len) lies in the user part of the address space.
+// The kernel identity map and the vsyscall page are off limits; unmapped
+// pages fault and kill the process.
+static int user_range(unsigned int addr, unsigned int len) {
+    return addr >= KERNEL_SPACE_END && addr + len >= addr && addr + len <= VSYSCALL_ADDR;
+}
+
+// Copy a file name from user memory. Returns 0 on success.
+static int copy_name(char* name, unsigned int addr) {
+    for (unsigned int i = 0; i < MAX_FILENAME_LENGTH; i++) {
+        if (!user_range(addr + i, 1)) {
+            return -1;
+        }
+        name[i] = ((const char*)addr)[i];
+        if (name[i] == '\0') {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static int sys_exit(unsigned int a, unsigned int b, unsigned int c) {
+    (void)a; (void)b; (void)c;
+    process_exit();
+    return 0;
+}
+
+// Characters are read one at a time, outside the console lock, so a bad
+// buffer faults with no lock held
+static int sys_write(unsigned int buf, unsigned int len, unsigned int c) {
+    (void)c;
+    if (!user_range(buf, len)) {
+        return -1;
+    }
+    for (unsigned int i = 0; i < len; i++) {
+        putchar(((const char*)buf)[i]);
+    }
+    return len;
+}
+
+static int sys_read(unsigned int buf, unsigned int len, unsigned int c) {
+    (void)c;
+    if (!user_range(buf, len)) {
+        return -1;
+    }
+    unsigned int n = 0;
+    while (n < len && (n == 0 || keyboard_has_char())) {
+        ((char*)buf)[n++] = keyboard_read();
+    }
+    return n;
+}
+
+static int sys_getpid(unsigned int a, unsigned int b, unsigned int c) {
+    (void)a; (void)b; (void)c;
+    return current_process->pid;
+}
+
+static int sys_yield(unsigned int a, unsigned int b, unsigned int c) {
+    (void)a; (void)b; (void)c;
+    process_yield();
+    return 0;
+}
+
+static int sys_sleep(unsigned int ms, unsigned int b, unsigned int c) {
+    (void)b; (void)c;
+    ksleep(ms);
+    return 0;
+}
+
+static int sys_sbrk(unsigned int increment, unsigned int b, unsigned int c) {
+    (void)b; (void)c;
+    return (int)process_sbrk((int)increment);
+}
+
+static int sys_create(unsigned int name_addr, unsigned int b, unsigned int c) {
+    (void)b; (void)c;
+    char name[MAX_FILENAME_LENGTH];
+    if (copy_name(name, name_addr) != 0) {
+        return -1;
+    }
+    return fs_create_file(name);
+}
+
+static int sys_delete(unsigned int name_addr, unsigned int b, unsigned int c) {
+    (void)b; (void)c;
+    char name[MAX_FILENAME_LENGTH];
+    if (copy_name(name, name_addr) != 0) {
+        return -1;
+    }
+    return fs_delete_file(name);
+}
+
+// File data goes through a kernel buffer: the file system must not
+// fault on a user page halfway through
+static int sys_fread(unsigned int name_addr, unsigned int buf, unsigned int size) {
+    char name[MAX_FILENAME_LENGTH];
+    unsigned char data[FILE_SIZE];
+    if (copy_name(name, name_addr) != 0 || !user_range(buf, size)) {
+        return -1;
+    }
+    
+    int n = fs_read_file(name, data, size < FILE_SIZE ? size : FILE_SIZE);
+    if (n > 0) {
+        memcpy((void*)buf, data, n);
+    }
+    return n;
+}
+
+static int sys_fwrite(unsigned int name_addr, unsigned int buf, unsigned int size) {
+    char name[MAX_FILENAME_LENGTH];
+    unsigned char data[FILE_SIZE];
+    if (copy_name(name, name_addr) != 0 || !user_range(buf, size)) {
+        return -1;
+    }
+    
+    if (size > FILE_SIZE) {
+        size = FILE_SIZE;
+    }
+    memcpy(data, (const void*)buf, size);
+    return fs_write_file(name, data, size);
+}
+
+static int sys_list(unsigned int a, unsigned int b, unsigned int c) {
+    (void)a; (void)b; (void)c;
+    fs_list_files();
+    return 0;
+}
+
+static int sys_time(unsigned int a, unsigned int b, unsigned int c) {
+    (void)a; (void)b; (void)c;
+    return timer_ms();
+}
+
+static int sys_memused(unsigned int a, unsigned int b, unsigned int c) {
+    (void)a; (void)b; (void)c;
+    return frame_used_count() * (PAGE_SIZE / 1024);
+}
+
+static int sys_port(unsigned int a, unsigned int b, unsigned int c) {
+    (void)a; (void)b; (void)c;
+    return ipc_port_create();
+}
+
+static int sys_recv(unsigned int port, unsigned int buf, unsigned int c) {
+    (void)c;
+    struct ipc_msg msg;
+    if (!user_range(buf, sizeof(msg)) || ipc_receive(port, &msg) != 0) {
+        return -1;
+    }
+    memcpy((void*)buf, &msg, sizeof(msg));
+    return 0;
+}
+
+static int sys_reply(unsigned int port, unsigned int pid, unsigned int value) {
+    return ipc_reply(port, pid, value);
+}
+
+// SYS_FORK needs the whole frame, see syscall_handler()
+static int (*const syscall_table[SYS_COUNT])(unsigned int, unsigned int, unsigned int) = {
+    [SYS_EXIT] = sys_exit,
+    [SYS_WRITE] = sys_write,
+    [SYS_READ] = sys_read,
+    [SYS_GETPID] = sys_getpid,
+    [SYS_YIELD] = sys_yield,
+    [SYS_SLEEP] = sys_sleep,
+    [SYS_SBRK] = sys_sbrk,
+    [SYS_CREATE] = sys_create,
+    [SYS_DELETE] = sys_delete,
+    [SYS_FREAD] = sys_fread,
+    [SYS_FWRITE] = sys_fwrite,
+    [SYS_LIST] = sys_list,
+    [SYS_TIME] = sys_time,
+    [SYS_MEMUSED] = sys_memused,
+    [SYS_PORT] = sys_port,
+    [SYS_SEND] = ipc_send,
+    [SYS_POST] = ipc_post,
+    [SYS_SENDPAGES] = ipc_send_pages,
+    [SYS_RECV] = sys_recv,
+    [SYS_REPLY] = sys_reply,
+};
+
+// Called from int 0x80 and SYSENTER with the same frame, interrupts
+// enabled. The result goes back in eax.
+void syscall_handler(struct registers* regs) {
+    if (regs->eax >= SYS_COUNT) {
+        regs->eax = -1;
+        return;
+    }
+    if (regs->eax == SYS_FORK) {
+        regs->eax = process_fork(regs);
+        return;
+    }
+    regs->eax = syscall_table[regs->eax](regs->ebx, regs->ecx, regs->edx);
+}
+
+// Point this CPU's SYSENTER at sysenter_entry, with the stack pointer
+// at its TSS esp0 field
+void syscall_init_cpu() {
+    if (!sysenter_ok) {
+        return;
+    }
+    wrmsr(IA32_SYSENTER_CS, KERNEL_CS);
+    wrmsr(IA32_SYSENTER_ESP, gdt_kernel_stack_slot(this_cpu()->id));
+    wrmsr(IA32_SYSENTER_EIP, (unsigned int)sysenter_entry);
+}
+
+// Fill in the vsyscall page. Page directories created afterwards share
+// it, so this runs before the first process.
+void syscall_init() {
+    unsigned int directory = paging_kernel_directory();
+    if (!directory) {
+        print("System calls: no paging, ring 3 unavailable\n");
+        return;
+    }
+    
+    // Early Pentium Pros report SEP without implementing it
+    unsigned int eax, ebx, ecx, edx;
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    unsigned int family = (eax >> 8) & 0xF;
+    unsigned int model = (eax >> 4) & 0xF;
+    unsigned int stepping = eax & 0xF;
+    sysenter_ok = (edx & CPUID_SEP) && !(family == 6 && model < 3 && stepping < 3);
+    
+    void* page = frame_alloc();
+    if (!page) {
+        print("System calls: no memory for the vsyscall page\n");
+        return;
+    }
+    memset(page, 0, PAGE_SIZE);
+    
+    if (sysenter_ok) {
+        memcpy(page, vsyscall_sysenter_start, vsyscall_sysenter_end - vsyscall_sysenter_start);
+        sysenter_return = VSYSCALL_ADDR + (vsyscall_sysenter_return - vsyscall_sysenter_start);
+    } else {
+        memcpy(page, vsyscall_int80_start, vsyscall_int80_end - vsyscall_int80_start);
+    }
+    
+    // Read-only for ring 3
+    if (paging_map_page(directory, VSYSCALL_ADDR, (unsigned int)page, PAGE_USER) != 0) {
+        frame_free(page);
+        print("System calls: no memory for the vsyscall page\n");
+        return;
+    }
+    syscall_init_cpu();
+    
+    print(sysenter_ok ? "System calls: int 0x80, SYSENTER through the vsyscall page\n"
+                      : "System calls: int 0x80 (no SYSENTER)\n");
+}
+
+// 'syscallbench': time system call round trips from ring 3, through
+// int 0x80 and through the vsyscall page
+void syscall_bench() {
+    print(sysenter_ok ? "vsyscall page uses SYSENTER\n" : "vsyscall page uses int 0x80\n");
+    
+    int pid = process_create_user("syscallbench", userbench_start,
+                                  userbench_end - userbench_start);
+    if (pid < 0) {
+        return;
+    }
+    
+    // Wait for its report before the shell prompt comes back
+    while (process_alive(pid)) {
+        ksleep(10);
+    }
+}
@@ -0,0 +1,54 @@
+// syscall.h
+
+#ifndef SYSCALL_H
+#define SYSCALL_H
+
+// System call numbers. Ring 3 passes the number in eax and up to three
+// arguments in ebx, ecx and edx, through int 0x80 or by calling the
+// vsyscall page. The result comes back in eax, negative on failure.
+#define SYS_EXIT    0
+#define SYS_WRITE   1   // (buf, len): print to the console
+#define SYS_READ    2   // (buf, len): keyboard input, blocks for the first key
+#define SYS_GETPID  3
+#define SYS_YIELD   4
+#define SYS_SLEEP   5   // (ms)
+#define SYS_SBRK    6   // (increment): returns the old break
+#define SYS_CREATE  7   // (name)
+#define SYS_DELETE  8   // (name)
+#define SYS_FREAD   9   // (name, buf, size): returns bytes read
+#define SYS_FWRITE  10  // (name, buf, size)
+#define SYS_LIST    11
+#define SYS_TIME    12  // Milliseconds since boot
+#define SYS_FORK    13  // Returns the child's PID, 0 in the child
+#define SYS_MEMUSED 14  // KB of physical memory in use
+#define SYS_PORT    15  // Create a message port, returns its number
+#define SYS_SEND    16  // (port, word0, word1): blocks until the reply, returns it
+#define SYS_POST    17  // (port, word0, word1): queue without waiting
+#define SYS_SENDPAGES 18    // (port, addr, pages | IPC_SHARE): like SYS_SEND
+#define SYS_RECV    19  // (port, msg): blocks for the next message
+#define SYS_REPLY   20  // (port, pid, value): unblock a SYS_SEND sender
+#define SYS_COUNT   21
+
+// SYS_SENDPAGES moves pages out of the sender's address space, or with
+// IPC_SHARE leaves them mapped copy-on-write on both sides
+#define IPC_SHARE   0x80000000
+
+// Message filled in by SYS_RECV. Pages arrive at the receiver's break,
+// which moves past them.
+struct ipc_msg {
+    unsigned int sender;        // PID of the sender
+    unsigned int waiting;       // Sender blocks until SYS_REPLY
+    unsigned int word[2];
+    unsigned int page;          // Address of the pages received, if any
+    unsigned int pages;
+};
+
+struct registers;
+
+// Functions
+void syscall_init();
+void syscall_init_cpu();
+void syscall_handler(struct registers* regs);
+void syscall_bench();
+
+#endif
@@ -0,0 +1,586 @@
+// timer.c
+
+#include "timer.h"
+#include "idt.h"
+#include "process.h"
+#include "sched.h"
+#include "cpu.h"
+#include "smp.h"
+#include "spinlock.h"
+#include "lapic.h"
+#include "irq.h"
+#include "softirq.h"
+
+// External functions from kernel
+extern void print(const char* str);
+extern void print_dec(unsigned int n);
+
+// PIT (8253/8254) ports and input clock
+#define PIT_CHANNEL0    0x40
+#define PIT_COMMAND     0x43
+#define PIT_FREQUENCY   1193182
+
+// Channel 0, lobyte/hibyte access
+#define PIT_MODE_ONESHOT    0x30    // Mode 0: interrupt on terminal count
+#define PIT_MODE_PERIODIC   0x34    // Mode 2: rate generator
+#define PIT_LATCH           0x00
+
+// Longest one-shot the 16-bit counter allows (about 55ms)
+#define PIT_MAX_COUNT   0xFFFF
+
+#define PIT_DIVISOR     (PIT_FREQUENCY / TIMER_HZ)
+
+// Ticks of the PIT used to calibrate the local APIC timer (50ms)
+#define CALIBRATE_TICKS (TIMER_HZ / 20)
+
+// A device that can tick periodically or fire once, counting down
+struct tick_source {
+    const char* name;
+    unsigned int divisor;       // Counts per tick
+    unsigned int max_count;     // Longest one-shot
+    void (*periodic)();
+    void (*oneshot)(unsigned int count);
+    unsigned int (*remaining)();    // Counts left of the one-shot
+};
+
+// Ticks since boot, counted by the boot CPU
+static volatile unsigned int ticks = 0;
+
+// Tickless idle state of the boot CPU
+static volatile int oneshot_armed = 0;
+static unsigned int oneshot_count = 0;
+static unsigned int count_remainder = 0;   // Counts not yet worth a tick
+static unsigned int idle_entries = 0;
+static unsigned int idle_ticks = 0;
+
+// TSC at timer_init, for calibrating the TSC against the tick
+static unsigned long long tsc_boot = 0;
+
+// Timing wheel: 256 slots one tick apart, then four levels of 64 slots
+// each covering 64 slots of the level below, 2^32 ticks in all. A timer
+// goes to the slot of the lowest level its deadline is in range of, and
+// moves down a level whenever the level below wraps around (cascades).
+// Adding and cancelling are O(1) and expiring timers cost nothing until
+// they are due.
+#define WHEEL_LEVELS    5
+#define LEVEL0_BITS     8
+#define LEVEL0_SLOTS    (1 << LEVEL0_BITS)
+#define LEVEL0_MASK     (LEVEL0_SLOTS - 1)
+#define LEVEL_BITS      6
+#define LEVEL_SLOTS     (1 << LEVEL_BITS)
+#define LEVEL_MASK      (LEVEL_SLOTS - 1)
+#define WHEEL_SLOTS     (LEVEL0_SLOTS + (WHEEL_LEVELS - 1) * LEVEL_SLOTS)
+
+static struct timer* wheel[WHEEL_SLOTS];
+static unsigned int level0_bitmap[LEVEL0_SLOTS / 32];  // Non-empty level 0 slots
+static unsigned int wheel_tick = 0;                     // Next tick to expire
+static volatile unsigned int timers_pending = 0;
+static unsigned int upper_pending = 0;                  // Pending above level 0
+static volatile unsigned int next_expiry = 0;           // Bottom half due by then
+static struct spinlock wheel_lock = SPINLOCK_INIT;
+
+// Statistics
+static unsigned int timers_expired = 0;
+static unsigned int timers_cascaded = 0;
+
+static void pit_set(unsigned char mode, unsigned short count) {
+    outb(PIT_COMMAND, mode);
+    outb(PIT_CHANNEL0, count & 0xFF);
+    outb(PIT_CHANNEL0, count >> 8);
+}
+
+// Read the current count of channel 0
+static unsigned int pit_read() {
+    outb(PIT_COMMAND, PIT_LATCH);
+    unsigned char lo = inb(PIT_CHANNEL0);
+    unsigned char hi = inb(PIT_CHANNEL0);
+    return (hi << 8) | lo;
+}
+
+static void pit_periodic() {
+    pit_set(PIT_MODE_PERIODIC, PIT_DIVISOR);
+}
+
+static void pit_oneshot(unsigned int count) {
+    pit_set(PIT_MODE_ONESHOT, count);
+}
+
+static struct tick_source pit_source = {
+    "PIT", PIT_DIVISOR, PIT_MAX_COUNT, pit_periodic, pit_oneshot, pit_read
+};
+
+// The local APIC timer ticks each CPU by itself, no tick IPIs needed.
+// Its divisor is measured against the PIT by timer_init_lapic().
+static struct tick_source lapic_source;
+
+static void lapic_periodic() {
+    lapic_timer_set(LAPIC_TIMER_PERIODIC, lapic_source.divisor);
+}
+
+static void lapic_oneshot(unsigned int count) {
+    lapic_timer_set(LAPIC_TIMER_ONESHOT, count);
+}
+
+static struct tick_source lapic_source = {
+    "local APIC", 0, 0xFFFFFFFF, lapic_periodic, lapic_oneshot, lapic_timer_current
+};
+
+static struct tick_source* source = &pit_source;
+
+static struct registers* timer_handler(struct registers* regs, void* ctx);
+static void run_timers();
+
+// Program channel 0 for a periodic TIMER_HZ tick
+void timer_init() {
+    softirq_register(SOFTIRQ_TIMER, run_timers, "timer");
+    irq_register(0, timer_handler, 0, "timer");
+    irq_register_vector(LAPIC_TIMER_VECTOR, timer_handler, 0, "apic timer");
+    
+    source->periodic();
+    tsc_boot = rdtsc();
+    
+    print("Timer: ");
+    print_dec(TIMER_HZ);
+    print(" Hz, ");
+    print_dec(TIME_SLICE_MS);
+    print(" ms time slice\n");
+}
+
+// Move the tick from the PIT to the local APIC timer of every CPU.
+// Needs interrupts enabled, as it counts PIT ticks to calibrate.
+void timer_init_lapic() {
+    if (!lapic_present()) {
+        return;
+    }
+    
+    // Count down, masked, across whole PIT ticks
+    lapic_timer_set(LAPIC_TIMER_ONESHOT | LAPIC_TIMER_MASKED, 0xFFFFFFFF);
+    unsigned int t = ticks;
+    while (ticks == t) {
+        asm volatile("hlt");
+    }
+    unsigned int start = lapic_timer_current();
+    while (ticks - t <= CALIBRATE_TICKS) {
+        asm volatile("hlt");
+    }
+    unsigned int end = lapic_timer_current();
+    lapic_timer_set(LAPIC_TIMER_MASKED, 0);
+    
+    lapic_source.divisor = (start - end) / CALIBRATE_TICKS;
+    if (lapic_source.divisor == 0) {
+        print("Timer: local APIC timer not usable, keeping the PIT\n");
+        return;
+    }
+    
+    unsigned int flags = irq_save();
+    idt_mask_irq(0);
+    count_remainder = 0;
+    source = &lapic_source;
+    source->periodic();
+    irq_restore(flags);
+    
+    print("Timer: local APIC, ");
+    print_dec(lapic_source.divisor);
+    print(" counts per tick\n");
+}
+
+// Start an application processor's own tick, before it enables interrupts
+void timer_init_ap() {
+    if (source == &lapic_source) {
+        source->periodic();
+    }
+}
+
+// Leave tickless mode, crediting the time spent in it
+static void tickless_exit(unsigned int elapsed) {
+    count_remainder += elapsed;
+    unsigned int credited = count_remainder / source->divisor;
+    count_remainder %= source->divisor;
+    ticks += credited;
+    idle_ticks += credited;
+    
+    oneshot_armed = 0;
+    source->periodic();
+}
+
+// Slot of a deadline, relative to wheel_tick. Overdue timers go to the
+// slot expired next.
+static unsigned int wheel_slot(unsigned int expires) {
+    unsigned int delta = expires - wheel_tick;
+    if ((int)delta < 0) {
+        return wheel_tick & LEVEL0_MASK;
+    }
+    if (delta < LEVEL0_SLOTS) {
+        return expires & LEVEL0_MASK;
+    }
+    
+    unsigned int base = LEVEL0_SLOTS;
+    unsigned int shift = LEVEL0_BITS;
+    for (int level = 1; level < WHEEL_LEVELS - 1; level++) {
+        if (delta < 1u << (shift + LEVEL_BITS)) {
+            break;
+        }
+        base += LEVEL_SLOTS;
+        shift += LEVEL_BITS;
+    }
+    return base + ((expires >> shift) & LEVEL_MASK);
+}
+
+// Called with wheel_lock held, as are the helpers below
+static void wheel_link(struct timer* t) {
+    unsigned int slot = wheel_slot(t->expires);
+    t->slot = slot;
+    t->next = wheel[slot];
+    if (t->next) {
+        t->next->pprev = &t->next;
+    }
+    t->pprev = &wheel[slot];
+    wheel[slot] = t;
+    
+    if (slot < LEVEL0_SLOTS) {
+        level0_bitmap[slot / 32] |= 1u << (slot % 32);
+    } else {
+        upper_pending++;
+    }
+}
+
+static void wheel_unlink(struct timer* t) {
+    *t->pprev = t->next;
+    if (t->next) {
+        t->next->pprev = t->pprev;
+    }
+    t->pprev = 0;
+    
+    if (t->slot >= LEVEL0_SLOTS) {
+        upper_pending--;
+    } else if (!wheel[t->slot]) {
+        level0_bitmap[t->slot / 32] &= ~(1u << (t->slot % 32));
+    }
+}
+
+// Move the timers of an upper level slot down to where they now belong
+static void cascade(unsigned int slot) {
+    struct timer* t = wheel[slot];
+    wheel[slot] = 0;
+    while (t) {
+        struct timer* next = t->next;
+        upper_pending--;
+        wheel_link(t);
+        timers_cascaded++;
+        t = next;
+    }
+}
+
+// First non-empty level 0 slot at or after index, wrapping around;
+// -1 if there is none
+static int first_level0_slot(unsigned int index) {
+    unsigned int word = index / 32;
+    unsigned int bits = level0_bitmap[word] & (~0u << (index % 32));
+    for (int n = 0; n <= LEVEL0_SLOTS / 32; n++) {
+        if (bits) {
+            unsigned int bit;
+            asm("bsf %1, %0" : "=r"(bit) : "rm"(bits));
+            return word * 32 + bit;
+        }
+        word = (word + 1) % (LEVEL0_SLOTS / 32);
+        bits = level0_bitmap[word];
+    }
+    return -1;
+}
+
+// Tick by which the bottom half has to run: the next level 0 deadline,
+// or the next cascade if that comes first
+static void update_next_expiry() {
+    unsigned int index = wheel_tick & LEVEL0_MASK;
+    int slot = first_level0_slot(index);
+    unsigned int next = wheel_tick + ((slot - index) & LEVEL0_MASK);
+    
+    if (upper_pending) {
+        unsigned int boundary = (wheel_tick + LEVEL0_MASK) & ~LEVEL0_MASK;
+        if (slot < 0 || (int)(boundary - next) < 0) {
+            next = boundary;
+        }
+    }
+    next_expiry = next;
+}
+
+// timer_add() with wheel_lock already held
+static void timer_add_locked(struct timer* t, unsigned int expires,
+                             void (*fn)(void* arg), void* arg) {
+    // An empty wheel can skip the ticks nobody waited for
+    if (!timers_pending) {
+        wheel_tick = ticks;
+    }
+    
+    t->expires = expires;
+    t->fn = fn;
+    t->arg = arg;
+    wheel_link(t);
+    
+    if (!timers_pending || (int)(expires - next_expiry) < 0) {
+        next_expiry = expires;
+    }
+    timers_pending++;
+}
+
+// Arm t to call fn(arg) once the tick count reaches expires. Callbacks
+// run in the timer bottom half with interrupts disabled.
+void timer_add(struct timer* t, unsigned int expires, void (*fn)(void* arg), void* arg) {
+    unsigned int flags = spin_lock_irqsave(&wheel_lock);
+    timer_add_locked(t, expires, fn, arg);
+    spin_unlock_irqrestore(&wheel_lock, flags);
+}
+
+// Disarm t. Returns 1 if it was pending, 0 if it already expired (its
+// callback may still be running).
+int timer_cancel(struct timer* t) {
+    unsigned int flags = spin_lock_irqsave(&wheel_lock);
+    int pending = t->pprev != 0;
+    if (pending) {
+        wheel_unlink(t);
+        timers_pending--;
+    }
+    spin_unlock_irqrestore(&wheel_lock, flags);
+    return pending;
+}
+
+// Expire the timers due up to the current tick. Timer bottom half.
+static void run_timers() {
+    unsigned int flags = spin_lock_irqsave(&wheel_lock);
+    while (timers_pending && (int)(ticks - wheel_tick) >= 0) {
+        unsigned int index = wheel_tick & LEVEL0_MASK;
+        
+        // Level 0 wrapped: bring down the next slot of level 1, and of
+        // the levels above while they wrap too
+        if (index == 0) {
+            unsigned int base = LEVEL0_SLOTS;
+            unsigned int shift = LEVEL0_BITS;
+            for (int level = 1; level < WHEEL_LEVELS; level++) {
+                unsigned int upper = (wheel_tick >> shift) & LEVEL_MASK;
+                cascade(base + upper);
+                if (upper != 0) {
+                    break;
+                }
+                base += LEVEL_SLOTS;
+                shift += LEVEL_BITS;
+            }
+        }
+        wheel_tick++;
+        
+        // Detach the slot first: a timer added by a callback may belong
+        // in it again, one rotation later. Cancelling still works
+        // through pprev.
+        struct timer* list = wheel[index];
+        wheel[index] = 0;
+        level0_bitmap[index / 32] &= ~(1u << (index % 32));
+        if (list) {
+            list->pprev = &list;
+        }
+        
+        while (list) {
+            struct timer* t = list;
+            wheel_unlink(t);
+            timers_pending--;
+            timers_expired++;
+            
+            // t may be freed by its callback or added again
+            void (*fn)(void*) = t->fn;
+            void* arg = t->arg;
+            spin_unlock(&wheel_lock);
+            fn(arg);
+            spin_lock(&wheel_lock);
+        }
+    }
+    if (timers_pending) {
+        update_next_expiry();
+    }
+    spin_unlock_irqrestore(&wheel_lock, flags);
+}
+
+// Raise the timer bottom half if a timer is due. Peeks without the
+// lock: a timer added concurrently is at worst seen a tick late.
+static void check_timers() {
+    if (timers_pending && (int)(ticks - next_expiry) >= 0) {
+        softirq_raise(SOFTIRQ_TIMER);
+    }
+}
+
+// Timer handler, returns the frame of the process to resume. The boot
+// CPU keeps time; with the PIT it also forwards the tick to the others,
+// with the local APIC timer every CPU gets its own.
+static struct registers* timer_handler(struct registers* regs, void* ctx) {
+    (void)ctx;
+    
+    if (this_cpu()->id != 0) {
+        sched_tick();
+        return regs;
+    }
+    
+    // The idle one-shot ran out: nothing to schedule, just catch up
+    if (oneshot_armed) {
+        tickless_exit(oneshot_count);
+        check_timers();
+        return regs;
+    }
+    
+    ticks++;
+    check_timers();
+    if (source == &pit_source) {
+        smp_tick_others();
+    }
+    
+    sched_tick();
+    return regs;
+}
+
+// Wait for an interrupt. If no process on any CPU wants to run, the
+// periodic tick is replaced by a single long one-shot so the CPU stays
+// halted until there is real work (an IRQ) or the one-shot expires.
+void timer_idle() {
+    unsigned int flags = irq_save();
+    
+    if (sched_has_ready()) {
+        irq_restore(flags);
+        process_yield();
+        return;
+    }
+    
+    // APs wait for an IPI, with their own tick (if any) stopped until
+    // schedule() leaves idle. The boot CPU keeps time for busy APs.
+    struct cpu* cpu = this_cpu();
+    if (cpu->id != 0) {
+        if (source == &lapic_source) {
+            lapic_timer_set(LAPIC_TIMER_MASKED, 0);
+            cpu->tick_stopped = 1;
+        }
+        asm volatile("sti; hlt; cli");
+        irq_restore(flags);
+        return;
+    }
+    
+    int others_busy = 0;
+    for (unsigned int i = 1; i < cpu_count; i++) {
+        others_busy |= sched_cpu_busy(i);
+    }
+    if (others_busy) {
+        asm volatile("sti; hlt; cli");
+        irq_restore(flags);
+        return;
+    }
+    
+    // Stay halted no longer than the next timer allows
+    oneshot_count = source->max_count;
+    spin_lock(&wheel_lock);
+    if (timers_pending) {
+        unsigned int until = next_expiry - ticks;
+        if ((int)until <= 0) {
+            oneshot_count = 1;
+        } else if (until < source->max_count / source->divisor) {
+            oneshot_count = until * source->divisor;
+        }
+    }
+    spin_unlock(&wheel_lock);
+    oneshot_armed = 1;
+    idle_entries++;
+    source->oneshot(oneshot_count);
+    
+    // sti takes effect after hlt starts, so no wakeup is lost
+    asm volatile("sti; hlt; cli");
+    
+    // Woken by some other IRQ: credit the part of the one-shot that ran
+    timer_idle_exit();
+    
+    irq_restore(flags);
+}
+
+// Is the boot CPU halted with the periodic tick stopped?
+int timer_tickless() {
+    return oneshot_armed;
+}
+
+// Restore this CPU's periodic tick when idle is switched away from,
+// early if the boot CPU's one-shot has not expired yet
+void timer_idle_exit() {
+    struct cpu* cpu = this_cpu();
+    if (cpu->id == 0) {
+        if (oneshot_armed) {
+            tickless_exit(oneshot_count - source->remaining());
+        }
+    } else if (cpu->tick_stopped) {
+        cpu->tick_stopped = 0;
+        source->periodic();
+    }
+}
+
+// Ticks since boot
+unsigned int timer_ticks() {
+    return ticks;
+}
+
+// Milliseconds since boot
+unsigned int timer_ms() {
+    unsigned int t = ticks;
+    return (t / TIMER_HZ) * 1000 + (t % TIMER_HZ) * 1000 / TIMER_HZ;
+}
+
+// TSC frequency in kHz, measured against the tick since timer_init
+unsigned int timer_tsc_khz() {
+    unsigned int ms = timer_ms();
+    if (ms == 0) {
+        return 0;
+    }
+    return div64(rdtsc() - tsc_boot, ms);
+}
+
+static void wake_process(void* arg) {
+    sched_wakeup((struct pcb*)arg);
+}
+
+// Sleep for at least ms milliseconds (rounded up to whole ticks)
+void ksleep(unsigned int ms) {
+    unsigned int delay = (ms * TIMER_HZ + 999) / 1000;
+    if (delay == 0) {
+        delay = 1;
+    }
+    
+    // Expires only once the process is blocked: the lock is held until then
+    struct timer t;
+    unsigned int flags = spin_lock_irqsave(&wheel_lock);
+    timer_add_locked(&t, ticks + delay, wake_process, current_process);
+    sched_block(&wheel_lock);
+    spin_unlock_irqrestore(&wheel_lock, flags);
+}
+
+// Print timer statistics
+void timer_stats() {
+    unsigned int ms = timer_ms();
+    
+    print("Uptime: ");
+    print_dec(ms / 1000);
+    print(".");
+    unsigned int frac = ms % 1000;
+    if (frac < 100) print("0");
+    if (frac < 10) print("0");
+    print_dec(frac);
+    print(" s (");
+    print_dec(ticks);
+    print(" ticks at ");
+    print_dec(TIMER_HZ);
+    print(" Hz from the ");
+    print(source->name);
+    print(")\n");
+    
+    print("Tickless idle: ");
+    print_dec(idle_entries);
+    print(" entries, ");
+    print_dec(idle_ticks);
+    print(" ticks idle without a tick interrupt\n");
+    
+    print("Timer wheel: ");
+    print_dec(timers_pending);
+    print(" pending, ");
+    print_dec(timers_expired);
+    print(" expired, ");
+    print_dec(timers_cascaded);
+    print(" cascaded\n");
+}
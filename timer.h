@@ -0,0 +1,43 @@
+// timer.h
+
+#ifndef TIMER_H
+#define TIMER_H
+
+// Tick rate, override with 'make HZ=...'
+#ifndef TIMER_HZ
+#define TIMER_HZ 100
+#endif
+
+#if TIMER_HZ < 100 || TIMER_HZ > 1000
+#error "TIMER_HZ must be between 100 and 1000"
+#endif
+
+// Scheduler time slice
+#define TIME_SLICE_MS 20
+
+// Callback armed for a tick, see timer_add()
+struct timer {
+    struct timer* next;
+    struct timer** pprev;       // Link pointing at it while pending, else 0
+    unsigned int slot;          // Wheel slot it is in
+    unsigned int expires;       // Tick to fire at
+    void (*fn)(void* arg);
+    void* arg;
+};
+
+// Functions
+void timer_init();
+void timer_init_lapic();
+void timer_init_ap();
+void timer_idle();
+void timer_idle_exit();
+int timer_tickless();
+unsigned int timer_ticks();
+unsigned int timer_ms();
+unsigned int timer_tsc_khz();
+void timer_add(struct timer* t, unsigned int expires, void (*fn)(void* arg), void* arg);
+int timer_cancel(struct timer* t);
+void ksleep(unsigned int ms);
+void timer_stats();
+
+#endif
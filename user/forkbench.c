@@ -0,0 +1,69 @@
+// forkbench.c
+// Fork cost as the parent's heap grows. Pages are shared copy-on-write,
+// so the time to fork and the memory a child takes should stay nearly
+// flat; only a child that writes its heap pays for copies.
+
+#include "ulib.h"
+
+#define PAGE_SIZE 4096
+#define CHILD_MS  50
+
+static const unsigned int heap_kb[] = { 0, 256, 1024, 4096 };
+
+// Touch every page of the heap so it is backed by frames
+static void write_heap(char* heap, unsigned int size) {
+    for (unsigned int offset = 0; offset < size; offset += PAGE_SIZE) {
+        heap[offset]++;
+    }
+}
+
+// Fork a child that optionally writes the heap, then sleeps. Prints the
+// fork time and the memory the child holds while it sleeps.
+static void measure(char* heap, unsigned int size, int child_writes) {
+    unsigned int before = memused_kb();
+    unsigned long long start = rdtsc();
+    int pid = fork();
+    if (pid == 0) {
+        if (child_writes) {
+            write_heap(heap, size);
+        }
+        sleep(CHILD_MS);
+        exit();
+    }
+    unsigned int cycles = (unsigned int)(rdtsc() - start);
+    if (pid < 0) {
+        puts("fork failed\n");
+        return;
+    }
+    
+    sleep(CHILD_MS / 2);
+    unsigned int used = memused_kb();
+    
+    puts("heap ");
+    print_dec(size / 1024);
+    puts(child_writes ? " KB, child writes it: fork " : " KB: fork ");
+    print_dec(cycles);
+    puts(" cycles, child ");
+    print_dec(used > before ? used - before : 0);
+    puts(" KB\n");
+    
+    sleep(CHILD_MS);  // Let it exit before the next round
+}
+
+int main() {
+    char* heap = sbrk(0);
+    unsigned int size = 0;
+    
+    for (unsigned int i = 0; i < sizeof(heap_kb) / sizeof(heap_kb[0]); i++) {
+        unsigned int target = heap_kb[i] * 1024;
+        if (sbrk(target - size) == (void*)-1) {
+            puts("sbrk failed\n");
+            return 1;
+        }
+        size = target;
+        write_heap(heap, size);
+        measure(heap, size, 0);
+    }
+    measure(heap, size, 1);
+    return 0;
+}
@@ -0,0 +1,34 @@
+// hello.c
+// Exercises the system calls: console, heap, files
+
+#include "ulib.h"
+
+int main() {
+    puts("Hello from ring 3! PID ");
+    print_dec(getpid());
+    puts(", up ");
+    print_dec(uptime_ms());
+    puts(" ms\n");
+    
+    // Demand-zero heap
+    unsigned int* heap = (unsigned int*)sbrk(8192);
+    heap[0] = 1;
+    heap[2047] = 2;
+    puts("Heap at ");
+    print_dec((unsigned int)heap >> 20);
+    puts(" MB: ");
+    puts(heap[0] + heap[2047] == 3 ? "OK\n" : "FAILED\n");
+    
+    // A file round trip
+    const char text[] = "written from ring 3";
+    char back[sizeof(text)];
+    fcreate("hello.txt");
+    fwrite("hello.txt", text, sizeof(text));
+    int n = fread("hello.txt", back, sizeof(back));
+    puts("Read back: ");
+    puts(n == sizeof(text) ? back : "FAILED");
+    puts("\n");
+    fdelete("hello.txt");
+    
+    return 0;
+}
@@ -0,0 +1,120 @@
+// ipcbench.c
+// Message passing between two processes: send/reply round trips with
+// the payload in registers, posted messages, and 1MB payloads moved or
+// shared as pages, against copying them
+
+#include "ulib.h"
+
+#define PAGE_SIZE   4096
+#define ROUNDS      10000
+#define BULK_PAGES  256
+#define BULK_ROUNDS 50
+
+// Second message word
+#define OP_PING     0
+#define OP_QUIT     1
+
+// Totals stay well below 2^32 cycles
+static void report(const char* what, unsigned long long cycles, unsigned int count) {
+    puts(what);
+    puts(": ");
+    print_dec((unsigned int)cycles / count);
+    puts(" cycles\n");
+}
+
+// Parent: answer until told to quit. Pages received are read and handed
+// back with sbrk, like a server consuming a buffer would.
+static void serve(int port) {
+    struct ipc_msg msg;
+    while (msg_recv(port, &msg) == 0) {
+        if (msg.pages) {
+            volatile unsigned int* data = (unsigned int*)msg.page;
+            msg.word[0] = data[0];
+            sbrk(-(int)(msg.pages * PAGE_SIZE));
+        }
+        if (msg.waiting) {
+            msg_reply(port, msg.sender, msg.word[0] + 1);
+        }
+        if (msg.word[1] == OP_QUIT) {
+            return;
+        }
+    }
+}
+
+static void touch(char* buf, unsigned int pages) {
+    for (unsigned int i = 0; i < pages; i++) {
+        buf[i * PAGE_SIZE] = (char)i;
+    }
+}
+
+// Child: drive the server and time it
+static void client(int port) {
+    unsigned long long start = rdtsc();
+    for (unsigned int i = 0; i < ROUNDS; i++) {
+        if (msg_send(port, i, OP_PING) != (int)i + 1) {
+            puts("bad reply\n");
+            return;
+        }
+    }
+    report("send/reply round trip", rdtsc() - start, ROUNDS);
+    
+    // The queue is bounded: wait for the server when it fills up
+    start = rdtsc();
+    for (unsigned int i = 0; i < ROUNDS; i++) {
+        while (msg_post(port, i, OP_PING) != 0) {
+            yield();
+        }
+    }
+    msg_send(port, 0, OP_PING);
+    report("post", rdtsc() - start, ROUNDS);
+    
+    char* buf = sbrk(2 * BULK_PAGES * PAGE_SIZE);
+    char* copy = buf + BULK_PAGES * PAGE_SIZE;
+    touch(buf, 2 * BULK_PAGES);
+    
+    start = rdtsc();
+    for (unsigned int i = 0; i < BULK_ROUNDS; i++) {
+        memcpy(copy, buf, BULK_PAGES * PAGE_SIZE);
+    }
+    report("copy 1MB", rdtsc() - start, BULK_ROUNDS);
+    
+    // Moved pages leave this address space; touching them again gets
+    // fresh ones, which is not timed
+    unsigned long long total = 0;
+    for (unsigned int i = 0; i < BULK_ROUNDS; i++) {
+        touch(buf, BULK_PAGES);
+        start = rdtsc();
+        msg_send_pages(port, buf, BULK_PAGES);
+        total += rdtsc() - start;
+    }
+    report("move 1MB", total, BULK_ROUNDS);
+    
+    touch(buf, BULK_PAGES);
+    start = rdtsc();
+    for (unsigned int i = 0; i < BULK_ROUNDS; i++) {
+        msg_send_pages(port, buf, BULK_PAGES | IPC_SHARE);
+    }
+    report("share 1MB", rdtsc() - start, BULK_ROUNDS);
+    
+    msg_send(port, 0, OP_QUIT);
+}
+
+int main() {
+    int port = port_create();
+    if (port < 0) {
+        puts("no free port\n");
+        return 1;
+    }
+    
+    int pid = fork();
+    if (pid < 0) {
+        puts("fork failed\n");
+        return 1;
+    }
+    if (pid == 0) {
+        client(port);
+    } else {
+        serve(port);
+    }
+    return 0;
+}
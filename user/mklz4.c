@@ -0,0 +1,190 @@
+// mklz4.c
+// Host tool: packs kernel.bin into an LZ4 block behind a kernel_lz4_header
+// (see boot.h), which stage2.asm unpacks. Fewer sectors to read from disk.
+//
+// Usage: mklz4 kernel.bin output
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../boot.h"
+
+#define MIN_MATCH       4
+#define LAST_LITERALS   5       // The block ends with at least 5 literals
+#define MATCH_LIMIT     12      // and no match starts in its last 12 bytes
+#define MAX_DISTANCE    65535
+#define HASH_BITS       16
+
+static unsigned int hash(const unsigned char* p) {
+    unsigned int v;
+    memcpy(&v, p, sizeof(v));
+    return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+// Lengths of 15 and up continue in bytes of 255, ending with a smaller one
+static unsigned char* put_length(unsigned char* out, size_t length) {
+    length -= 15;
+    while (length >= 255) {
+        *out++ = 255;
+        length -= 255;
+    }
+    *out++ = (unsigned char)length;
+    return out;
+}
+
+// One sequence: token, literals, then the match unless match is 0
+static unsigned char* put_sequence(unsigned char* out, const unsigned char* literals,
+                                   size_t count, size_t distance, size_t match) {
+    unsigned char* token = out++;
+    *token = (count >= 15 ? 15 : count) << 4;
+    if (count >= 15) {
+        out = put_length(out, count);
+    }
+    memcpy(out, literals, count);
+    out += count;
+    if (match == 0) {
+        return out;
+    }
+    
+    *out++ = distance & 0xFF;
+    *out++ = distance >> 8;
+    match -= MIN_MATCH;
+    *token |= match >= 15 ? 15 : match;
+    if (match >= 15) {
+        out = put_length(out, match);
+    }
+    return out;
+}
+
+// Greedy compression with a hash table of the last position of each
+// 4-byte prefix. Returns the size of the block.
+static size_t compress(const unsigned char* in, size_t size, unsigned char* out) {
+    static long table[1 << HASH_BITS];
+    unsigned char* start = out;
+    size_t anchor = 0;
+    size_t pos = 0;
+    
+    for (size_t i = 0; i < (1 << HASH_BITS); i++) {
+        table[i] = -1;
+    }
+    while (size > MATCH_LIMIT && pos + MATCH_LIMIT <= size) {
+        unsigned int h = hash(in + pos);
+        long candidate = table[h];
+        table[h] = pos;
+        if (candidate < 0 || pos - candidate > MAX_DISTANCE ||
+            memcmp(in + candidate, in + pos, MIN_MATCH) != 0) {
+            pos++;
+            continue;
+        }
+    
+        size_t length = MIN_MATCH;
+        while (pos + length < size - LAST_LITERALS && in[candidate + length] == in[pos + length]) {
+            length++;
+        }
+        out = put_sequence(out, in + anchor, pos - anchor, pos - candidate, length);
+        pos += length;
+        anchor = pos;
+    }
+    out = put_sequence(out, in + anchor, size - anchor, 0, 0);
+    return out - start;
+}
+
+// The same steps as lz4_unpack in stage2.asm, to check the block
+static size_t unpack(const unsigned char* in, size_t size, unsigned char* out, size_t max) {
+    const unsigned char* end = in + size;
+    size_t pos = 0;
+    
+    while (in < end) {
+        unsigned int token = *in++;
+        size_t count = token >> 4;
+        if (count == 15) {
+            unsigned char more;
+            do {
+                more = *in++;
+                count += more;
+            } while (more == 255);
+        }
+        if (pos + count > max) {
+            return 0;
+        }
+        memcpy(out + pos, in, count);
+        in += count;
+        pos += count;
+        if (in >= end) {
+            break;
+        }
+    
+        size_t distance = in[0] | (in[1] << 8);
+        in += 2;
+        size_t match = token & 15;
+        if (match == 15) {
+            unsigned char more;
+            do {
+                more = *in++;
+                match += more;
+            } while (more == 255);
+        }
+        match += MIN_MATCH;
+        if (distance == 0 || distance > pos || pos + match > max) {
+            return 0;
+        }
+        for (size_t i = 0; i < match; i++, pos++) {
+            out[pos] = out[pos - distance];
+        }
+    }
+    return pos;
+}
+
+int main(int argc, char** argv) {
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s kernel.bin output\n", argv[0]);
+        return 1;
+    }
+    
+    FILE* in = fopen(argv[1], "rb");
+    if (!in) {
+        perror(argv[1]);
+        return 1;
+    }
+    fseek(in, 0, SEEK_END);
+    long size = ftell(in);
+    fseek(in, 0, SEEK_SET);
+    unsigned char* image = malloc(size > 0 ? size : 1);
+    if (!image || size < 16 || fread(image, 1, size, in) != (size_t)size) {
+        fprintf(stderr, "mklz4: %s: cannot read the image\n", argv[1]);
+        return 1;
+    }
+    fclose(in);
+    
+    // Plain image header at offset 4: magic, image_end, bss_end
+    unsigned int words[3];
+    memcpy(words, image + 4, sizeof(words));
+    if (words[0] != KERNEL_MAGIC || words[1] - KERNEL_ADDR != (unsigned long)size) {
+        fprintf(stderr, "mklz4: %s: not a kernel image\n", argv[1]);
+        return 1;
+    }
+    
+    unsigned char* packed = malloc(size + size / 255 + 16);
+    unsigned char* check = malloc(size);
+    struct kernel_lz4_header header = { KERNEL_LZ4_MAGIC, 0, words[1], words[2] };
+    header.packed_size = compress(image, size, packed);
+    if (unpack(packed, header.packed_size, check, size) != (size_t)size ||
+        memcmp(check, image, size) != 0) {
+        fprintf(stderr, "mklz4: %s: packed data does not unpack to the image\n", argv[1]);
+        return 1;
+    }
+    
+    FILE* out = fopen(argv[2], "wb");
+    if (!out || fwrite(&header, sizeof(header), 1, out) != 1 ||
+        fwrite(packed, 1, header.packed_size, out) != header.packed_size) {
+        perror(argv[2]);
+        return 1;
+    }
+    fclose(out);
+    
+    printf("%s: %ld bytes packed to %u (%ld to %ld sectors)\n", argv[2], size,
+           header.packed_size, (size + 511) / 512,
+           (long)(sizeof(header) + header.packed_size + 511) / 512);
+    return 0;
+}
@@ -0,0 +1,67 @@
+// mkpkg.c
+// Host tool: packs files into a program package (see pkg.h) sized for
+// the sectors boot.asm loads. Files keep their base name.
+//
+// Usage: mkpkg output file...
+
+#include <stdio.h>
+#include <string.h>
+
+#include "../pkg.h"
+#include "../boot.h"
+
+static unsigned char package[PROGRAMS_SIZE];
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s output file...\n", argv[0]);
+        return 1;
+    }
+    
+    unsigned int count = argc - 2;
+    struct pkg_header* header = (struct pkg_header*)package;
+    struct pkg_entry* entries = (struct pkg_entry*)(header + 1);
+    unsigned int offset = sizeof(*header) + count * sizeof(*entries);
+    if (offset > sizeof(package)) {
+        fprintf(stderr, "mkpkg: too many files\n");
+        return 1;
+    }
+    header->magic = PKG_MAGIC;
+    header->count = count;
+    
+    for (unsigned int i = 0; i < count; i++) {
+        const char* path = argv[i + 2];
+        const char* name = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+        if (strlen(name) >= PKG_NAME_LENGTH) {
+            fprintf(stderr, "mkpkg: %s: name longer than %d characters\n", name, PKG_NAME_LENGTH - 1);
+            return 1;
+        }
+        
+        FILE* in = fopen(path, "rb");
+        if (!in) {
+            perror(path);
+            return 1;
+        }
+        size_t size = fread(package + offset, 1, sizeof(package) - offset, in);
+        if (!feof(in)) {
+            fprintf(stderr, "mkpkg: %s: package full (%d bytes)\n", path, PROGRAMS_SIZE);
+            return 1;
+        }
+        fclose(in);
+        
+        strncpy(entries[i].name, name, PKG_NAME_LENGTH);
+        entries[i].offset = offset;
+        entries[i].size = size;
+        offset = (offset + size + 3) & ~3u;
+    }
+    
+    FILE* out = fopen(argv[1], "wb");
+    if (!out || fwrite(package, 1, sizeof(package), out) != sizeof(package)) {
+        perror(argv[1]);
+        return 1;
+    }
+    fclose(out);
+    
+    printf("%s: %u files, %u of %d bytes\n", argv[1], count, offset, PROGRAMS_SIZE);
+    return 0;
+}
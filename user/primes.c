@@ -0,0 +1,30 @@
+// primes.c
+// CPU-bound workload: counts primes by trial division
+
+#include "ulib.h"
+
+#define LIMIT 200000
+
+int main() {
+    unsigned int start = uptime_ms();
+    unsigned int count = 0;
+    
+    for (unsigned int n = 2; n < LIMIT; n++) {
+        unsigned int d = 2;
+        while (d * d <= n && n % d != 0) {
+            d++;
+        }
+        if (d * d > n) {
+            count++;
+        }
+    }
+    
+    puts("primes: ");
+    print_dec(count);
+    puts(" below ");
+    print_dec(LIMIT);
+    puts(" in ");
+    print_dec(uptime_ms() - start);
+    puts(" ms\n");
+    return 0;
+}
@@ -0,0 +1,147 @@
+// ulib.c
+
+#include "ulib.h"
+
+// Enter the kernel through the vsyscall page: SYSENTER when the CPU
+// has it, int 0x80 otherwise
+static int syscall(unsigned int nr, unsigned int a, unsigned int b, unsigned int c) {
+    int ret;
+    asm volatile("call *%%esi"
+                 : "=a"(ret)
+                 : "a"(nr), "b"(a), "c"(b), "d"(c), "S"(VSYSCALL_ADDR)
+                 : "memory");
+    return ret;
+}
+
+// Program entry point
+void _start() {
+    main();
+    exit();
+}
+
+void exit() {
+    syscall(SYS_EXIT, 0, 0, 0);
+    while (1) {
+    }
+}
+
+int write(const char* buf, unsigned int len) {
+    return syscall(SYS_WRITE, (unsigned int)buf, len, 0);
+}
+
+int read(char* buf, unsigned int len) {
+    return syscall(SYS_READ, (unsigned int)buf, len, 0);
+}
+
+int getpid() {
+    return syscall(SYS_GETPID, 0, 0, 0);
+}
+
+void yield() {
+    syscall(SYS_YIELD, 0, 0, 0);
+}
+
+void sleep(unsigned int ms) {
+    syscall(SYS_SLEEP, ms, 0, 0);
+}
+
+void* sbrk(int increment) {
+    return (void*)syscall(SYS_SBRK, increment, 0, 0);
+}
+
+int fcreate(const char* name) {
+    return syscall(SYS_CREATE, (unsigned int)name, 0, 0);
+}
+
+int fdelete(const char* name) {
+    return syscall(SYS_DELETE, (unsigned int)name, 0, 0);
+}
+
+int fread(const char* name, void* buf, unsigned int size) {
+    return syscall(SYS_FREAD, (unsigned int)name, (unsigned int)buf, size);
+}
+
+int fwrite(const char* name, const void* buf, unsigned int size) {
+    return syscall(SYS_FWRITE, (unsigned int)name, (unsigned int)buf, size);
+}
+
+void flist() {
+    syscall(SYS_LIST, 0, 0, 0);
+}
+
+unsigned int uptime_ms() {
+    return syscall(SYS_TIME, 0, 0, 0);
+}
+
+int fork() {
+    return syscall(SYS_FORK, 0, 0, 0);
+}
+
+unsigned int memused_kb() {
+    return syscall(SYS_MEMUSED, 0, 0, 0);
+}
+
+int port_create() {
+    return syscall(SYS_PORT, 0, 0, 0);
+}
+
+int msg_send(int port, unsigned int word0, unsigned int word1) {
+    return syscall(SYS_SEND, port, word0, word1);
+}
+
+int msg_post(int port, unsigned int word0, unsigned int word1) {
+    return syscall(SYS_POST, port, word0, word1);
+}
+
+// pages may include IPC_SHARE
+int msg_send_pages(int port, void* addr, unsigned int pages) {
+    return syscall(SYS_SENDPAGES, port, (unsigned int)addr, pages);
+}
+
+int msg_recv(int port, struct ipc_msg* msg) {
+    return syscall(SYS_RECV, port, (unsigned int)msg, 0);
+}
+
+int msg_reply(int port, unsigned int pid, int value) {
+    return syscall(SYS_REPLY, port, pid, value);
+}
+
+unsigned int strlen(const char* s) {
+    unsigned int n = 0;
+    while (s[n]) {
+        n++;
+    }
+    return n;
+}
+
+// The compiler may emit calls to these for struct copies
+void* memset(void* dst, int c, unsigned int n) {
+    unsigned char* d = (unsigned char*)dst;
+    while (n--) {
+        *d++ = c;
+    }
+    return dst;
+}
+
+void* memcpy(void* dst, const void* src, unsigned int n) {
+    unsigned char* d = (unsigned char*)dst;
+    const unsigned char* s = (const unsigned char*)src;
+    while (n--) {
+        *d++ = *s++;
+    }
+    return dst;
+}
+
+void puts(const char* s) {
+    write(s, strlen(s));
+}
+
+void print_dec(unsigned int n) {
+    char buffer[10];
+    unsigned int i = sizeof(buffer);
+    do {
+        buffer[--i] = '0' + n % 10;
+        n /= 10;
+    } while (n);
+    write(buffer + i, sizeof(buffer) - i);
+}
@@ -0,0 +1,52 @@
+// ulib.h
+// System call wrappers and helpers for ring 3 programs
+
+#ifndef ULIB_H
+#define ULIB_H
+
+// System call numbers, shared with the kernel
+#include "../syscall.h"
+
+// Entry code shared by the kernel with every address space (paging.h)
+#define VSYSCALL_ADDR 0xF0000000
+
+// System calls
+void exit();
+int write(const char* buf, unsigned int len);
+int read(char* buf, unsigned int len);
+int getpid();
+void yield();
+void sleep(unsigned int ms);
+void* sbrk(int increment);
+int fcreate(const char* name);
+int fdelete(const char* name);
+int fread(const char* name, void* buf, unsigned int size);
+int fwrite(const char* name, const void* buf, unsigned int size);
+void flist();
+unsigned int uptime_ms();
+int fork();
+unsigned int memused_kb();
+int port_create();
+int msg_send(int port, unsigned int word0, unsigned int word1);
+int msg_post(int port, unsigned int word0, unsigned int word1);
+int msg_send_pages(int port, void* addr, unsigned int pages);
+int msg_recv(int port, struct ipc_msg* msg);
+int msg_reply(int port, unsigned int pid, int value);
+
+// Helpers
+unsigned int strlen(const char* s);
+void* memset(void* dst, int c, unsigned int n);
+void* memcpy(void* dst, const void* src, unsigned int n);
+void puts(const char* s);
+void print_dec(unsigned int n);
+
+static inline unsigned long long rdtsc() {
+    unsigned long long tsc;
+    asm volatile("rdtsc" : "=A"(tsc));
+    return tsc;
+}
+
+// Provided by the program
+int main();
+
+#endif
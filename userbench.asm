@@ -0,0 +1,103 @@
+; userbench.asm
+; Ring 3 program run by the 'syscallbench' command: times getpid round
+; trips through int 0x80 and through the vsyscall page, and prints the
+; average cost of each. syscall_bench() copies everything between
+; userbench_start and userbench_end to USER_CODE_BASE, so the code must
+; be position independent.
+
+[BITS 32]
+
+VSYSCALL_ADDR   equ 0xF0000000  ; paging.h
+SYS_EXIT        equ 0           ; syscall.h
+SYS_WRITE       equ 1
+SYS_GETPID      equ 3
+
+ROUNDS          equ 10000
+LABEL_LEN       equ 10
+
+section .text
+
+global userbench_start
+global userbench_end
+
+userbench_start:
+    call userbench_base
+userbench_base:
+    pop ebp             ; Runtime address of userbench_base, for the strings
+    
+    ; int 0x80
+    rdtsc
+    mov esi, eax
+    mov edi, ROUNDS
+.int80:
+    mov eax, SYS_GETPID
+    int 0x80
+    dec edi
+    jnz .int80
+    rdtsc
+    sub eax, esi
+    lea ebx, [ebp + label_int80 - userbench_base]
+    call report
+    
+    ; vsyscall page: SYSENTER when the CPU has it
+    rdtsc
+    mov esi, eax
+    mov edi, ROUNDS
+    mov edx, VSYSCALL_ADDR
+.vsyscall:
+    mov eax, SYS_GETPID
+    call edx
+    dec edi
+    jnz .vsyscall
+    rdtsc
+    sub eax, esi
+    lea ebx, [ebp + label_vsyscall - userbench_base]
+    call report
+    
+    mov eax, SYS_EXIT
+    int 0x80
+
+; Print the label at ebx, then eax / ROUNDS cycles per call
+report:
+    push eax
+    mov ecx, LABEL_LEN
+    mov eax, SYS_WRITE
+    int 0x80
+    pop eax
+    
+    xor edx, edx
+    mov ecx, ROUNDS
+    div ecx
+    
+    ; Decimal digits, last first, into a buffer on the stack
+    sub esp, 16
+    lea edi, [esp + 16]
+    mov ecx, 10
+.digit:
+    xor edx, edx
+    div ecx
+    add dl, '0'
+    dec edi
+    mov [edi], dl
+    test eax, eax
+    jnz .digit
+    
+    mov ebx, edi
+    lea ecx, [esp + 16]
+    sub ecx, edi
+    mov eax, SYS_WRITE
+    int 0x80
+    add esp, 16
+    
+    lea ebx, [ebp + label_cycles - userbench_base]
+    mov ecx, label_cycles_end - label_cycles
+    mov eax, SYS_WRITE
+    int 0x80
+    ret
+
+label_int80:    db "int 0x80: "
+label_vsyscall: db "vsyscall: "
+label_cycles:   db " cycles per round trip", 10
+label_cycles_end:
+
+userbench_end:
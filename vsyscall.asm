@@ -0,0 +1,46 @@
+; vsyscall.asm
+; System call entry code for ring 3. syscall_init() copies one of the two
+; variants to the vsyscall page, mapped read-only at VSYSCALL_ADDR in
+; every address space. Programs enter the kernel with
+;     call VSYSCALL_ADDR      ; eax = number, ebx/ecx/edx = arguments
+; and get the result in eax, whichever way the CPU supports. All other
+; registers are preserved. The code is copied, so it must be position
+; independent.
+
+[BITS 32]
+
+section .text
+
+global vsyscall_int80_start
+global vsyscall_int80_end
+global vsyscall_sysenter_start
+global vsyscall_sysenter_return
+global vsyscall_sysenter_end
+
+; Any CPU
+vsyscall_int80_start:
+    int 0x80
+    ret
+vsyscall_int80_end:
+
+; SYSENTER keeps neither the user stack nor the return address, and
+; SYSEXIT takes them back in ecx and edx. Those two arguments move to
+; esi and edi, the stack to ebp (see sysenter_entry in interrupt.asm).
+vsyscall_sysenter_start:
+    push ecx
+    push edx
+    push ebp
+    push esi
+    push edi
+    mov esi, ecx
+    mov edi, edx
+    mov ebp, esp
+    sysenter
+vsyscall_sysenter_return:
+    pop edi
+    pop esi
+    pop ebp
+    pop edx
+    pop ecx
+    ret
+vsyscall_sysenter_end:
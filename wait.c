@@ -0,0 +1,54 @@
+// wait.c
+
+#include "wait.h"
+#include "sched.h"
+
+void waitq_init(struct wait_queue* wq) {
+    spin_init(&wq->lock);
+    wq->head = 0;
+    wq->tail = 0;
+}
+
+// Block the current process on the queue. Must be called with interrupts
+// disabled and wq->lock held, after checking the condition being waited
+// for, so a wakeup between the check and the sleep cannot be lost.
+// The lock is held again on return.
+void waitq_sleep(struct wait_queue* wq) {
+    struct pcb* p = current_process;
+    p->run_next = 0;
+    if (wq->tail) {
+        wq->tail->run_next = p;
+    } else {
+        wq->head = p;
+    }
+    wq->tail = p;
+    
+    sched_block(&wq->lock);
+}
+
+// Wake the longest waiting process, if any, and return it.
+// Called with interrupts disabled and wq->lock held.
+struct pcb* waitq_wake_one(struct wait_queue* wq) {
+    struct pcb* p = wq->head;
+    if (!p) {
+        return 0;
+    }
+    
+    wq->head = p->run_next;
+    if (!wq->head) {
+        wq->tail = 0;
+    }
+    sched_wakeup(p);
+    return p;
+}
+
+// Wake every waiting process. Called with interrupts disabled and
+// wq->lock held.
+void waitq_wake_all(struct wait_queue* wq) {
+    while (waitq_wake_one(wq)) {
+    }
+}
+
+int waitq_empty(struct wait_queue* wq) {
+    return wq->head == 0;
+}
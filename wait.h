@@ -0,0 +1,25 @@
+// wait.h
+
+#ifndef WAIT_H
+#define WAIT_H
+
+#include "process.h"
+#include "spinlock.h"
+
+// FIFO of processes blocked on some event. Sleepers are linked through
+// their run_next field, which is unused while they are blocked. The
+// lock also protects whatever condition the sleepers wait for.
+struct wait_queue {
+    struct spinlock lock;
+    struct pcb* head;
+    struct pcb* tail;
+};
+
+// Functions
+void waitq_init(struct wait_queue* wq);
+void waitq_sleep(struct wait_queue* wq);
+struct pcb* waitq_wake_one(struct wait_queue* wq);
+void waitq_wake_all(struct wait_queue* wq);
+int waitq_empty(struct wait_queue* wq);
+
+#endif